@@ -2,16 +2,90 @@
  * Algorithm 2.2.3T @ TAOCP::p.265
  *
  * author: Forrest Y. Yu <forrest.yu@gmail.com>, http://forrestyu.net/
+ *
+ * compile and run:
+ *         $ gcc -O2 -Wall -o topo p.265_Topological_sort.c -pthread
+ *         $ ./topo
+ *     sorts the example of the book (TAOCP p.264 (18)) with Algorithm_T().
+ *
+ * sort it level by level on 4 threads (see topo_levels()), the objects of
+ * every level in increasing order:
+ *         $ ./topo -p 4 -o
+ *
+ * add the pair 4 ≺ 2 to it, then try 6 ≺ 1, which would make a loop, and
+ * remove 9 ≺ 2; the order is repaired after every change (see dyn_insert()):
+ *         $ ./topo -a 4:2 -a 6:1 -r 9:2
+ *
+ * sort it with the pairs 6 ≺ 1 and 8 ≺ 9 too, which make loops; what can
+ * be sorted is written, and a loop is shown (see topo_loops()):
+ *         $ ./topo -x 6:1 -x 8:9
+ *
+ * what every object of it reaches, and which pairs are left in its
+ * transitive reduction, if 1 ≺ 5 is added (see closure_build()):
+ *         $ ./topo -x 1:5 -t
+ *
+ * schedule it, if object k is a job which takes k units of time: the
+ * earliest and latest starts, the slack and the critical path (see
+ * topo_schedule()):
+ *         $ ./topo -e
+ *
+ * the smallest object first whenever there is a choice, which makes the
+ * lexicographically smallest order, and the jobs by their latest starts
+ * (see topo_priority()):
+ *         $ ./topo -L
+ *
+ * benchmark the linked TOP[]/NEXT form of the book against the compressed
+ * sparse row form (see struct graph) on a random DAG of 10^7 objects and
+ * 5*10^7 pairs:
+ *         $ ./topo -b 10000000 50000000 [-s seed] [-p threads [-o]] [-u changes]
+ * or with 10 pairs which make loops:
+ *         $ ./topo -b 10000000 50000000 -c 10
+ *
+ * sort the pairs of a file, a pair ``j k'' on every line (or binary, see
+ * graph_load()), which is read on 4 threads; the order is written one object
+ * on a line:
+ *         $ ./topo -b 10000000 50000000 -W pairs.bin
+ *         $ ./topo -i pairs.bin -p 4 > order
+ *
+ * or with the pairs on the disk, in runs of 64 MB, and only COUNT in memory
+ * (see ext_sort()):
+ *         $ ./topo -E pairs.bin -M 64 > order
+ *
+ * run 10^6 jobs of a wide and of a deep DAG on 1, 2, 4 and 8 threads which
+ * steal jobs from each other (see exec_run()):
+ *         $ ./topo -J 1000000 -p 8
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <assert.h>
 
 /* if no more X pairs are acceptable, then LIMIT=(X+2)*2 */
 #define LIMIT		24	/* X=10 */
 #define NODE_POOL_SIZE	16
 
+#define LEVEL_CHUNK	256	/* objects of a level taken by a thread at a time */
+#define LEVEL_BUF	256	/* objects of the next level kept by a thread */
+
+#define EXEC_LEVELS	10	/* of the wide DAG of ``-J'' */
+#define EXEC_CHAINS	8	/* of the deep DAG of ``-J'' */
+#define EXEC_WORK	1000	/* spins of a job of ``-J'', besides empty ones */
+#define EXEC_BATCH	64	/* jobs run by a thread before it says so */
+
+#define UPDATE_INSERTS	3	/* new pairs for every removed pair, see ``-u'' */
+#define UPDATE_WINDOW	64
+
+#define LOOP_PRINT	24	/* objects of a loop printed, see print_loops() */
+
 struct Node {
 	unsigned int	SUC;
 	struct Node *	NEXT;
@@ -22,6 +96,28 @@ union CQ {
 	unsigned int	QLINK;
 };
 
+/** the relations j ≺ k of the input, in a growable array, so that there is
+ *  no LIMIT to the number of pairs, see add_pair()
+ */
+struct pairs {
+	unsigned int	n;		/* the objects are 1..n */
+	size_t		nr;		/* number of pairs */
+	size_t		max;
+	unsigned int *	jk;		/* jk[2*i] ≺ jk[2*i+1] */
+};
+
+/** the successors of every object in compressed sparse row form: those of k
+ *  are SUC[TOP[k]] .. SUC[TOP[k+1]-1], in the order in which the linked
+ *  TOP[k] of the book would give them, see graph_build()
+ */
+struct graph {
+	unsigned int	n;
+	size_t		m;		/* number of pairs */
+	size_t *	TOP;		/* TOP[n + 2] */
+	unsigned int *	SUC;		/* SUC[m] */
+	unsigned int *	COUNT;		/* COUNT[n + 1]: the predecessors of k */
+};
+
 struct Node * AllocNode()
 {
 	static struct Node NodePool[NODE_POOL_SIZE];
@@ -136,23 +232,3284 @@ void Algorithm_T(const unsigned int topo_input[])
 	return;
 }
 
-int main()
+/****************************************************************************************************
+ * Large inputs. Algorithm_T() above follows the book: at most LIMIT numbers
+ * of input, and a node of NodePool[] for every pair. For millions of pairs:
+ *
+ *     struct pairs     the input, in one array which doubles when it is full
+ *     struct graph     the successors in compressed sparse row form, built
+ *                      from the pairs in two counting passes (graph_build()):
+ *                      one array for all the successors, no node per pair
+ *     topo_sort()      T4-T7 on the arrays of the graph
+ *
+ * topo_linked() is T2-T7 of the book on TOP[] and NEXT, with all the nodes
+ * in one array, to be compared with them (``-b'').
+ ****************************************************************************************************/
+void pairs_init(struct pairs * P)
 {
-	const unsigned int input[LIMIT] = {0, 9, /* (0,n) */
-					   9, 2,
-					   3, 7,
-					   7, 5,
-					   5, 8,
-					   8, 6,
-					   4, 6,
-					   1, 3,
-					   7, 4,
-					   9, 5,
-					   2, 8,
-					   0, 0}; /* (0,0) terminates the input */
+	P->n   = 0;
+	P->nr  = 0;
+	P->max = 0;
+	P->jk  = 0;
+}
 
-	Algorithm_T(input);
+void pairs_free(struct pairs * P)
+{
+	free(P->jk);
+	pairs_init(P);
+}
 
-	return 0;
+/* j ≺ k */
+void add_pair(struct pairs * P, unsigned int j, unsigned int k)
+{
+	assert(j > 0 && k > 0);
+	if (P->nr == P->max) {
+		P->max = P->max ? P->max * 2 : 1024;
+		P->jk = (unsigned int *)realloc(P->jk, sizeof(unsigned int) * 2 * P->max);
+		assert(P->jk);
+	}
+	P->jk[2 * P->nr]     = j;
+	P->jk[2 * P->nr + 1] = k;
+	P->nr++;
+	if (j > P->n)
+		P->n = j;
+	if (k > P->n)
+		P->n = k;
+}
+
+/* the pairs of the input of Algorithm_T() */
+void input_pairs(struct pairs * P, const unsigned int topo_input[])
+{
+	int i;
+
+	assert(topo_input[0] == 0);
+	for (i = 1; i < LIMIT / 2 && topo_input[i*2]; i++)
+		add_pair(P, topo_input[i*2], topo_input[i*2+1]);
+	if (topo_input[1] > P->n)
+		P->n = topo_input[1];
+}
+
+/** T1-T3 in two passes over the pairs: the first one counts the successors
+ *  and the predecessors of every object, the second one puts every successor
+ *  into its place. The successors of j are put from the end of its row, so
+ *  that they come in the order of the linked list of the book, to which T3
+ *  prepends them.
+ */
+void graph_build(struct graph * g, const struct pairs * P)
+{
+	unsigned int n = P->n;
+	size_t i;
+	unsigned int k;
+
+	g->n     = n;
+	g->m     = P->nr;
+	g->TOP   = (size_t *)calloc(n + 2, sizeof(size_t));
+	g->SUC   = (unsigned int *)malloc(sizeof(unsigned int) * (P->nr ? P->nr : 1));
+	g->COUNT = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	assert(g->TOP && g->SUC && g->COUNT);
+
+	/* pass 1: TOP[j + 1] is the number of successors of j */
+	for (i = 0; i < P->nr; i++) {
+		g->TOP[P->jk[2 * i] + 1]++;
+		g->COUNT[P->jk[2 * i + 1]]++;
+	}
+	/* TOP[k + 1] is the end of row k */
+	for (k = 1; k <= n; k++)
+		g->TOP[k + 1] += g->TOP[k];
+
+	/* pass 2: TOP[j + 1] goes back to the beginning of row j */
+	for (i = 0; i < P->nr; i++)
+		g->SUC[--g->TOP[P->jk[2 * i] + 1]] = P->jk[2 * i + 1];
+	memmove(g->TOP + 1, g->TOP + 2, sizeof(size_t) * n);
+	g->TOP[n + 1] = P->nr;
+}
+
+void graph_free(struct graph * g)
+{
+	free(g->TOP);
+	free(g->SUC);
+	free(g->COUNT);
+}
+
+/** T4-T7 on the graph: writes the objects to out[] in topological order, and
+ *  returns how many of them there are, which is less than n if there is a
+ *  loop (see T8)
+ */
+unsigned int topo_sort(const struct graph * g, unsigned int * out)
+{
+	unsigned int n = g->n;
+	unsigned int N = 0;
+	unsigned int k;
+	union CQ * cq = (union CQ *)malloc(sizeof(union CQ) * (n + 1));
+
+	assert(cq);
+	for (k = 1; k <= n; k++)
+		cq[k].COUNT = g->COUNT[k];
+
+	/***** T4 *****/
+	unsigned int R = 0;
+	cq[0].QLINK = 0;
+	for (k = 1; k <= n; k++) {
+		if (cq[k].COUNT == 0) {
+			cq[R].QLINK = k;
+			R = k;
+		}
+	}
+	unsigned int F = cq[0].QLINK;
+
+	while (F) {
+		/***** T5 *****/
+		out[N++] = F;
+
+		/***** T6 *****/
+		const unsigned int * P   = g->SUC + g->TOP[F];
+		const unsigned int * end = g->SUC + g->TOP[F + 1];
+		for (; P < end; P++) {
+			if (--cq[*P].COUNT == 0) {
+				cq[R].QLINK = *P;
+				R = *P;
+			}
+		}
+
+		/***** T7 *****/
+		/* COUNT[R] == QLINK[R] == 0: the queue ends at R */
+		F = cq[F].QLINK;
+	}
+
+	free(cq);
+	return N;
+}
+
+/* T2-T7 of the book, with a node of the array nodes[] for every pair */
+unsigned int topo_linked(const struct pairs * P, unsigned int * out)
+{
+	unsigned int n = P->n;
+	unsigned int N = 0;
+	unsigned int k;
+	size_t i;
+	union CQ * cq = (union CQ *)calloc(n + 1, sizeof(union CQ));
+	struct Node ** TOP = (struct Node **)calloc(n + 1, sizeof(struct Node *));
+	struct Node * nodes = (struct Node *)malloc(sizeof(struct Node) * (P->nr ? P->nr : 1));
+
+	assert(cq && TOP && nodes);
+
+	/***** T2, T3 *****/
+	for (i = 0; i < P->nr; i++) {
+		unsigned int j = P->jk[2 * i];
+		struct Node * p = &nodes[i];
+		cq[P->jk[2 * i + 1]].COUNT++;
+		p->SUC  = P->jk[2 * i + 1];
+		p->NEXT = TOP[j];
+		TOP[j]  = p;
+	}
+
+	/***** T4 *****/
+	unsigned int R = 0;
+	cq[0].QLINK = 0;
+	for (k = 1; k <= n; k++) {
+		if (cq[k].COUNT == 0) {
+			cq[R].QLINK = k;
+			R = k;
+		}
+	}
+	unsigned int F = cq[0].QLINK;
+
+	while (F) {
+		/***** T5 *****/
+		out[N++] = F;
+
+		/***** T6 *****/
+		struct Node * p;
+		for (p = TOP[F]; p; p = p->NEXT) {
+			if (--cq[p->SUC].COUNT == 0) {
+				cq[R].QLINK = p->SUC;
+				R = p->SUC;
+			}
+		}
+
+		/***** T7 *****/
+		F = cq[F].QLINK;
+	}
+
+	free(cq);
+	free(TOP);
+	free(nodes);
+	return N;
+}
+
+/* is out[0..N-1] a topological order of all the objects of the pairs? */
+int topo_check(const struct pairs * P, const unsigned int * out, unsigned int N)
+{
+	unsigned int * pos = (unsigned int *)calloc(P->n + 1, sizeof(unsigned int));
+	unsigned int i;
+	size_t e;
+	int ok = (N == P->n);
+
+	assert(pos);
+	for (i = 0; ok && i < N; i++) {
+		if (out[i] < 1 || out[i] > P->n || pos[out[i]])
+			ok = 0;
+		else
+			pos[out[i]] = i + 1;
+	}
+	for (e = 0; ok && e < P->nr; e++)
+		if (pos[P->jk[2 * e]] >= pos[P->jk[2 * e + 1]])
+			ok = 0;
+	free(pos);
+	return ok;
+}
+
+/****************************************************************************************************
+ * Loops. If topo_sort() writes fewer than n objects (T8), the others are
+ * left with COUNT > 0: they are on a loop, or after one. topo_loops() says
+ * which ones, in linear time and without recursion:
+ *
+ *     one loop       as in exercise 2.2.3-23: QLINK[k] is set to one of the
+ *                    predecessors of k which are left, and going from QLINK
+ *                    to QLINK must come back to an object seen before
+ *     components     the strongly connected components of the objects left
+ *                    (Tarjan's algorithm, with a stack of its own), every
+ *                    one with more than one object (or a pair k ≺ k) being
+ *                    a knot of loops which has to be broken
+ ****************************************************************************************************/
+struct loops {
+	unsigned int	left_nr;	/* objects left with COUNT > 0 */
+	unsigned int *	left;		/* left[0..left_nr-1] */
+	unsigned int *	loop;		/* loop[0] ≺ loop[1] ≺ ... ≺ loop[0] */
+	unsigned int	loop_nr;
+	unsigned int *	comp;		/* comp[k]: the component of k, 1.., 0 if output */
+	unsigned int	comp_nr;
+	unsigned int	knot_nr;	/* components with a loop */
+	unsigned int	largest;	/* objects in the largest one */
+	unsigned int	largest_comp;
+};
+
+/* the loops of g, of which topo_sort() has written out[0..N-1] */
+void topo_loops(const struct graph * g, const unsigned int * out, unsigned int N,
+		struct loops * L)
+{
+	unsigned int n = g->n;
+	unsigned int * QLINK = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	unsigned int * index = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	unsigned int * low   = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * stack = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * call  = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	size_t * next        = (size_t *)malloc(sizeof(size_t) * (n + 1));
+	unsigned int i, j, k;
+	unsigned int sp = 0, cp = 0, idx = 0;
+	size_t p;
+
+	L->left    = (unsigned int *)malloc(sizeof(unsigned int) * (n - N + 1));
+	L->loop    = (unsigned int *)malloc(sizeof(unsigned int) * (n - N + 1));
+	L->comp    = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	assert(QLINK && index && low && stack && call && next &&
+	       L->left && L->loop && L->comp);
+	L->left_nr = 0;
+	L->loop_nr = 0;
+	L->comp_nr = 0;
+	L->knot_nr = 0;
+	L->largest = 0;
+	L->largest_comp = 0;
+
+	/* index[k] == 1 for the objects written, for a while */
+	for (i = 0; i < N; i++)
+		index[out[i]] = 1;
+	for (k = 1; k <= n; k++)
+		if (!index[k])
+			L->left[L->left_nr++] = k;
+
+	/***** ex.23: a predecessor left of every object left *****/
+	for (i = 0; i < L->left_nr; i++) {
+		j = L->left[i];
+		for (p = g->TOP[j]; p < g->TOP[j + 1]; p++)
+			QLINK[g->SUC[p]] = j;
+	}
+	if (L->left_nr) {
+		/* low[] is the step at which k is met, 0 if never */
+		for (i = 0; i < L->left_nr; i++)
+			low[L->left[i]] = 0;
+		k = L->left[0];
+		for (i = 1; !low[k]; i++) {
+			low[k] = i;
+			k = QLINK[k];
+			assert(k);	/* every object left has a predecessor left */
+		}
+		/* k is met again: k, QLINK[k], ... back to k, backwards */
+		j = k;
+		do {
+			L->loop[L->loop_nr++] = j;
+			j = QLINK[j];
+		} while (j != k);
+		for (i = 0; i < L->loop_nr / 2; i++) {
+			unsigned int t = L->loop[i];
+			L->loop[i] = L->loop[L->loop_nr - 1 - i];
+			L->loop[L->loop_nr - 1 - i] = t;
+		}
+	}
+
+	/***** Tarjan: index[k] is 1 + the order in which k is found *****/
+	for (i = 0; i < L->left_nr; i++)
+		index[L->left[i]] = 0;
+	idx = 1;	/* index 1 is taken by the objects written */
+	for (i = 0; i < L->left_nr; i++) {
+		if (index[L->left[i]])
+			continue;
+		call[cp++] = L->left[i];
+		index[L->left[i]] = low[L->left[i]] = ++idx;
+		stack[sp++] = L->left[i];
+		next[L->left[i]] = g->TOP[L->left[i]];
+		while (cp) {
+			unsigned int v = call[cp - 1];
+			if (next[v] < g->TOP[v + 1]) {
+				unsigned int w = g->SUC[next[v]++];
+				if (index[w] == 1)
+					continue;	/* written, not on a loop */
+				if (!index[w]) {
+					index[w] = low[w] = ++idx;
+					stack[sp++] = w;
+					next[w] = g->TOP[w];
+					call[cp++] = w;
+				}
+				else if (!L->comp[w] && index[w] < low[v]) {
+					low[v] = index[w];	/* w is on the stack */
+				}
+				continue;
+			}
+			/* v is done */
+			cp--;
+			if (cp && low[v] < low[call[cp - 1]])
+				low[call[cp - 1]] = low[v];
+			if (low[v] == index[v]) {
+				unsigned int size = 0;
+				int knot;
+				L->comp_nr++;
+				do {
+					k = stack[--sp];
+					L->comp[k] = L->comp_nr;
+					size++;
+				} while (k != v);
+				knot = size > 1;
+				for (p = g->TOP[v]; !knot && p < g->TOP[v + 1]; p++)
+					knot = (g->SUC[p] == v);
+				if (knot)
+					L->knot_nr++;
+				if (knot && size > L->largest) {
+					L->largest = size;
+					L->largest_comp = L->comp_nr;
+				}
+			}
+		}
+	}
+
+	free(QLINK);
+	free(index);
+	free(low);
+	free(stack);
+	free(call);
+	free(next);
+}
+
+void loops_free(struct loops * L)
+{
+	free(L->left);
+	free(L->loop);
+	free(L->comp);
+}
+
+/* 1 if L->loop is a loop of g, all in the largest knot or in a knot like it */
+int loops_check(const struct graph * g, const struct loops * L)
+{
+	unsigned int i;
+	size_t p;
+
+	if (!L->left_nr)
+		return !L->loop_nr && !L->knot_nr;
+	if (!L->loop_nr || !L->knot_nr)
+		return 0;
+	for (i = 0; i < L->loop_nr; i++) {
+		unsigned int j = L->loop[i];
+		unsigned int k = L->loop[(i + 1) % L->loop_nr];
+		for (p = g->TOP[j]; p < g->TOP[j + 1] && g->SUC[p] != k; p++)
+			;
+		if (p == g->TOP[j + 1] || L->comp[j] != L->comp[L->loop[0]])
+			return 0;
+	}
+	return 1;
+}
+
+/* the report of topo_loops(), at most max objects of a list */
+void print_loops(FILE * f, const struct loops * L, unsigned int max)
+{
+	unsigned int i;
+
+	fprintf(f, "%u objects are left with COUNT > 0, %u knot%s of loops "
+	       "(the largest of %u object%s).\n",
+	       L->left_nr, L->knot_nr, L->knot_nr == 1 ? "" : "s", L->largest,
+	       L->largest == 1 ? "" : "s");
+	fprintf(f, "a loop of %u: ", L->loop_nr);
+	for (i = 0; i < L->loop_nr && i < max; i++)
+		fprintf(f, "%u ≺ ", L->loop[i]);
+	if (L->loop_nr > max)
+		fprintf(f, "... ≺ ");
+	fprintf(f, "%u.\n", L->loop[0]);
+}
+
+/****************************************************************************************************
+ * Schedules (``-e''). If object k is a job which takes weight[k] units of
+ * time, and j ≺ k means that k cannot start before j is done, then
+ *
+ *     ES[k]    the earliest start of k, the largest ES[j] + weight[j] of its
+ *              predecessors j, or 0
+ *     LS[k]    the latest start of k which does not delay the end of all the
+ *              jobs, the length of the schedule
+ *     slack    LS[k] - ES[k]; the jobs without slack are on a critical path
+ *     level    as in topo_levels(): 0 without predecessors, else one more
+ *              than the largest level of the predecessors
+ *
+ * topo_schedule() is topo_sort() with ES[] and level[] of the successors
+ * raised in T6, when the row of F is gone through anyway, so that they cost
+ * no other pass over the pairs; they are kept next to COUNT of the object
+ * (struct sched_node), so that a successor is one miss of the cache, not
+ * four. LS[] is then found by one pass backwards
+ * over the output and the rows, and the critical path by going back from
+ * the job which ends last, through the predecessors which gave ES[].
+ ****************************************************************************************************/
+struct schedule {
+	uint64_t *	ES;		/* [n + 1] */
+	uint64_t *	LS;		/* [n + 1] */
+	unsigned int *	level;		/* [n + 1] */
+	unsigned int *	before;		/* before[k]: the predecessor which gave ES[k], or 0 */
+	uint64_t	length;		/* the end of the last job */
+	unsigned int	level_nr;
+	unsigned int *	path;		/* the critical path, path[0] ≺ path[1] ≺ ... */
+	unsigned int	path_nr;
+};
+
+/* what T6 changes for a successor, in one place of memory */
+struct sched_node {
+	uint64_t	ES;
+	union CQ	cq;
+	unsigned int	level;
+	unsigned int	before;
+};
+
+/** T4-T7 as in topo_sort(), and the schedule of the objects written if they
+ *  take weight[1..n] units of time
+ */
+unsigned int topo_schedule(const struct graph * g, const unsigned int * weight,
+			   unsigned int * out, struct schedule * S)
+{
+	unsigned int n = g->n;
+	unsigned int N = 0;
+	unsigned int i, k;
+	struct sched_node * x = (struct sched_node *)malloc(sizeof(struct sched_node) * (n + 1));
+	uint64_t length = 0;
+	unsigned int last = 0;
+
+	assert(x);
+	for (k = 1; k <= n; k++) {
+		x[k].ES       = 0;
+		x[k].cq.COUNT = g->COUNT[k];
+		x[k].level    = 0;
+		x[k].before   = 0;
+	}
+
+	/***** T4 *****/
+	unsigned int R = 0;
+	x[0].cq.QLINK = 0;
+	for (k = 1; k <= n; k++) {
+		if (x[k].cq.COUNT == 0) {
+			x[R].cq.QLINK = k;
+			R = k;
+		}
+	}
+	unsigned int F = x[0].cq.QLINK;
+
+	while (F) {
+		/***** T5 *****/
+		out[N++] = F;
+		uint64_t EF = x[F].ES + weight[F];	/* F is done at EF */
+		unsigned int up = x[F].level + 1;
+		if (EF > length || !last) {
+			length = EF;
+			last = F;
+		}
+
+		/***** T6 *****/
+		const unsigned int * P   = g->SUC + g->TOP[F];
+		const unsigned int * end = g->SUC + g->TOP[F + 1];
+		for (; P < end; P++) {
+			struct sched_node * s = x + *P;
+			if (EF > s->ES || !s->before) {
+				s->ES = EF;
+				s->before = F;
+			}
+			if (up > s->level)
+				s->level = up;
+			if (--s->cq.COUNT == 0) {
+				x[R].cq.QLINK = *P;
+				R = *P;
+			}
+		}
+
+		/***** T7 *****/
+		F = x[F].cq.QLINK;
+	}
+
+	S->ES     = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+	S->LS     = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+	S->level  = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	S->before = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	assert(S->ES && S->LS && S->level && S->before);
+	for (k = 0; k <= n; k++) {
+		S->ES[k]     = x[k].ES;
+		S->LS[k]     = UINT64_MAX;	/* left on a loop, if not written */
+		S->level[k]  = x[k].level;
+		S->before[k] = x[k].before;
+	}
+	S->ES[0] = S->level[0] = S->before[0] = 0;
+	free(x);
+
+	/* LS backwards: a job must be done when its first successor starts */
+	S->level_nr = 0;
+	for (i = N; i-- > 0; ) {
+		uint64_t LF = length;
+		const unsigned int * P;
+		k = out[i];
+		for (P = g->SUC + g->TOP[k]; P < g->SUC + g->TOP[k + 1]; P++)
+			if (S->LS[*P] < LF)
+				LF = S->LS[*P];
+		S->LS[k] = LF - weight[k];
+		if (S->level[k] + 1 > S->level_nr)
+			S->level_nr = S->level[k] + 1;
+	}
+
+	S->length  = length;
+	S->path_nr = 0;
+	for (k = last; k; k = S->before[k])
+		S->path_nr++;
+	S->path = (unsigned int *)malloc(sizeof(unsigned int) * (S->path_nr + 1));
+	assert(S->path);
+	for (i = S->path_nr, k = last; k; k = S->before[k])
+		S->path[--i] = k;
+	return N;
+}
+
+void schedule_free(struct schedule * S)
+{
+	free(S->ES);
+	free(S->LS);
+	free(S->level);
+	free(S->before);
+	free(S->path);
+}
+
+void print_schedule(const struct schedule * S, const unsigned int * weight,
+		    const unsigned int * out, unsigned int N)
+{
+	unsigned int i, k;
+
+	printf("%6s %8s %6s %10s %10s %10s\n", "object", "weight", "level",
+	       "ES", "LS", "slack");
+	for (i = 0; i < N; i++) {
+		k = out[i];
+		printf("%6u %8u %6u %10llu %10llu %10llu%s\n", k, weight[k],
+		       S->level[k], (unsigned long long)S->ES[k],
+		       (unsigned long long)S->LS[k],
+		       (unsigned long long)(S->LS[k] - S->ES[k]),
+		       S->LS[k] == S->ES[k] ? "  *" : "");
+	}
+	printf("critical path (%llu units, %u levels): ",
+	       (unsigned long long)S->length, S->level_nr);
+	for (i = 0; i < S->path_nr; i++)
+		printf("%s%u", i ? " ≺ " : "", S->path[i]);
+	printf(".\n");
+}
+
+/****************************************************************************************************
+ * Priorities (``-L''). With the queue of T4-T7 replaced by one which gives
+ * the smallest object first, the order is the lexicographically smallest
+ * one; with a priority of every object, the objects which are ready come
+ * in the order of their priorities. The keys are the ranks 0..n-1 of the
+ * objects, by priority and then by number (priority_ranks(), a radix sort),
+ * so that a key is an integer below n, and the queue is a tree of bits:
+ *
+ *     struct bitq    level 0 has a bit for every key, and a bit of level
+ *                    i+1 says whether a word of 64 bits of level i is not 0;
+ *                    the minimum is found by going down from the top word
+ *                    with a count of trailing zeros at every level, so that
+ *                    a push or a pop is ceil(log_64 n) words, 4 for 16M keys
+ *
+ * (A radix heap would want the keys to come out in increasing order, which
+ * they do not here: an object made ready may be smaller than the one which
+ * was taken.) topo_heap() is the same with a binary heap, to compare.
+ ****************************************************************************************************/
+#define BITQ_LEVELS	6		/* 64^6 keys */
+
+struct bitq {
+	int		top;		/* the level of one word */
+	uint64_t *	level[BITQ_LEVELS];
+};
+
+void bitq_init(struct bitq * Q, unsigned int size)
+{
+	size_t words = ((size_t)size + 63) / 64;
+
+	for (Q->top = 0; ; Q->top++) {
+		assert(Q->top < BITQ_LEVELS);
+		Q->level[Q->top] = (uint64_t *)calloc(words ? words : 1, sizeof(uint64_t));
+		assert(Q->level[Q->top]);
+		if (words <= 1)
+			break;
+		words = (words + 63) / 64;
+	}
+}
+
+void bitq_free(struct bitq * Q)
+{
+	int i;
+
+	for (i = 0; i <= Q->top; i++)
+		free(Q->level[i]);
+}
+
+void bitq_push(struct bitq * Q, unsigned int x)
+{
+	int i;
+
+	for (i = 0; i <= Q->top; i++) {
+		uint64_t w = Q->level[i][x >> 6];
+		Q->level[i][x >> 6] = w | (uint64_t)1 << (x & 63);
+		if (w)
+			break;		/* the levels above know already */
+		x >>= 6;
+	}
+}
+
+/* the smallest key, which is taken out; the queue must not be empty */
+unsigned int bitq_pop(struct bitq * Q)
+{
+	unsigned int x = 0;
+	unsigned int y;
+	int i;
+
+	for (i = Q->top; i >= 0; i--)
+		x = (x << 6) | __builtin_ctzll(Q->level[i][x]);
+	for (i = 0, y = x; i <= Q->top; i++) {
+		if ((Q->level[i][y >> 6] &= ~((uint64_t)1 << (y & 63))) != 0)
+			break;
+		y >>= 6;
+	}
+	return x;
 }
 
+int bitq_empty(const struct bitq * Q)
+{
+	return Q->level[Q->top][0] == 0;
+}
+
+/** rank[k]: the place of object k (0..n-1) if they are sorted by prio[k],
+ *  the smaller numbers first if the priorities are the same, at[] the
+ *  objects in that order; prio == 0 for the numbers only
+ */
+void priority_ranks(unsigned int n, const unsigned int * prio,
+		    unsigned int * rank, unsigned int * at)
+{
+	unsigned int * tmp;
+	size_t * start;
+	unsigned int k, i;
+	size_t sum;
+	int shift;
+
+	for (k = 1; k <= n; k++)
+		at[k - 1] = k;
+	if (prio) {
+		/* two stable passes of 16 bits: the numbers stay in order */
+		tmp   = (unsigned int *)malloc(sizeof(unsigned int) * (n ? n : 1));
+		start = (size_t *)malloc(sizeof(size_t) * 65536);
+		assert(tmp && start);
+		for (shift = 0; shift < 32; shift += 16) {
+			memset(start, 0, sizeof(size_t) * 65536);
+			for (i = 0; i < n; i++)
+				start[(prio[at[i]] >> shift) & 0xFFFF]++;
+			for (i = 0, sum = 0; i < 65536; i++) {
+				size_t c = start[i];
+				start[i] = sum;
+				sum += c;
+			}
+			for (i = 0; i < n; i++)
+				tmp[start[(prio[at[i]] >> shift) & 0xFFFF]++] = at[i];
+			memcpy(at, tmp, sizeof(unsigned int) * n);
+		}
+		free(tmp);
+		free(start);
+	}
+	for (i = 0; i < n; i++)
+		rank[at[i]] = i;
+}
+
+/** T4-T7 with the objects which are ready taken by rank[], smallest first,
+ *  at[] being its inverse (see priority_ranks()); returns N as topo_sort().
+ *  COUNT and the rank of an object are kept in one word, which T6 reads
+ *  anyway, rank << 32 | COUNT
+ */
+unsigned int topo_priority(const struct graph * g, const unsigned int * rank,
+			   const unsigned int * at, unsigned int * out)
+{
+	unsigned int n = g->n;
+	unsigned int N = 0;
+	unsigned int k;
+	uint64_t * cr = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+	struct bitq Q;
+
+	assert(cr);
+	bitq_init(&Q, n);
+
+	/***** T4 *****/
+	for (k = 1; k <= n; k++) {
+		cr[k] = (uint64_t)rank[k] << 32 | g->COUNT[k];
+		if (g->COUNT[k] == 0)
+			bitq_push(&Q, rank[k]);
+	}
+
+	while (!bitq_empty(&Q)) {
+		/***** T5 *****/
+		unsigned int F = at[bitq_pop(&Q)];
+		out[N++] = F;
+
+		/***** T6 *****/
+		const unsigned int * P   = g->SUC + g->TOP[F];
+		const unsigned int * end = g->SUC + g->TOP[F + 1];
+		for (; P < end; P++)
+			if ((uint32_t)--cr[*P] == 0)
+				bitq_push(&Q, cr[*P] >> 32);
+	}
+
+	bitq_free(&Q);
+	free(cr);
+	return N;
+}
+
+/* the same with a binary heap of the ranks */
+unsigned int topo_heap(const struct graph * g, const unsigned int * rank,
+		       const unsigned int * at, unsigned int * out)
+{
+	unsigned int n = g->n;
+	unsigned int N = 0;
+	unsigned int k, h = 0;
+	unsigned int * count = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * heap  = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+
+	assert(count && heap);
+	memcpy(count, g->COUNT, sizeof(unsigned int) * (n + 1));
+	for (k = 1; k <= n; k++) {
+		if (count[k] == 0) {
+			unsigned int c = h++;
+			for (; c && heap[(c - 1) / 2] > rank[k]; c = (c - 1) / 2)
+				heap[c] = heap[(c - 1) / 2];
+			heap[c] = rank[k];
+		}
+	}
+	while (h) {
+		unsigned int F = at[heap[0]];
+		unsigned int x = heap[--h];
+		unsigned int c = 0;
+		const unsigned int * P;
+		while (2 * c + 1 < h) {
+			unsigned int d = 2 * c + 1;
+			if (d + 1 < h && heap[d + 1] < heap[d])
+				d++;
+			if (heap[d] >= x)
+				break;
+			heap[c] = heap[d];
+			c = d;
+		}
+		if (h)
+			heap[c] = x;
+		out[N++] = F;
+		for (P = g->SUC + g->TOP[F]; P < g->SUC + g->TOP[F + 1]; P++) {
+			if (--count[*P] == 0) {
+				c = h++;
+				for (; c && heap[(c - 1) / 2] > rank[*P]; c = (c - 1) / 2)
+					heap[c] = heap[(c - 1) / 2];
+				heap[c] = rank[*P];
+			}
+		}
+	}
+	free(count);
+	free(heap);
+	return N;
+}
+
+/****************************************************************************************************
+ * Levels (``-p threads''). Level 0 is the objects without predecessors, and
+ * level i+1 is the objects whose last predecessor is in level i, i.e. what
+ * T4 finds first, and then what T6 finds while the queue goes through level
+ * i. topo_levels() does T5-T7 for a whole level at once on several threads:
+ *
+ *     - the threads take LEVEL_CHUNK objects of the level at a time, and
+ *       decrease COUNT of their successors atomically, so that exactly one
+ *       thread sees a COUNT become 0
+ *     - such an object is kept in a buffer of the thread, and LEVEL_BUF of
+ *       them at a time are appended to out[] by one atomic add to its end
+ *     - the threads wait for each other at a barrier after every level
+ *
+ * The order of a level in out[] is then the order in which the threads came,
+ * unless ``-o'' is given, with which every level is sorted, so that the
+ * output is the same for any number of threads.
+ ****************************************************************************************************/
+struct levels_job {
+	const struct graph *	g;
+	unsigned int *		count;		/* COUNT[n + 1], decreased atomically */
+	unsigned int *		out;
+	unsigned int		lo;		/* the level being done is out[lo..hi-1] */
+	unsigned int		hi;
+	unsigned int		next;		/* the next chunk, from lo */
+	unsigned int		tail;		/* the end of the next level */
+	unsigned int *		level;		/* level i is out[level[i]..level[i+1]-1] */
+	unsigned int		level_nr;
+	int			ordered;
+	pthread_barrier_t	barrier;
+};
+
+int cmp_uint(const void * a, const void * b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+/* appends buf[0..nr-1] to the next level */
+void levels_flush(struct levels_job * J, const unsigned int * buf, unsigned int nr)
+{
+	unsigned int pos = __atomic_fetch_add(&J->tail, nr, __ATOMIC_RELAXED);
+	memcpy(J->out + pos, buf, sizeof(unsigned int) * nr);
+}
+
+void * levels_worker(void * arg)
+{
+	struct levels_job * J = (struct levels_job *)arg;
+	const struct graph * g = J->g;
+	unsigned int buf[LEVEL_BUF];
+	unsigned int nr = 0;
+	unsigned int i;
+
+	while (J->lo < J->hi) {
+		/***** T5, T6 *****/
+		while ((i = J->lo + __atomic_fetch_add(&J->next, LEVEL_CHUNK,
+							 __ATOMIC_RELAXED)) < J->hi) {
+			unsigned int end = i + LEVEL_CHUNK < J->hi ? i + LEVEL_CHUNK : J->hi;
+			for (; i < end; i++) {
+				const unsigned int * P = g->SUC + g->TOP[J->out[i]];
+				const unsigned int * E = g->SUC + g->TOP[J->out[i] + 1];
+				for (; P < E; P++) {
+					if (__atomic_sub_fetch(&J->count[*P], 1,
+							       __ATOMIC_RELAXED) == 0) {
+						buf[nr++] = *P;
+						if (nr == LEVEL_BUF) {
+							levels_flush(J, buf, nr);
+							nr = 0;
+						}
+					}
+				}
+			}
+		}
+		if (nr) {
+			levels_flush(J, buf, nr);
+			nr = 0;
+		}
+
+		/***** T7, for the whole level *****/
+		if (pthread_barrier_wait(&J->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			if (J->ordered)
+				qsort(J->out + J->hi, J->tail - J->hi,
+				      sizeof(unsigned int), cmp_uint);
+			if (J->tail > J->hi)
+				J->level[J->level_nr++] = J->hi;
+			J->lo   = J->hi;
+			J->hi   = J->tail;
+			J->next = 0;
+		}
+		pthread_barrier_wait(&J->barrier);
+	}
+	return 0;
+}
+
+/** writes the objects to out[] level by level, on thread_nr threads, and
+ *  the beginning of every level to level[] (n + 1 of them at most), with
+ *  level[*level_nr] = N; returns N, the number of objects written, which is
+ *  less than n if there is a loop
+ */
+unsigned int topo_levels(const struct graph * g, unsigned int * out,
+			 unsigned int * level, unsigned int * level_nr,
+			 int thread_nr, int ordered)
+{
+	struct levels_job J;
+	pthread_t * threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_nr);
+	unsigned int k;
+	int i;
+
+	J.g     = g;
+	J.count = (unsigned int *)malloc(sizeof(unsigned int) * (g->n + 1));
+	assert(threads && J.count);
+	memcpy(J.count, g->COUNT, sizeof(unsigned int) * (g->n + 1));
+	J.out      = out;
+	J.level    = level;
+	J.level_nr = 0;
+	J.ordered  = ordered;
+
+	/***** T4 *****/
+	J.tail = 0;
+	for (k = 1; k <= g->n; k++)
+		if (J.count[k] == 0)
+			out[J.tail++] = k;
+	if (J.tail)
+		level[J.level_nr++] = 0;
+	J.lo   = 0;
+	J.hi   = J.tail;
+	J.next = 0;
+
+	pthread_barrier_init(&J.barrier, 0, thread_nr);
+	for (i = 0; i < thread_nr; i++) {
+		if (pthread_create(&threads[i], 0, levels_worker, &J) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < thread_nr; i++)
+		pthread_join(threads[i], 0);
+	pthread_barrier_destroy(&J.barrier);
+
+	level[J.level_nr] = J.hi;
+	*level_nr = J.level_nr;
+	free(J.count);
+	free(threads);
+	return J.hi;
+}
+
+void print_levels(const unsigned int * out, const unsigned int * level,
+		  unsigned int level_nr)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < level_nr; i++) {
+		printf("Level %u: ", i);
+		for (k = level[i]; k < level[i + 1]; k++)
+			printf("%s%u", k > level[i] ? ", " : "", out[k]);
+		printf("\n");
+	}
+}
+
+/****************************************************************************************************
+ * A dynamic order (``-a'', ``-r''). When a few pairs come and go, the order
+ * need not be sorted again from scratch: struct dyn_topo keeps the order of
+ * the objects (ord[] and its inverse at[]) together with the successors and
+ * the predecessors of every object, and repairs the order after every new
+ * pair by the algorithm of Pearce and Kelly:
+ *
+ *     a new pair x ≺ y with ord[x] < ord[y] changes nothing; otherwise only
+ *     the objects between ord[y] and ord[x] may have to move:
+ *         F  the ones reached from y, searched forward within ord[x]
+ *         B  the ones which reach x, searched backward within ord[y]
+ *     if F contains x, there is a loop y ≺ ... ≺ x ≺ y, and the pair is
+ *     rejected; otherwise B goes before F, in the positions they had before
+ *
+ * so that the work is proportional to the affected region. Removing a pair
+ * never spoils an order. The searches use a stack of their own instead of
+ * recursion.
+ ****************************************************************************************************/
+struct adj {
+	unsigned int *	v;
+	unsigned int	nr;
+	unsigned int	max;
+};
+
+struct dyn_topo {
+	unsigned int	n;
+	unsigned int *	ord;		/* ord[k]: the position of k, 0..n-1 */
+	unsigned int *	at;		/* at[i]: the object at position i */
+	struct adj *	succ;		/* succ[k] and pred[k], k = 1..n */
+	struct adj *	pred;
+	unsigned int *	mark;		/* mark[k] == stamp: k is in F, stamp+1: in B */
+	unsigned int	stamp;
+	unsigned int *	parent;		/* in the forward search */
+	unsigned int *	stack;
+	uint64_t *	F;		/* ord[k] << 32 | k, to be sorted */
+	uint64_t *	B;
+	unsigned int *	pos;		/* the positions of B and F */
+	unsigned int *	path;		/* the loop of a rejected pair, y ... x */
+	unsigned int	path_nr;
+	long		visited;	/* objects searched, for the statistics */
+};
+
+void adj_add(struct adj * a, unsigned int k)
+{
+	if (a->nr == a->max) {
+		a->max = a->max ? a->max * 2 : 4;
+		a->v = (unsigned int *)realloc(a->v, sizeof(unsigned int) * a->max);
+		assert(a->v);
+	}
+	a->v[a->nr++] = k;
+}
+
+/* removes one k, returns 0 if there is none */
+int adj_del(struct adj * a, unsigned int k)
+{
+	unsigned int i;
+
+	for (i = 0; i < a->nr; i++) {
+		if (a->v[i] == k) {
+			a->v[i] = a->v[--a->nr];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** the graph and an order of all its objects (topo_sort() of it, which must
+ *  have found no loop)
+ */
+void dyn_init(struct dyn_topo * D, const struct graph * g,
+	      const unsigned int * order)
+{
+	unsigned int n = g->n;
+	unsigned int i, k;
+
+	D->n      = n;
+	D->ord    = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	D->at     = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	D->succ   = (struct adj *)calloc(n + 1, sizeof(struct adj));
+	D->pred   = (struct adj *)calloc(n + 1, sizeof(struct adj));
+	D->mark   = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	D->parent = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	D->stack  = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	D->F      = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+	D->B      = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+	D->pos    = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	D->path   = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	assert(D->ord && D->at && D->succ && D->pred && D->mark && D->parent &&
+	       D->stack && D->F && D->B && D->pos && D->path);
+	D->stamp   = 1;
+	D->path_nr = 0;
+	D->visited = 0;
+
+	for (i = 0; i < n; i++) {
+		D->at[i] = order[i];
+		D->ord[order[i]] = i;
+	}
+	for (k = 1; k <= n; k++) {
+		size_t p;
+		for (p = g->TOP[k]; p < g->TOP[k + 1]; p++) {
+			adj_add(&D->succ[k], g->SUC[p]);
+			adj_add(&D->pred[g->SUC[p]], k);
+		}
+	}
+}
+
+void dyn_free(struct dyn_topo * D)
+{
+	unsigned int k;
+
+	for (k = 1; k <= D->n; k++) {
+		free(D->succ[k].v);
+		free(D->pred[k].v);
+	}
+	free(D->ord);
+	free(D->at);
+	free(D->succ);
+	free(D->pred);
+	free(D->mark);
+	free(D->parent);
+	free(D->stack);
+	free(D->F);
+	free(D->B);
+	free(D->pos);
+	free(D->path);
+}
+
+int cmp_u64(const void * a, const void * b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/** adds the pair x ≺ y and repairs the order. Returns 0 if the pair would
+ *  make a loop, which is then D->path[0..path_nr-1]: y ≺ ... ≺ x, and the
+ *  pair is not added.
+ */
+int dyn_insert(struct dyn_topo * D, unsigned int x, unsigned int y)
+{
+	unsigned int lb, ub;
+	unsigned int f_nr = 0, b_nr = 0;
+	unsigned int sp, i, k;
+
+	assert(x >= 1 && x <= D->n && y >= 1 && y <= D->n);
+	if (x == y) {
+		D->path[0] = x;
+		D->path_nr = 1;
+		return 0;
+	}
+	lb = D->ord[y];
+	ub = D->ord[x];
+	if (lb > ub) {
+		adj_add(&D->succ[x], y);
+		adj_add(&D->pred[y], x);
+		return 1;
+	}
+
+	if (D->stamp >= UINT32_MAX - 2) {
+		memset(D->mark, 0, sizeof(unsigned int) * (D->n + 1));
+		D->stamp = 1;
+	}
+	D->stamp += 2;
+
+	/* F: forward from y, within ub */
+	sp = 0;
+	D->stack[sp++] = y;
+	D->mark[y] = D->stamp;
+	D->parent[y] = 0;
+	while (sp) {
+		unsigned int w = D->stack[--sp];
+		D->F[f_nr++] = (uint64_t)D->ord[w] << 32 | w;
+		for (i = 0; i < D->succ[w].nr; i++) {
+			unsigned int s = D->succ[w].v[i];
+			if (s == x) {
+				/* the loop: y ≺ ... ≺ w ≺ x */
+				D->path_nr = 0;
+				D->path[D->path_nr++] = x;
+				for (k = w; k; k = D->parent[k])
+					D->path[D->path_nr++] = k;
+				for (k = 0; k < D->path_nr / 2; k++) {
+					unsigned int t = D->path[k];
+					D->path[k] = D->path[D->path_nr - 1 - k];
+					D->path[D->path_nr - 1 - k] = t;
+				}
+				D->visited += f_nr;
+				return 0;
+			}
+			if (D->mark[s] != D->stamp && D->ord[s] < ub) {
+				D->mark[s] = D->stamp;
+				D->parent[s] = w;
+				D->stack[sp++] = s;
+			}
+		}
+	}
+
+	/* B: backward from x, within lb */
+	sp = 0;
+	D->stack[sp++] = x;
+	D->mark[x] = D->stamp + 1;
+	while (sp) {
+		unsigned int w = D->stack[--sp];
+		D->B[b_nr++] = (uint64_t)D->ord[w] << 32 | w;
+		for (i = 0; i < D->pred[w].nr; i++) {
+			unsigned int p = D->pred[w].v[i];
+			if (D->mark[p] != D->stamp + 1 && D->ord[p] > lb) {
+				D->mark[p] = D->stamp + 1;
+				D->stack[sp++] = p;
+			}
+		}
+	}
+	D->visited += f_nr + b_nr;
+
+	/* B before F, in the positions of both */
+	qsort(D->F, f_nr, sizeof(uint64_t), cmp_u64);
+	qsort(D->B, b_nr, sizeof(uint64_t), cmp_u64);
+	{
+		unsigned int a = 0, b = 0, p = 0;
+		while (a < b_nr || b < f_nr) {
+			if (b == f_nr || (a < b_nr && D->B[a] < D->F[b]))
+				D->pos[p++] = D->B[a++] >> 32;
+			else
+				D->pos[p++] = D->F[b++] >> 32;
+		}
+	}
+	for (i = 0; i < b_nr; i++) {
+		k = (unsigned int)D->B[i];
+		D->ord[k] = D->pos[i];
+		D->at[D->pos[i]] = k;
+	}
+	for (i = 0; i < f_nr; i++) {
+		k = (unsigned int)D->F[i];
+		D->ord[k] = D->pos[b_nr + i];
+		D->at[D->pos[b_nr + i]] = k;
+	}
+
+	adj_add(&D->succ[x], y);
+	adj_add(&D->pred[y], x);
+	return 1;
+}
+
+/* removes a pair x ≺ y, returns 0 if there is none */
+int dyn_delete(struct dyn_topo * D, unsigned int x, unsigned int y)
+{
+	assert(x >= 1 && x <= D->n && y >= 1 && y <= D->n);
+	if (!adj_del(&D->succ[x], y))
+		return 0;
+	adj_del(&D->pred[y], x);
+	return 1;
+}
+
+/* is the order of D topological? */
+int dyn_check(const struct dyn_topo * D)
+{
+	unsigned int k, i;
+
+	for (k = 1; k <= D->n; k++)
+		for (i = 0; i < D->succ[k].nr; i++)
+			if (D->ord[k] >= D->ord[D->succ[k].v[i]])
+				return 0;
+	for (i = 0; i < D->n; i++)
+		if (D->ord[D->at[i]] != i)
+			return 0;
+	return 1;
+}
+
+/****************************************************************************************************
+ * Closure (``-t''). For a DAG of at most CLOSURE_MAX objects, a matrix of
+ * bits: row j has bit k if j ≺ ... ≺ k, so that reaches(j, k) is one load.
+ * closure_build() goes through the order backwards, so that the rows of the
+ * successors of j are done before the one of j:
+ *
+ *     row j = (row s | bit s) for all the successors s of j
+ *
+ * the ORs being of CLOSURE_VEC bytes at a time (the vectors of GCC, which
+ * are SIMD registers where there are). A pair j ≺ s is in the transitive
+ * reduction iff s is not reached from another successor of j; such an s'
+ * comes before s in the order, so if the successors are taken in the
+ * order, s is either in the row already, and the pair and row s (which is
+ * in row s') are left out, or the pair is in the reduction. Only the pairs
+ * of the reduction cost an OR of a row.
+ ****************************************************************************************************/
+#define CLOSURE_MAX	65536		/* 512 MB of bits */
+#define CLOSURE_VEC	32		/* bytes ORed at a time */
+
+typedef uint64_t closure_vec __attribute__((vector_size(CLOSURE_VEC)));
+
+struct closure {
+	unsigned int	n;
+	size_t		row;		/* vectors in a row */
+	closure_vec *	R;		/* [(n + 1) * row]: row k from R + k * row */
+};
+
+/* 1 if u ≺ ... ≺ v */
+int reaches(const struct closure * C, unsigned int u, unsigned int v)
+{
+	const uint64_t * r = (const uint64_t *)(C->R + (size_t)u * C->row);
+	return (r[v >> 6] >> (v & 63)) & 1;
+}
+
+/** the closure of g, out[] being all its objects in topological order, and
+ *  the pairs of its transitive reduction added to reduction if not 0;
+ *  returns 0 if g is too large
+ */
+int closure_build(struct closure * C, const struct graph * g,
+		  const unsigned int * out, struct pairs * reduction)
+{
+	unsigned int n = g->n;
+	unsigned int * pos;
+	uint64_t * suc;		/* pos << 32 | k, for the successors k of j */
+	size_t max = 0;
+	unsigned int i;
+	size_t v, p;
+
+	if (n > CLOSURE_MAX)
+		return 0;
+	C->n   = n;
+	C->row = (n + 1 + CLOSURE_VEC * 8 - 1) / (CLOSURE_VEC * 8);
+	C->R   = (closure_vec *)aligned_alloc(CLOSURE_VEC,
+					      sizeof(closure_vec) * C->row * (n + 1));
+	pos = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	assert(C->R && pos);
+	memset(C->R, 0, sizeof(closure_vec) * C->row * (n + 1));
+	for (i = 0; i < n; i++)
+		pos[out[i]] = i;
+	for (i = 1; i <= n; i++)
+		if (g->TOP[i + 1] - g->TOP[i] > max)
+			max = g->TOP[i + 1] - g->TOP[i];
+	suc = (uint64_t *)malloc(sizeof(uint64_t) * (max + 1));
+	assert(suc);
+
+	for (i = n; i-- > 0; ) {
+		unsigned int j = out[i];
+		closure_vec * r = C->R + (size_t)j * C->row;
+		uint64_t * bits = (uint64_t *)r;
+		size_t nr = g->TOP[j + 1] - g->TOP[j];
+
+		for (p = 0; p < nr; p++) {
+			unsigned int k = g->SUC[g->TOP[j] + p];
+			suc[p] = (uint64_t)pos[k] << 32 | k;
+		}
+		if (nr > 1)
+			qsort(suc, nr, sizeof(uint64_t), cmp_u64);
+		for (p = 0; p < nr; p++) {
+			unsigned int k = (unsigned int)suc[p];
+			const closure_vec * s = C->R + (size_t)k * C->row;
+			if ((bits[k >> 6] >> (k & 63)) & 1)
+				continue;	/* through another successor, or twice */
+			for (v = 0; v < C->row; v++)
+				r[v] |= s[v];
+			bits[k >> 6] |= (uint64_t)1 << (k & 63);
+			if (reduction)
+				add_pair(reduction, j, k);
+		}
+	}
+	free(pos);
+	free(suc);
+	return 1;
+}
+
+void closure_free(struct closure * C)
+{
+	free(C->R);
+}
+
+/* the number of objects reached from u */
+unsigned int closure_count(const struct closure * C, unsigned int u)
+{
+	const uint64_t * r = (const uint64_t *)(C->R + (size_t)u * C->row);
+	unsigned int c = 0;
+	size_t w;
+
+	for (w = 0; w < C->row * (CLOSURE_VEC / 8); w++)
+		c += __builtin_popcountll(r[w]);
+	return c;
+}
+
+/****************************************************************************************************
+ * Files (``-i file''). The pairs are read from a file which is mapped into
+ * memory, in one of two forms:
+ *
+ *     text     a pair ``j k'' on every line, as in the book, where a line
+ *              ``0 n'' says that there are n objects, and ``#'' starts a
+ *              comment to the end of the line
+ *     binary   LOAD_MAGIC, then j and k as unsigned ints of this machine,
+ *              for every pair (see ``-W'')
+ *
+ * graph_load() cuts the file into one piece per thread, at the ends of lines
+ * for a text, and every thread parses its piece into a struct pairs of its
+ * own; the pairs of a binary file are used where they are mapped. The
+ * threads then count the successors and predecessors of the pairs of their
+ * pieces, with atomic adds to TOP[] and COUNT, and the successors are put
+ * into their rows piece after piece, so that the graph is the one which
+ * graph_build() makes of the same pairs, for any number of threads.
+ ****************************************************************************************************/
+#define LOAD_MAGIC	"TOPOBIN\n"	/* 8 bytes */
+
+struct load_job {
+	const char *		begin;		/* the piece of the file */
+	const char *		end;
+	struct pairs		P;		/* its pairs */
+	const unsigned int *	jk;		/* P.jk, or where the pairs are mapped */
+	size_t			nr;
+	size_t			bad;		/* where a bad line or object is, + 1 */
+	struct graph *		g;
+};
+
+void * load_parse_worker(void * arg)
+{
+	struct load_job * J = (struct load_job *)arg;
+	const char * s = J->begin;
+	const char * line;
+	unsigned long x[2];
+	int i;
+
+	while (s < J->end && !J->bad) {
+		line = s;
+		for (i = 0; i < 2; i++) {
+			while (s < J->end && (*s == ' ' || *s == '\t' || *s == '\r'))
+				s++;
+			if (s == J->end || *s < '0' || *s > '9')
+				break;
+			for (x[i] = 0; s < J->end && *s >= '0' && *s <= '9'; s++) {
+				x[i] = x[i] * 10 + (*s - '0');
+				if (x[i] > UINT32_MAX - 2) {	/* TOP[] has n + 2 entries */
+					J->bad = line - J->begin + 1;
+					break;
+				}
+			}
+			if (J->bad)
+				break;
+		}
+		if (J->bad)
+			break;
+		while (s < J->end && (*s == ' ' || *s == '\t' || *s == '\r'))
+			s++;
+		if (s < J->end && *s == '#')
+			while (s < J->end && *s != '\n')
+				s++;
+		if (s < J->end && *s != '\n') {
+			J->bad = line - J->begin + 1;
+			break;
+		}
+		s++;
+		if (i == 0)
+			continue;	/* empty line, or a comment */
+		if (i == 1) {
+			J->bad = line - J->begin + 1;
+			break;
+		}
+		if (x[0] == 0) {
+			if (x[1] > J->P.n)	/* ``0 n'', or ``0 0'' */
+				J->P.n = x[1];
+		}
+		else if (x[1] == 0) {
+			J->bad = line - J->begin + 1;
+		}
+		else {
+			add_pair(&J->P, x[0], x[1]);
+		}
+	}
+	J->jk = J->P.jk;
+	J->nr = J->P.nr;
+	return 0;
+}
+
+/* load_parse_worker() on some lines, good and bad, and whether it is right about them */
+int load_check()
+{
+	static const struct {
+		const char *	text;
+		int		bad;
+	} lines[] = {
+		{"1 2\n",			0},
+		{"0 5\n3 4 # a comment\n\n",	0},
+		{"1 4294967293\n",		0},	/* the largest object */
+		{"1\n",				1},
+		{"1 0\n",			1},
+		{"1 2 3\n",			1},
+		{"1 x\n",			1},
+		{"1 4294967294\n",		1},
+		{"4294967299\n",		1},	/* not 429496729 ≺ 9 */
+		{"99999999999999999999999 1\n",	1},
+	};
+	struct load_job J;
+	size_t i;
+	int ok = 1;
+
+	for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+		memset(&J, 0, sizeof(J));
+		pairs_init(&J.P);
+		J.begin = lines[i].text;
+		J.end   = lines[i].text + strlen(lines[i].text);
+		load_parse_worker(&J);
+		if ((J.bad != 0) != lines[i].bad) {
+			fprintf(stderr, "load_parse_worker() takes \"%s\" as %s\n",
+				lines[i].text, J.bad ? "bad" : "good");
+			ok = 0;
+		}
+		pairs_free(&J.P);
+	}
+	return ok;
+}
+
+void * load_count_worker(void * arg)
+{
+	struct load_job * J = (struct load_job *)arg;
+	size_t i;
+
+	for (i = 0; i < J->nr; i++) {
+		__atomic_fetch_add(&J->g->TOP[J->jk[2 * i] + 1], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&J->g->COUNT[J->jk[2 * i + 1]], 1, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/* the largest object of the binary pairs of a piece, or a bad one */
+void * load_max_worker(void * arg)
+{
+	struct load_job * J = (struct load_job *)arg;
+	size_t i;
+
+	for (i = 0; i < 2 * J->nr; i++) {
+		if (J->jk[i] == 0 || J->jk[i] > UINT32_MAX - 2) {
+			J->bad = i + 1;
+			break;
+		}
+		if (J->jk[i] > J->P.n)
+			J->P.n = J->jk[i];
+	}
+	return 0;
+}
+
+void load_run(struct load_job * jobs, int thread_nr, void * (*worker)(void *))
+{
+	pthread_t * threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_nr);
+	int i;
+
+	assert(threads);
+	for (i = 1; i < thread_nr; i++) {
+		if (pthread_create(&threads[i], 0, worker, &jobs[i]) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	worker(&jobs[0]);
+	for (i = 1; i < thread_nr; i++)
+		pthread_join(threads[i], 0);
+	free(threads);
+}
+
+/** the graph of the pairs in the file at path, read by thread_nr threads;
+ *  returns 0, after saying why, if the file cannot be read
+ */
+int graph_load(struct graph * g, const char * path, int thread_nr)
+{
+	struct load_job * jobs;
+	struct stat st;
+	const char * map;
+	size_t size, i;
+	unsigned int n = 0;
+	int binary;
+	int fd;
+	int t;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	size = st.st_size;
+	map = size ? (const char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return 0;
+	}
+	if (size)
+		madvise((void *)map, size, MADV_SEQUENTIAL);
+	binary = size >= 8 && memcmp(map, LOAD_MAGIC, 8) == 0;
+	if (binary && (size - 8) % (2 * sizeof(unsigned int))) {
+		fprintf(stderr, "%s: not a whole number of pairs\n", path);
+		munmap((void *)map, size);
+		return 0;
+	}
+
+	jobs = (struct load_job *)calloc(thread_nr, sizeof(struct load_job));
+	assert(jobs);
+	for (t = 0; t < thread_nr; t++) {
+		pairs_init(&jobs[t].P);
+		jobs[t].g = g;
+	}
+
+	if (binary) {
+		const unsigned int * jk = (const unsigned int *)(map + 8);
+		size_t m = (size - 8) / (2 * sizeof(unsigned int));
+		for (t = 0; t < thread_nr; t++) {
+			jobs[t].jk = jk + 2 * (m * t / thread_nr);
+			jobs[t].nr = m * (t + 1) / thread_nr - m * t / thread_nr;
+		}
+		load_run(jobs, thread_nr, load_max_worker);
+		for (t = 0; t < thread_nr; t++) {
+			if (jobs[t].bad) {
+				i = jobs[t].jk - jk + jobs[t].bad - 1;
+				fprintf(stderr, "%s: pair %zu: bad object %u\n", path,
+					i / 2 + 1, jk[i]);
+				free(jobs);
+				munmap((void *)map, size);
+				return 0;
+			}
+		}
+	}
+	else {
+		/* the pieces end after a '\n' */
+		const char * p = map;
+		for (t = 0; t < thread_nr; t++) {
+			const char * q = map + size * (t + 1) / thread_nr;
+			if (q < p)
+				q = p;
+			while (q < map + size && q > map && q[-1] != '\n')
+				q++;
+			jobs[t].begin = p;
+			jobs[t].end   = q;
+			p = q;
+		}
+		load_run(jobs, thread_nr, load_parse_worker);
+		for (t = 0; t < thread_nr; t++) {
+			if (jobs[t].bad) {
+				const char * line = jobs[t].begin + jobs[t].bad - 1;
+				const char * eol = memchr(line, '\n', map + size - line);
+				fprintf(stderr, "%s: byte %zu: not a pair: \"%.*s\"\n", path,
+					(size_t)(line - map), eol ? (int)(eol - line) : (int)(map + size - line),
+					line);
+				for (t = 0; t < thread_nr; t++)
+					pairs_free(&jobs[t].P);
+				free(jobs);
+				munmap((void *)map, size);
+				return 0;
+			}
+		}
+	}
+
+	g->m = 0;
+	for (t = 0; t < thread_nr; t++) {
+		if (jobs[t].P.n > n)
+			n = jobs[t].P.n;
+		g->m += jobs[t].nr;
+	}
+	g->n     = n;
+	g->TOP   = (size_t *)calloc(n + 2, sizeof(size_t));
+	g->SUC   = (unsigned int *)malloc(sizeof(unsigned int) * (g->m ? g->m : 1));
+	g->COUNT = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+	assert(g->TOP && g->SUC && g->COUNT);
+
+	/* pass 1, on all the threads */
+	load_run(jobs, thread_nr, load_count_worker);
+	for (i = 1; i <= n; i++)
+		g->TOP[i + 1] += g->TOP[i];
+
+	/* pass 2, as in graph_build() */
+	for (t = 0; t < thread_nr; t++)
+		for (i = 0; i < jobs[t].nr; i++)
+			g->SUC[--g->TOP[jobs[t].jk[2 * i] + 1]] = jobs[t].jk[2 * i + 1];
+	memmove(g->TOP + 1, g->TOP + 2, sizeof(size_t) * n);
+	g->TOP[n + 1] = g->m;
+
+	for (t = 0; t < thread_nr; t++)
+		pairs_free(&jobs[t].P);
+	free(jobs);
+	if (size)
+		munmap((void *)map, size);
+	return 1;
+}
+
+/* the pairs to a file which graph_load() reads, binary or text */
+int pairs_write(const struct pairs * P, const char * path, int binary)
+{
+	FILE * f = fopen(path, "w");
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return 0;
+	}
+	if (binary) {
+		fwrite(LOAD_MAGIC, 1, 8, f);
+		fwrite(P->jk, sizeof(unsigned int) * 2, P->nr, f);
+	}
+	else {
+		fprintf(f, "0 %u\n", P->n);
+		for (i = 0; i < P->nr; i++)
+			fprintf(f, "%u %u\n", P->jk[2 * i], P->jk[2 * i + 1]);
+	}
+	if (fclose(f) != 0) {
+		perror(path);
+		return 0;
+	}
+	return 1;
+}
+
+/****************************************************************************************************
+ * Out of memory (``-E file''). If the pairs do not fit in memory, but COUNT
+ * does (4 bytes and a bit an object), the pairs are kept in a file sorted by j, and
+ * read forwards only:
+ *
+ *     ext_runs()   reads the pairs of a binary file (see ``-W'') in runs of
+ *                  as many as fit in the memory given, counts COUNT, sorts
+ *                  every run by j (radix_pairs()) and writes it to a
+ *                  temporary file; then
+ *                  the runs are merged into one file, in blocks of
+ *                  EXT_BLOCK pairs, the first j of every block being kept
+ *     ext_sort()   passes over the objects 1..n: an object whose COUNT is 0
+ *                  is written, and its successors are read from its block
+ *                  on (if it has any, a bit of X->has), and their COUNT
+ *                  decreased. A successor k whose COUNT becomes 0 is
+ *                  written at once if it has no successors, or if its block
+ *                  is one of those kept in memory (as many as fit in the
+ *                  memory given, the least recently used going first); else
+ *                  later in the same pass if k > j, or in the next one;
+ *                  the blocks without an object to be written are not read
+ *
+ * A pass writes at least a level of topo_levels(), so that there are at most
+ * as many passes as levels (+ 1, which finds that nothing is left), and
+ * usually far fewer, as the blocks kept let a pass go on down the levels.
+ * A chain numbered backwards, with every block out of memory, takes a pass
+ * for every block, which is the price of not having TOP[] in memory.
+ ****************************************************************************************************/
+#define EXT_BLOCK	65536		/* pairs read at a time by ext_sort() */
+#define EXT_MEMORY	64		/* MB for the runs and the blocks, see ``-M'' */
+#define EXT_DONE	UINT32_MAX	/* COUNT of an object written */
+
+struct ext_graph {
+	FILE *		edges;		/* the pairs, sorted by j */
+	unsigned int	n;
+	uint64_t	m;
+	unsigned int *	COUNT;		/* [n + 1] */
+	unsigned char *	has;		/* bit k: k has successors */
+	unsigned int *	first;		/* first[b]: the j of the first pair of block b */
+	size_t		block_nr;
+	unsigned int	runs;
+	uint64_t	bytes_read;
+	uint64_t	bytes_written;
+};
+
+/* the order of the runs: by j only */
+int cmp_pair(const unsigned int * x, const unsigned int * y)
+{
+	return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/** the pairs of a[0..nr-1] sorted by j, by two passes of a radix sort on 16
+ *  bits of it, through tmp[] of as many pairs
+ */
+void radix_pairs(unsigned int * a, unsigned int * tmp, size_t nr)
+{
+	size_t * start = (size_t *)malloc(sizeof(size_t) * 65536);
+	unsigned int * from = a;
+	unsigned int * to = tmp;
+	unsigned int * t;
+	size_t i, sum;
+	int shift;
+
+	assert(start);
+	for (shift = 0; shift < 32; shift += 16) {
+		memset(start, 0, sizeof(size_t) * 65536);
+		for (i = 0; i < nr; i++)
+			start[(from[2 * i] >> shift) & 0xFFFF]++;
+		for (i = 0, sum = 0; i < 65536; i++) {
+			size_t c = start[i];
+			start[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < nr; i++) {
+			size_t p = start[(from[2 * i] >> shift) & 0xFFFF]++;
+			to[2 * p]     = from[2 * i];
+			to[2 * p + 1] = from[2 * i + 1];
+		}
+		t = from;
+		from = to;
+		to = t;
+	}
+	free(start);	/* two passes: the pairs are back in a[] */
+}
+
+/* the next pair of a run being merged */
+struct ext_run {
+	FILE *		f;
+	unsigned int *	buf;
+	size_t		nr;		/* pairs in buf[] */
+	size_t		i;
+};
+
+int ext_run_next(struct ext_graph * X, struct ext_run * r, size_t max)
+{
+	if (r->i == r->nr) {
+		r->nr = fread(r->buf, sizeof(unsigned int) * 2, max, r->f);
+		r->i = 0;
+		X->bytes_read += r->nr * sizeof(unsigned int) * 2;
+	}
+	return r->i < r->nr;
+}
+
+/** the pairs of the binary file in, sorted with memory bytes of buffers at
+ *  most; returns 0, after saying why, if in cannot be read
+ */
+int ext_runs(struct ext_graph * X, FILE * in, size_t memory)
+{
+	size_t max = memory / (sizeof(unsigned int) * 4);	/* pairs of a run, and as many for radix_pairs() */
+	unsigned int * buf;
+	unsigned int size = 0;		/* of X->COUNT */
+	FILE ** run = 0;
+	struct ext_run * r;
+	unsigned int * heap;		/* runs, by their next pair */
+	unsigned int * out;
+	unsigned int h, t;
+	size_t nr, i, per_run, out_nr = 0;
+	char magic[8];
+
+	if (fread(magic, 1, 8, in) != 8 || memcmp(magic, LOAD_MAGIC, 8) != 0) {
+		fprintf(stderr, "not a binary file of pairs\n");
+		return 0;
+	}
+	if (max < 1024)
+		max = 1024;
+	buf = (unsigned int *)malloc(sizeof(unsigned int) * 4 * max);
+	assert(buf);
+	X->n = 0;
+	X->m = 0;
+	X->COUNT = 0;
+	X->has = 0;
+	X->runs = 0;
+	X->bytes_read = 8;
+	X->bytes_written = 0;
+
+	/***** the runs *****/
+	while ((nr = fread(buf, sizeof(unsigned int) * 2, max, in)) > 0) {
+		X->bytes_read += nr * sizeof(unsigned int) * 2;
+		for (i = 0; i < 2 * nr; i++) {
+			unsigned int k = buf[i];
+			if (k == 0 || k > UINT32_MAX - 2) {
+				fprintf(stderr, "pair %llu: bad object %u\n",
+					(unsigned long long)(X->m + i / 2 + 1), k);
+				free(buf);
+				return 0;
+			}
+			if (k >= size) {
+				unsigned int old = size;
+				size = (uint64_t)k + 1 > 2 * (uint64_t)size ? k + 1 : 2 * size;
+				X->COUNT = (unsigned int *)realloc(X->COUNT, sizeof(unsigned int) * size);
+				X->has = (unsigned char *)realloc(X->has, size / 8 + 1);
+				assert(X->COUNT && X->has);
+				memset(X->COUNT + old, 0, sizeof(unsigned int) * (size - old));
+				if (old)	/* old / 8 + 1 bytes were there */
+					memset(X->has + old / 8 + 1, 0, size / 8 - old / 8);
+				else
+					memset(X->has, 0, size / 8 + 1);
+			}
+			if (k > X->n)
+				X->n = k;
+			if (i & 1)
+				X->COUNT[k]++;
+			else
+				X->has[k >> 3] |= 1 << (k & 7);
+		}
+		radix_pairs(buf, buf + 2 * max, nr);
+		run = (FILE **)realloc(run, sizeof(FILE *) * (X->runs + 1));
+		assert(run);
+		run[X->runs] = tmpfile();
+		if (!run[X->runs] ||
+		    fwrite(buf, sizeof(unsigned int) * 2, nr, run[X->runs]) != nr) {
+			perror("tmpfile");
+			exit(EXIT_FAILURE);
+		}
+		rewind(run[X->runs]);
+		X->runs++;
+		X->m += nr;
+		X->bytes_written += nr * sizeof(unsigned int) * 2;
+	}
+	if (!size) {
+		X->COUNT = (unsigned int *)calloc(1, sizeof(unsigned int));
+		X->has = (unsigned char *)calloc(1, 1);
+		assert(X->COUNT && X->has);
+	}
+
+	/***** the merge, the buffer divided among the runs and the output *****/
+	per_run = 2 * max / (X->runs + 1);
+	if (per_run < 1024)
+		per_run = 1024;
+	if (per_run * (X->runs + 1) > 2 * max) {
+		free(buf);
+		buf = (unsigned int *)malloc(sizeof(unsigned int) * 2 * per_run * (X->runs + 1));
+		assert(buf);
+	}
+	r    = (struct ext_run *)malloc(sizeof(struct ext_run) * (X->runs + 1));
+	heap = (unsigned int *)malloc(sizeof(unsigned int) * (X->runs + 1));
+	X->block_nr = (X->m + EXT_BLOCK - 1) / EXT_BLOCK;
+	X->first = (unsigned int *)malloc(sizeof(unsigned int) * (X->block_nr + 1));
+	X->edges = tmpfile();
+	assert(r && heap && X->first);
+	if (!X->edges) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+	out = buf + 2 * per_run * X->runs;
+	h = 0;
+	for (t = 0; t < X->runs; t++) {
+		r[t].f   = run[t];
+		r[t].buf = buf + 2 * per_run * t;
+		r[t].nr  = r[t].i = 0;
+		if (ext_run_next(X, &r[t], per_run)) {
+			/* sift up */
+			unsigned int c = h++;
+			while (c && cmp_pair(r[heap[(c - 1) / 2]].buf + 2 * r[heap[(c - 1) / 2]].i,
+					     r[t].buf) > 0) {
+				heap[c] = heap[(c - 1) / 2];
+				c = (c - 1) / 2;
+			}
+			heap[c] = t;
+		}
+	}
+	for (i = 0; h; i++) {
+		struct ext_run * q = &r[heap[0]];
+		unsigned int c;
+		out[2 * out_nr]     = q->buf[2 * q->i];
+		out[2 * out_nr + 1] = q->buf[2 * q->i + 1];
+		if (i % EXT_BLOCK == 0)
+			X->first[i / EXT_BLOCK] = out[2 * out_nr];
+		if (++out_nr == per_run) {
+			fwrite(out, sizeof(unsigned int) * 2, out_nr, X->edges);
+			out_nr = 0;
+		}
+		q->i++;
+		t = heap[0];
+		if (!ext_run_next(X, q, per_run))
+			t = heap[--h];
+		/* sift down */
+		for (c = 0; 2 * c + 1 < h; ) {
+			unsigned int d = 2 * c + 1;
+			if (d + 1 < h && cmp_pair(r[heap[d + 1]].buf + 2 * r[heap[d + 1]].i,
+						  r[heap[d]].buf + 2 * r[heap[d]].i) < 0)
+				d++;
+			if (cmp_pair(r[heap[d]].buf + 2 * r[heap[d]].i,
+				     r[t].buf + 2 * r[t].i) >= 0)
+				break;
+			heap[c] = heap[d];
+			c = d;
+		}
+		if (h)
+			heap[c] = t;
+	}
+	if (fwrite(out, sizeof(unsigned int) * 2, out_nr, X->edges) != out_nr ||
+	    fflush(X->edges) != 0) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+	X->bytes_written += X->m * sizeof(unsigned int) * 2;
+	rewind(X->edges);
+
+	for (t = 0; t < X->runs; t++)
+		fclose(run[t]);
+	free(run);
+	free(r);
+	free(heap);
+	free(buf);
+	return 1;
+}
+
+void ext_free(struct ext_graph * X)
+{
+	fclose(X->edges);
+	free(X->COUNT);
+	free(X->has);
+	free(X->first);
+}
+
+#define EXT_HAS(X, k)	((X)->has[(k) >> 3] & (1 << ((k) & 7)))
+#define EXT_NONE	((size_t)-1)
+
+/* the blocks kept by ext_sort(), and what it writes */
+struct ext_pass {
+	size_t		slot_nr;
+	unsigned int *	buf;		/* slot_nr blocks */
+	size_t *	nr;		/* nr[s]: pairs of the block in slot s */
+	size_t *	block;		/* block[s]: the block in slot s */
+	uint64_t *	used;		/* used[s]: when slot s was last used */
+	size_t *	slot;		/* slot[b]: the slot of block b, or EXT_NONE */
+	uint64_t	clock;
+	size_t		next;		/* the block after the one read last */
+	unsigned int *	stack;		/* objects to be written at once */
+	size_t		sp;
+	size_t		stack_max;
+	FILE *		out;
+	int		text;
+	unsigned int	N;
+};
+
+void ext_write(struct ext_graph * X, struct ext_pass * S, unsigned int k)
+{
+	X->COUNT[k] = EXT_DONE;
+	S->N++;
+	if (S->text)
+		fprintf(S->out, "%u\n", k);
+	else
+		fwrite(&k, sizeof(unsigned int), 1, S->out);
+}
+
+/* the block where the pairs of j begin: the last one with a smaller j */
+size_t ext_find(const struct ext_graph * X, unsigned int j)
+{
+	size_t lo = 0, hi = X->block_nr;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (X->first[mid] < j)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? lo - 1 : 0;
+}
+
+/* the slot of block b, which is read into the slot used least recently */
+size_t ext_block(struct ext_graph * X, struct ext_pass * S, size_t b)
+{
+	size_t s = S->slot[b];
+	size_t i;
+
+	if (s == EXT_NONE) {
+		s = 0;
+		for (i = 1; i < S->slot_nr; i++)
+			if (S->used[i] < S->used[s])
+				s = i;
+		if (S->block[s] != EXT_NONE)
+			S->slot[S->block[s]] = EXT_NONE;
+		if (b != S->next &&
+		    fseeko(X->edges, (off_t)b * EXT_BLOCK * 2 * sizeof(unsigned int),
+			   SEEK_SET) != 0) {
+			perror("fseeko");
+			exit(EXIT_FAILURE);
+		}
+		S->nr[s] = fread(S->buf + 2 * EXT_BLOCK * s, sizeof(unsigned int) * 2,
+				 EXT_BLOCK, X->edges);
+		X->bytes_read += S->nr[s] * sizeof(unsigned int) * 2;
+		S->next = b + 1;
+		S->block[s] = b;
+		S->slot[b] = s;
+	}
+	S->used[s] = ++S->clock;
+	return s;
+}
+
+/** T6 for j: COUNT of its successors is decreased. A successor whose COUNT
+ *  becomes 0 is written at once if it has no successors, and pushed on the
+ *  stack if its block is in memory; else it waits for the pass to reach it
+ */
+void ext_pairs(struct ext_graph * X, struct ext_pass * S, unsigned int j)
+{
+	size_t b = ext_find(X, j);
+	size_t lo, hi, nr;
+	const unsigned int * buf;
+
+	for (;;) {
+		size_t s = ext_block(X, S, b);
+		buf = S->buf + 2 * EXT_BLOCK * s;
+		nr  = S->nr[s];
+		/* the first pair of j in the block */
+		for (lo = 0, hi = nr; lo < hi; ) {
+			size_t mid = (lo + hi) / 2;
+			if (buf[2 * mid] < j)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < nr && buf[2 * lo] == j; lo++) {
+			unsigned int k = buf[2 * lo + 1];
+			if (--X->COUNT[k] != 0)
+				continue;
+			if (!EXT_HAS(X, k))
+				ext_write(X, S, k);
+			else if (S->sp < S->stack_max && S->slot[ext_find(X, k)] != EXT_NONE)
+				S->stack[S->sp++] = k;
+		}
+		if (lo < nr || b + 1 == X->block_nr || X->first[b + 1] != j)
+			break;
+		b++;	/* the pairs of j go on in the next block */
+	}
+}
+
+/** the objects of X in topological order, to out as unsigned ints, or as
+ *  text, an object on a line, with memory bytes for the blocks kept; returns
+ *  how many of them there are (less than n if there is a loop), and the
+ *  number of passes in *pass_nr
+ */
+unsigned int ext_sort(struct ext_graph * X, FILE * out, int text, size_t memory,
+		      unsigned int * pass_nr)
+{
+	struct ext_pass S;
+	unsigned int N0;
+	unsigned int j;
+	size_t i;
+
+	S.slot_nr = memory / (sizeof(unsigned int) * 2 * EXT_BLOCK);
+	if (S.slot_nr > X->block_nr)
+		S.slot_nr = X->block_nr;
+	if (S.slot_nr < 1)
+		S.slot_nr = 1;
+	S.stack_max = S.slot_nr * EXT_BLOCK;
+	S.buf   = (unsigned int *)malloc(sizeof(unsigned int) * 2 * EXT_BLOCK * S.slot_nr);
+	S.nr    = (size_t *)malloc(sizeof(size_t) * S.slot_nr);
+	S.block = (size_t *)malloc(sizeof(size_t) * S.slot_nr);
+	S.used  = (uint64_t *)calloc(S.slot_nr, sizeof(uint64_t));
+	S.slot  = (size_t *)malloc(sizeof(size_t) * (X->block_nr + 1));
+	S.stack = (unsigned int *)malloc(sizeof(unsigned int) * S.stack_max);
+	assert(S.buf && S.nr && S.block && S.used && S.slot && S.stack);
+	for (i = 0; i < S.slot_nr; i++)
+		S.block[i] = EXT_NONE;
+	for (i = 0; i <= X->block_nr; i++)
+		S.slot[i] = EXT_NONE;
+	S.clock = 0;
+	S.next  = 0;
+	S.sp    = 0;
+	S.out   = out;
+	S.text  = text;
+	S.N     = 0;
+
+	*pass_nr = 0;
+	do {
+		N0 = S.N;
+		(*pass_nr)++;
+		for (j = 1; j <= X->n; j++) {
+			if (X->COUNT[j] != 0)
+				continue;
+			ext_write(X, &S, j);
+			if (!EXT_HAS(X, j))
+				continue;
+			ext_pairs(X, &S, j);
+			while (S.sp) {
+				unsigned int k = S.stack[--S.sp];
+				ext_write(X, &S, k);
+				ext_pairs(X, &S, k);
+			}
+		}
+	} while (S.N > N0 && S.N < X->n);
+
+	free(S.buf);
+	free(S.nr);
+	free(S.block);
+	free(S.used);
+	free(S.slot);
+	free(S.stack);
+	return S.N;
+}
+
+/****************************************************************************************************
+ * Executor (``-J n''). The objects are jobs to be run, on several threads,
+ * a job after all its predecessors; COUNT is what is left of them, as in
+ * T6, but decreased atomically by the thread which has run a predecessor:
+ *
+ *     - every thread has a deque of jobs which are ready (Chase and Lev):
+ *       it pushes and takes at the bottom, alone, and the other threads
+ *       steal from the top, with a compare-and-swap
+ *     - a thread which has run job j decreases COUNT of its successors,
+ *       and pushes those which become 0 onto its own deque, where it takes
+ *       the last one first, while the others are there to be stolen
+ *     - a thread without jobs steals one from another thread, chosen at
+ *       random, and yields if there is none
+ *     - the jobs run are added up in J->done by EXEC_BATCH at a time, not
+ *       to fight for its cache line, and before a thread looks whether all
+ *       the n jobs are done
+ *
+ * g must have no loop, or the threads wait for ever.
+ ****************************************************************************************************/
+struct deque {
+	int64_t		top;		/* stolen from */
+	int64_t		bottom;		/* pushed and taken by the owner */
+	unsigned int *	a;		/* [mask + 1] */
+	int64_t		mask;
+	char		pad[64];	/* no false sharing with the next deque */
+};
+
+#define DEQUE_EMPTY	0		/* no object is 0 */
+#define DEQUE_ABORT	UINT32_MAX	/* lost a race, try again */
+
+void deque_push(struct deque * d, unsigned int k)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->a[b & d->mask], k, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+unsigned int deque_take(struct deque * d)
+{
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	int64_t t;
+	unsigned int k;
+
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	if (t > b) {
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		return DEQUE_EMPTY;
+	}
+	k = __atomic_load_n(&d->a[b & d->mask], __ATOMIC_RELAXED);
+	if (t == b) {
+		/* the last one: a thief may take it too */
+		if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+						 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			k = DEQUE_EMPTY;
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+
+unsigned int deque_steal(struct deque * d)
+{
+	int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	int64_t b;
+	unsigned int k;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return DEQUE_EMPTY;
+	k = __atomic_load_n(&d->a[t & d->mask], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return DEQUE_ABORT;
+	return k;
+}
+
+struct exec_job {
+	const struct graph *	g;
+	unsigned int *		count;		/* COUNT[n + 1], decreased atomically */
+	struct deque *		dq;		/* [thread_nr] */
+	int			thread_nr;
+	unsigned int		done;		/* jobs run */
+	void			(*run)(unsigned int k, void * arg);
+	void *			arg;
+	long *			steals;		/* [thread_nr] */
+};
+
+struct exec_worker {
+	struct exec_job *	J;
+	int			id;
+};
+
+void * exec_worker(void * arg)
+{
+	struct exec_worker * w = (struct exec_worker *)arg;
+	struct exec_job * J = w->J;
+	struct deque * own = &J->dq[w->id];
+	const struct graph * g = J->g;
+	uint64_t seed = 0x9E3779B97F4A7C15ULL * (w->id + 1);
+	long steals = 0;
+	unsigned int ran = 0;		/* not yet added to J->done */
+	unsigned int k;
+
+	for (;;) {
+		k = deque_take(own);
+		while (k == DEQUE_EMPTY) {
+			int i;
+			if (ran) {
+				__atomic_add_fetch(&J->done, ran, __ATOMIC_RELEASE);
+				ran = 0;
+			}
+			if (__atomic_load_n(&J->done, __ATOMIC_ACQUIRE) == g->n)
+				goto out;
+			for (i = 0; i < J->thread_nr && (k == DEQUE_EMPTY || k == DEQUE_ABORT); i++) {
+				seed ^= seed << 13;
+				seed ^= seed >> 7;
+				seed ^= seed << 17;
+				if ((int)(seed % J->thread_nr) != w->id)
+					k = deque_steal(&J->dq[seed % J->thread_nr]);
+			}
+			if (k == DEQUE_ABORT)
+				k = DEQUE_EMPTY;
+			if (k != DEQUE_EMPTY)
+				steals++;
+			else
+				sched_yield();
+		}
+
+		/***** T5: run k *****/
+		J->run(k, J->arg);
+
+		/***** T6 *****/
+		const unsigned int * P   = g->SUC + g->TOP[k];
+		const unsigned int * end = g->SUC + g->TOP[k + 1];
+		for (; P < end; P++)
+			if (__atomic_sub_fetch(&J->count[*P], 1, __ATOMIC_ACQ_REL) == 0)
+				deque_push(own, *P);
+		if (++ran == EXEC_BATCH) {
+			__atomic_add_fetch(&J->done, ran, __ATOMIC_RELEASE);
+			ran = 0;
+		}
+	}
+out:
+	J->steals[w->id] = steals;
+	return 0;
+}
+
+/** run(k, arg) for every object k of g, after its predecessors, on thread_nr
+ *  threads; returns the number of jobs stolen
+ */
+long exec_run(const struct graph * g, int thread_nr,
+	      void (*run)(unsigned int k, void * arg), void * arg)
+{
+	struct exec_job J;
+	struct exec_worker * w = (struct exec_worker *)malloc(sizeof(struct exec_worker) * thread_nr);
+	pthread_t * threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_nr);
+	int64_t size = 1;
+	long steals = 0;
+	unsigned int k;
+	int i;
+
+	while (size <= g->n)
+		size *= 2;
+	J.g         = g;
+	J.count     = (unsigned int *)malloc(sizeof(unsigned int) * (g->n + 1));
+	J.dq        = (struct deque *)calloc(thread_nr, sizeof(struct deque));
+	J.steals    = (long *)calloc(thread_nr, sizeof(long));
+	J.thread_nr = thread_nr;
+	J.done      = 0;
+	J.run       = run;
+	J.arg       = arg;
+	assert(w && threads && J.count && J.dq && J.steals);
+	memcpy(J.count, g->COUNT, sizeof(unsigned int) * (g->n + 1));
+	for (i = 0; i < thread_nr; i++) {
+		J.dq[i].a = (unsigned int *)malloc(sizeof(unsigned int) * size);
+		J.dq[i].mask = size - 1;
+		assert(J.dq[i].a);
+	}
+
+	/***** T4, the objects without predecessors dealt out *****/
+	for (k = 1, i = 0; k <= g->n; k++) {
+		if (J.count[k] == 0) {
+			deque_push(&J.dq[i], k);
+			i = (i + 1) % thread_nr;
+		}
+	}
+
+	for (i = 0; i < thread_nr; i++) {
+		w[i].J  = &J;
+		w[i].id = i;
+		if (i && pthread_create(&threads[i], 0, exec_worker, &w[i]) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	exec_worker(&w[0]);
+	for (i = 1; i < thread_nr; i++)
+		pthread_join(threads[i], 0);
+
+	for (i = 0; i < thread_nr; i++) {
+		steals += J.steals[i];
+		free(J.dq[i].a);
+	}
+	free(J.count);
+	free(J.dq);
+	free(J.steals);
+	free(w);
+	free(threads);
+	return steals;
+}
+
+/****************************************************************************************************
+ * Benchmark (``-b n m''): a random DAG of n objects and m pairs, sorted by
+ * topo_linked(), by graph_build() + topo_sort(), and by topo_levels() if
+ * ``-p'' is given. ``-c k'' adds k pairs between random objects, which
+ * make loops, found by topo_loops(). ``-u k'' makes k changes to it afterwards, a removal for
+ * every UPDATE_INSERTS new pairs, which are between objects at most
+ * UPDATE_WINDOW positions apart in the order (as an edit of a build graph
+ * usually is), and keeps the order by dyn_insert(). ``-w file'' and
+ * ``-W file'' write the pairs to a file for ``-i'', as text or binary.
+ * ``-M MB'' sorts them out of memory too, see ext_sort().
+ ****************************************************************************************************/
+uint64_t rng = 1;
+
+/* splitmix64 */
+uint64_t rand_u64(void)
+{
+	uint64_t z = (rng += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/** m pairs j ≺ k of objects 1..n: the objects are numbered by a random
+ *  permutation of a hidden order, and every pair goes forward in it
+ */
+void random_dag(struct pairs * P, unsigned int n, size_t m)
+{
+	unsigned int * perm = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int i;
+	size_t e;
+
+	assert(perm && n >= 2);
+	for (i = 0; i < n; i++)
+		perm[i] = i + 1;
+	for (i = n - 1; i > 0; i--) {
+		unsigned int r = rand_u64() % (i + 1);
+		unsigned int t = perm[i];
+		perm[i] = perm[r];
+		perm[r] = t;
+	}
+	for (e = 0; e < m; e++) {
+		unsigned int a = rand_u64() % n;
+		unsigned int b = rand_u64() % (n - 1);
+		if (b >= a)
+			b++;
+		if (a > b) {
+			unsigned int t = a;
+			a = b;
+			b = t;
+		}
+		add_pair(P, perm[a], perm[b]);
+	}
+	free(perm);
+}
+
+double seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* ext_runs() and ext_sort() on the pairs of P, with memory MB for the runs */
+void benchmark_ext(const struct pairs * P, size_t memory, double sort_sec)
+{
+	struct ext_graph X;
+	FILE * in = tmpfile();
+	FILE * out = tmpfile();
+	unsigned int * order = (unsigned int *)malloc(sizeof(unsigned int) * (P->n + 1));
+	unsigned int N, pass_nr;
+	double t0, t1, t2;
+
+	assert(order);
+	if (!in || !out) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+	fwrite(LOAD_MAGIC, 1, 8, in);
+	fwrite(P->jk, sizeof(unsigned int) * 2, P->nr, in);
+	rewind(in);
+
+	t0 = seconds();
+	if (!ext_runs(&X, in, memory << 20))
+		exit(EXIT_FAILURE);
+	t1 = seconds();
+	X.bytes_read = 0;
+	N = ext_sort(&X, out, 0, memory << 20, &pass_nr);
+	t2 = seconds();
+	printf("%-22s %10.3f %12.2f   (%u runs, %zu MB)\n", "out of memory: runs",
+	       t1 - t0, (t1 - t0) * 1e9 / P->nr, X.runs, memory);
+	printf("%-22s %10.3f %12.2f   (%u passes, %.2f bytes read a pair, "
+	       "%.0f MB/s)\n", "out of memory: sort", t2 - t1, (t2 - t1) * 1e9 / P->nr,
+	       pass_nr, (double)X.bytes_read / P->nr, X.bytes_read / 1e6 / (t2 - t1));
+	printf("%-22s %10s %12s   (in memory: %.3f s)\n", "", "", "", sort_sec);
+
+	rewind(out);
+	if (fread(order, sizeof(unsigned int), N, out) != N ||
+	    (N == P->n && !topo_check(P, order, N))) {
+		fprintf(stderr, "the order out of memory is not topological\n");
+		exit(EXIT_FAILURE);
+	}
+	ext_free(&X);
+	fclose(in);
+	fclose(out);
+	free(order);
+}
+
+/* closure_build() on g sorted in order[], and reaches() */
+void benchmark_closure(const struct graph * g, const unsigned int * order)
+{
+	struct closure C, C2;
+	struct pairs red;
+	struct graph g2;
+	unsigned int * queue = (unsigned int *)malloc(sizeof(unsigned int) * (g->n + 1));
+	unsigned char * seen = (unsigned char *)malloc(g->n + 1);
+	long q, found = 0;
+	unsigned int i;
+	double t0, t1, t2;
+
+	assert(queue && seen);
+	pairs_init(&red);
+	t0 = seconds();
+	if (!closure_build(&C, g, order, &red)) {
+		printf("closure: more than %d objects.\n", CLOSURE_MAX);
+		pairs_free(&red);
+		free(queue);
+		free(seen);
+		return;
+	}
+	t1 = seconds();
+	for (q = 0; q < 10000000; q++)
+		found += reaches(&C, 1 + rand_u64() % g->n, 1 + rand_u64() % g->n);
+	t2 = seconds();
+	printf("%-22s %10.3f %12.2f   (%zu pairs in the reduction, %.1f%% reached)\n",
+	       "closure_build()", t1 - t0, (t1 - t0) * 1e9 / g->m, red.nr,
+	       100.0 * found / q);
+	printf("%-22s %10.3f %12.2f   (ns/query)\n", "reaches()", t2 - t1,
+	       (t2 - t1) * 1e9 / q);
+
+	/* the closure of the reduction is the same, and rows are what a search finds */
+	red.n = g->n;
+	graph_build(&g2, &red);
+	closure_build(&C2, &g2, order, 0);
+	if (memcmp(C.R, C2.R, sizeof(closure_vec) * C.row * (C.n + 1)) != 0) {
+		fprintf(stderr, "the reduction has another closure\n");
+		exit(EXIT_FAILURE);
+	}
+	for (q = 0; q < 16; q++) {
+		unsigned int u = 1 + rand_u64() % g->n;
+		unsigned int head = 0, tail = 0;
+		memset(seen, 0, g->n + 1);
+		for (queue[tail++] = u; head < tail; head++) {
+			size_t p;
+			for (p = g->TOP[queue[head]]; p < g->TOP[queue[head] + 1]; p++) {
+				if (!seen[g->SUC[p]]) {
+					seen[g->SUC[p]] = 1;
+					queue[tail++] = g->SUC[p];
+				}
+			}
+		}
+		for (i = 1; i <= g->n && seen[i] == reaches(&C, u, i); i++)
+			;
+		if (i <= g->n || closure_count(&C, u) != tail - 1) {
+			fprintf(stderr, "the closure of %u is wrong\n", u);
+			exit(EXIT_FAILURE);
+		}
+	}
+	closure_free(&C);
+	closure_free(&C2);
+	graph_free(&g2);
+	pairs_free(&red);
+	free(queue);
+	free(seen);
+}
+
+/* a job of ``-J'': spins, and stamps when it starts and ends if asked */
+struct exec_bench {
+	long		work;
+	unsigned int *	start;
+	unsigned int *	end;
+	unsigned int	clock;
+};
+
+void exec_spin(unsigned int k, void * arg)
+{
+	struct exec_bench * B = (struct exec_bench *)arg;
+	volatile long i;
+
+	if (B->start)
+		B->start[k] = __atomic_fetch_add(&B->clock, 1, __ATOMIC_ACQ_REL);
+	for (i = 0; i < B->work; i++)
+		;
+	if (B->end)
+		B->end[k] = __atomic_fetch_add(&B->clock, 1, __ATOMIC_ACQ_REL);
+}
+
+/** exec_run() on a wide DAG (EXEC_LEVELS levels of n / EXEC_LEVELS jobs, a
+ *  job after 2 random ones of the level before) and a deep one (EXEC_CHAINS
+ *  chains, a job after the one before it in its chain and in the next
+ *  chain), against running them in the order of topo_sort() on one thread
+ */
+void benchmark_exec(unsigned int n, int thread_nr)
+{
+	struct exec_bench B;
+	int kind, t, w;
+
+	for (kind = 0; kind < 2; kind++) {
+		struct pairs P;
+		struct graph g;
+		unsigned int * order = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+		unsigned int width = kind == 0 ? n / EXEC_LEVELS : EXEC_CHAINS;
+		unsigned int k, N;
+		double static_sec = 0, t0, t1;
+		size_t p;
+
+		assert(order && width >= 2);
+		pairs_init(&P);
+		for (k = width + 1; k <= n; k++) {
+			unsigned int row = (k - 1) / width;	/* the level, or the place in a chain */
+			unsigned int col = (k - 1) % width;
+			if (kind == 0) {
+				add_pair(&P, (row - 1) * width + 1 + rand_u64() % width, k);
+				add_pair(&P, (row - 1) * width + 1 + rand_u64() % width, k);
+			}
+			else {
+				add_pair(&P, k - width, k);
+				add_pair(&P, (row - 1) * width + 1 + (col + 1) % width, k);
+			}
+		}
+		P.n = n;
+		graph_build(&g, &P);
+		N = topo_sort(&g, order);
+		assert(N == n);
+		(void)N;	/* only assert() reads it */
+		printf("%s DAG: %u jobs, %zu pairs, %u wide.\n",
+		       kind == 0 ? "wide" : "deep", n, P.nr, width);
+		printf("%-22s %10s %12s %12s %10s\n", "", "s", "ns/job", "overhead", "steals");
+
+		B.start = B.end = 0;
+		for (w = 0; w < 2; w++) {
+			B.work = w ? EXEC_WORK : 0;
+			printf("jobs of %ld spins:\n", B.work);
+			t0 = seconds();
+			for (k = 0; k < n; k++)
+				exec_spin(order[k], &B);
+			t1 = seconds();
+			static_sec = t1 - t0;
+			printf("%-22s %10.3f %12.2f\n", "  static order", static_sec,
+			       static_sec * 1e9 / n);
+			for (t = 1; t <= thread_nr; t = t * 2 > thread_nr && t < thread_nr ? thread_nr : t * 2) {
+				long steals;
+				char name[32];
+				t0 = seconds();
+				steals = exec_run(&g, t, exec_spin, &B);
+				t1 = seconds();
+				snprintf(name, sizeof(name), "  %d thread%s", t, t > 1 ? "s" : "");
+				/* the time of all the threads which is not the jobs */
+				printf("%-22s %10.3f %12.2f %12.2f %10ld\n", name, t1 - t0,
+				       (t1 - t0) * 1e9 / n, ((t1 - t0) * t - static_sec) * 1e9 / n,
+				       steals);
+			}
+		}
+
+		/* every job starts after its predecessors end */
+		B.work  = 0;
+		B.clock = 0;
+		B.start = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+		B.end   = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+		assert(B.start && B.end);
+		exec_run(&g, thread_nr, exec_spin, &B);
+		for (k = 1; k <= n; k++)
+			for (p = g.TOP[k]; p < g.TOP[k + 1]; p++)
+				if (B.end[k] >= B.start[g.SUC[p]]) {
+					fprintf(stderr, "%u started before %u ended\n", g.SUC[p], k);
+					exit(EXIT_FAILURE);
+				}
+		free(B.start);
+		free(B.end);
+		graph_free(&g);
+		pairs_free(&P);
+		free(order);
+	}
+}
+
+/* topo_priority() and topo_heap(), by number and by random priorities */
+void benchmark_priority(const struct pairs * P, const struct graph * g)
+{
+	unsigned int n = g->n;
+	unsigned int * rank = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * at   = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * prio = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * out1 = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int * out2 = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	unsigned int k, N1, N2;
+	int pass;
+	double t0, t1, t2, t3;
+
+	assert(rank && at && prio && out1 && out2);
+	for (k = 1; k <= n; k++)
+		prio[k] = rand_u64();
+	for (pass = 0; pass < 2; pass++) {
+		const char * what = pass ? "priority" : "lexicographic";
+		char name[32];
+		t0 = seconds();
+		priority_ranks(n, pass ? prio : 0, rank, at);
+		t1 = seconds();
+		N1 = topo_priority(g, rank, at, out1);
+		t2 = seconds();
+		N2 = topo_heap(g, rank, at, out2);
+		t3 = seconds();
+		if (pass) {
+			snprintf(name, sizeof(name), "%s: ranks", what);
+			printf("%-22s %10.3f %12.2f\n", name, t1 - t0, (t1 - t0) * 1e9 / g->m);
+		}
+		snprintf(name, sizeof(name), "%s: bitq", what);
+		printf("%-22s %10.3f %12.2f\n", name, t2 - t1, (t2 - t1) * 1e9 / g->m);
+		snprintf(name, sizeof(name), "%s: heap", what);
+		printf("%-22s %10.3f %12.2f\n", name, t3 - t2, (t3 - t2) * 1e9 / g->m);
+		if (N1 != N2 || memcmp(out1, out2, sizeof(unsigned int) * N1) != 0 ||
+		    (N1 == n && !topo_check(P, out1, N1))) {
+			fprintf(stderr, "the bit queue and the heap differ, or are not topological\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(rank);
+	free(at);
+	free(prio);
+	free(out1);
+	free(out2);
+}
+
+/* k changes to the graph g sorted in order[], see ``-u'' */
+void benchmark_updates(const struct graph * g, const unsigned int * order,
+		       long k, double sort_sec)
+{
+	struct dyn_topo D;
+	long inserted = 0, rejected = 0, deleted = 0;
+	long i;
+	double t0, t1;
+
+	dyn_init(&D, g, order);
+	t0 = seconds();
+	for (i = 0; i < k; i++) {
+		if (i % (UPDATE_INSERTS + 1) == UPDATE_INSERTS) {
+			unsigned int x = 1 + rand_u64() % D.n;
+			if (D.succ[x].nr &&
+			    dyn_delete(&D, x, D.succ[x].v[rand_u64() % D.succ[x].nr]))
+				deleted++;
+		}
+		else {
+			unsigned int p = rand_u64() % D.n;
+			long q = (long)p + (long)(rand_u64() % (2 * UPDATE_WINDOW + 1)) - UPDATE_WINDOW;
+			if (q < 0 || q >= D.n || q == p)
+				continue;
+			if (dyn_insert(&D, D.at[p], D.at[q]))
+				inserted++;
+			else
+				rejected++;
+		}
+	}
+	t1 = seconds();
+
+	printf("%ld changes: %ld pairs added, %ld rejected (loops), %ld removed.\n"
+	       "%.3f us per change, %.1f objects searched per new pair; "
+	       "sorting again takes %.0f us.\n",
+	       k, inserted, rejected, deleted, (t1 - t0) * 1e6 / k,
+	       inserted + rejected ? (double)D.visited / (inserted + rejected) : 0,
+	       sort_sec * 1e6);
+	if (!dyn_check(&D)) {
+		fprintf(stderr, "the dynamic order is not topological\n");
+		exit(EXIT_FAILURE);
+	}
+	dyn_free(&D);
+}
+
+void benchmark(unsigned int n, size_t m, int thread_nr, int ordered,
+	       long updates, long back, const char * write_path, int write_binary,
+	       int schedule, size_t ext_memory, int closure, int lex)
+{
+	struct pairs P;
+	struct graph g;
+	unsigned int * out1 = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int * out2 = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int N1, N2;
+	double t0, t1, t2, t3, sort_sec;
+
+	assert(out1 && out2);
+	if (!load_check())
+		exit(EXIT_FAILURE);
+	pairs_init(&P);
+	random_dag(&P, n, m);
+	for (; back > 0; back--)
+		add_pair(&P, 1 + rand_u64() % n, 1 + rand_u64() % n);
+	n = P.n;	/* the largest object in a pair */
+	if (write_path && !pairs_write(&P, write_path, write_binary))
+		exit(EXIT_FAILURE);
+
+	t0 = seconds();
+	N1 = topo_linked(&P, out1);
+	t1 = seconds();
+	graph_build(&g, &P);
+	t2 = seconds();
+	N2 = topo_sort(&g, out2);
+	t3 = seconds();
+	sort_sec = t3 - t1;
+
+	printf("%u objects, %zu pairs.\n", n, P.nr);
+	printf("%-22s %10s %12s\n", "", "s", "ns/pair");
+	printf("%-22s %10.3f %12.2f\n", "linked TOP[]/NEXT", t1 - t0,
+	       (t1 - t0) * 1e9 / P.nr);
+	printf("%-22s %10.3f %12.2f\n", "CSR: graph_build()", t2 - t1,
+	       (t2 - t1) * 1e9 / P.nr);
+	printf("%-22s %10.3f %12.2f\n", "CSR: topo_sort()", t3 - t2,
+	       (t3 - t2) * 1e9 / P.nr);
+	printf("%-22s %10.3f %12.2f\n", "CSR: total", t3 - t1,
+	       (t3 - t1) * 1e9 / P.nr);
+
+	if ((N1 == n && !topo_check(&P, out1, N1)) || N1 != N2 ||
+	    memcmp(out1, out2, sizeof(unsigned int) * N1) != 0) {
+		fprintf(stderr, "the orders differ, or are not topological\n");
+		exit(EXIT_FAILURE);
+	}
+	if (N2 < n) {
+		struct loops L;
+		t0 = seconds();
+		topo_loops(&g, out2, N2, &L);
+		t1 = seconds();
+		printf("%-22s %10.3f %12.2f\n", "topo_loops()", t1 - t0,
+		       (t1 - t0) * 1e9 / P.nr);
+		print_loops(stdout, &L, LOOP_PRINT);
+		if (!loops_check(&g, &L)) {
+			fprintf(stderr, "the loop is not a loop\n");
+			exit(EXIT_FAILURE);
+		}
+		loops_free(&L);
+	}
+
+	if (schedule) {
+		unsigned int * weight = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+		struct schedule S;
+		unsigned int k;
+		size_t p;
+		assert(weight);
+		for (k = 1; k <= n; k++)
+			weight[k] = 1 + rand_u64() % 100;
+		t0 = seconds();
+		N2 = topo_schedule(&g, weight, out2, &S);
+		t1 = seconds();
+		printf("%-22s %10.3f %12.2f   (%u levels, length %llu, path of %u)\n",
+		       "topo_schedule()", t1 - t0, (t1 - t0) * 1e9 / P.nr, S.level_nr,
+		       (unsigned long long)S.length, S.path_nr);
+		if (N2 != N1 || memcmp(out1, out2, sizeof(unsigned int) * N1) != 0) {
+			fprintf(stderr, "the schedule is not in the order of topo_sort()\n");
+			exit(EXIT_FAILURE);
+		}
+		for (k = 0; k < N2; k++) {
+			unsigned int j = out2[k];
+			for (p = g.TOP[j]; p < g.TOP[j + 1]; p++)
+				if (S.LS[g.SUC[p]] != UINT64_MAX &&
+				    (S.ES[j] + weight[j] > S.ES[g.SUC[p]] ||
+				     S.LS[j] + weight[j] > S.LS[g.SUC[p]]))
+					break;
+			if (p < g.TOP[j + 1] || S.LS[j] < S.ES[j] ||
+			    S.LS[j] + weight[j] > S.length) {
+				fprintf(stderr, "the schedule of %u is wrong\n", j);
+				exit(EXIT_FAILURE);
+			}
+		}
+		schedule_free(&S);
+		free(weight);
+	}
+	if (ext_memory)
+		benchmark_ext(&P, ext_memory, sort_sec);
+	if (closure && N1 == n)
+		benchmark_closure(&g, out2);
+	if (lex)
+		benchmark_priority(&P, &g);
+	if (thread_nr) {
+		unsigned int * level = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+		unsigned int level_nr;
+		char name[32];
+		assert(level);
+		t0 = seconds();
+		N2 = topo_levels(&g, out2, level, &level_nr, thread_nr, ordered);
+		t1 = seconds();
+		snprintf(name, sizeof(name), "levels: %d thread%s%s", thread_nr,
+			 thread_nr > 1 ? "s" : "", ordered ? ", -o" : "");
+		printf("%-22s %10.3f %12.2f   (%u levels)\n", name, t1 - t0,
+		       (t1 - t0) * 1e9 / P.nr, level_nr);
+		if (N2 != N1 || (N1 == n && !topo_check(&P, out2, N2))) {
+			fprintf(stderr, "the levels are not topological\n");
+			exit(EXIT_FAILURE);
+		}
+		free(level);
+	}
+	printf("memory per pair: %zu bytes linked, %zu bytes CSR.\n",
+	       sizeof(struct Node), sizeof(unsigned int));
+	if (updates && N1 == n) {
+		N2 = topo_sort(&g, out2);
+		benchmark_updates(&g, out2, updates, sort_sec);
+	}
+
+	graph_free(&g);
+	pairs_free(&P);
+	free(out1);
+	free(out2);
+}
+
+void print_usage(const char * bin_name)
+{
+	printf("USAGE:\n"
+	       "        $ %s\n"
+	       "        $ %s -p threads [-o]\n"
+	       "        $ %s [-a j:k] [-r j:k] ...\n"
+	       "        $ %s [-x j:k] ... [-t]\n"
+	       "        $ %s -e\n"
+	       "        $ %s -L\n"
+	       "        $ %s -i file [-p threads [-o]]\n"
+	       "        $ %s -E file [-M MB]\n"
+	       "        $ %s -J jobs [-p threads] [-s seed]\n"
+	       "        $ %s -b objects pairs [-s seed] [-p threads [-o]] [-u changes]\n"
+	       "                              [-c pairs] [-w file | -W file] [-e]\n"
+	       "                              [-M MB] [-t] [-L]\n"
+	       "    -p  sort level by level on this many threads\n"
+	       "    -o  the objects of every level in increasing order\n"
+	       "    -a  add the pair j ≺ k to the example, and repair its order\n"
+	       "    -r  remove the pair j ≺ k from the example\n"
+	       "    -x  sort the example with the pair j ≺ k too, and report the\n"
+	       "        loops if there are\n"
+	       "    -t  what every object reaches, and the transitive reduction,\n"
+	       "        see closure_build()\n"
+	       "    -L  the smallest objects first, and the jobs of -e by their\n"
+	       "        latest starts (with -b: by number, and by random\n"
+	       "        priorities), see topo_priority()\n"
+	       "    -e  the earliest and latest starts of the jobs of the example,\n"
+	       "        job k taking k units of time (random times with -b), see\n"
+	       "        topo_schedule()\n"
+	       "    -i  sort the pairs of a file, on this many threads if -p is given\n"
+	       "        (see graph_load())\n"
+	       "    -E  sort the pairs of a binary file (see -W) out of memory, see\n"
+	       "        ext_sort()\n"
+	       "    -M  memory for the runs of -E, in MB (default %d); with -b, sort\n"
+	       "        out of memory too\n"
+	       "    -J  run this many jobs of a wide and a deep DAG on 1, 2, 4, ...\n"
+	       "        threads (see exec_run())\n"
+	       "    -b  benchmark the linked form of the book against the CSR form\n"
+	       "        on a random DAG\n"
+	       "    -s  seed of the random DAG (default 1)\n"
+	       "    -u  make this many changes to the random DAG, see dyn_insert()\n"
+	       "    -c  add this many pairs between random objects, see topo_loops()\n"
+	       "    -w  write the pairs of the random DAG to a file, as text\n"
+	       "    -W  the same, binary\n",
+	       bin_name, bin_name, bin_name, bin_name, bin_name, bin_name, bin_name,
+	       bin_name, bin_name, bin_name, EXT_MEMORY);
+}
+
+int main(int argc, char * argv[])
+{
+	const unsigned int input[LIMIT] = {0, 9, /* (0,n) */
+					   9, 2,
+					   3, 7,
+					   7, 5,
+					   5, 8,
+					   8, 6,
+					   4, 6,
+					   1, 3,
+					   7, 4,
+					   9, 5,
+					   2, 8,
+					   0, 0}; /* (0,0) terminates the input */
+	unsigned int bench_n = 0;
+	size_t bench_m = 0;
+	int thread_nr = 0;
+	int ordered = 0;
+	long updates = 0;
+	long back = 0;
+	const char * load_path = 0;
+	const char * write_path = 0;
+	int write_binary = 0;
+	int extra_nr = 0;
+	int schedule = 0;
+	int closure = 0;
+	int lex = 0;
+	unsigned int exec_n = 0;
+	const char * ext_path = 0;
+	size_t ext_memory = 0;
+	char * change_op = (char *)malloc(argc);	/* -a or -r */
+	unsigned int * change = (unsigned int *)malloc(sizeof(unsigned int) * 2 * argc);
+	int change_nr = 0;
+	int i;
+
+	assert(change_op && change);
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0 && i + 2 < argc) {
+			bench_n = strtoul(argv[i+1], 0, 10);
+			bench_m = strtoull(argv[i+2], 0, 10);
+			i += 2;
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			rng = strtoull(argv[++i], 0, 0);
+		}
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			thread_nr = atoi(argv[++i]);
+			if (thread_nr < 1) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-o") == 0) {
+			ordered = 1;
+		}
+		else if (strcmp(argv[i], "-e") == 0) {
+			schedule = 1;
+		}
+		else if (strcmp(argv[i], "-t") == 0) {
+			closure = 1;
+		}
+		else if (strcmp(argv[i], "-L") == 0) {
+			lex = 1;
+		}
+		else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc) {
+			exec_n = strtoul(argv[++i], 0, 10);
+			if (exec_n < 2 * EXEC_LEVELS) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+			updates = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			back = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			load_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+			ext_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+			ext_memory = strtoul(argv[++i], 0, 10);
+			if (!ext_memory) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if ((strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "-W") == 0) &&
+			 i + 1 < argc) {
+			write_binary = (argv[i][1] == 'W');
+			write_path = argv[++i];
+		}
+		else if ((strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-r") == 0 ||
+			  strcmp(argv[i], "-x") == 0) && i + 1 < argc) {
+			char * p;
+			change_op[change_nr] = argv[i][1];
+			change[2 * change_nr] = strtoul(argv[++i], &p, 10);
+			if (*p != ':') {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			change[2 * change_nr + 1] = strtoul(p + 1, &p, 10);
+			if (*p || !change[2 * change_nr] || !change[2 * change_nr + 1] ||
+			    change[2 * change_nr] > input[1] ||
+			    change[2 * change_nr + 1] > input[1]) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			if (change_op[change_nr] == 'x')
+				extra_nr++;
+			change_nr++;
+		}
+		else {
+			print_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (bench_n) {
+		if (bench_n < 2) {
+			print_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		benchmark(bench_n, bench_m, thread_nr, ordered, updates, back,
+			  write_path, write_binary, schedule, ext_memory, closure, lex);
+		return 0;
+	}
+	if (exec_n) {
+		benchmark_exec(exec_n, thread_nr ? thread_nr : 1);
+		return 0;
+	}
+	if (ext_path) {
+		struct ext_graph X;
+		FILE * in = fopen(ext_path, "r");
+		unsigned int N, pass_nr;
+		uint64_t run_read, run_written;
+		double t0, t1, t2;
+
+		if (!in) {
+			perror(ext_path);
+			exit(EXIT_FAILURE);
+		}
+		t0 = seconds();
+		if (!ext_runs(&X, in, (ext_memory ? ext_memory : EXT_MEMORY) << 20))
+			exit(EXIT_FAILURE);
+		fclose(in);
+		t1 = seconds();
+		run_read = X.bytes_read;
+		run_written = X.bytes_written;
+		X.bytes_read = 0;
+		N = ext_sort(&X, stdout, 1, (ext_memory ? ext_memory : EXT_MEMORY) << 20,
+			     &pass_nr);
+		t2 = seconds();
+		fprintf(stderr, "%u objects, %llu pairs: %u runs in %.3f s "
+			"(%.1f bytes read and %.1f written a pair), %u passes in %.3f s "
+			"(%.2f bytes read a pair, %.0f pairs/s).\n",
+			X.n, (unsigned long long)X.m, X.runs, t1 - t0,
+			X.m ? (double)run_read / X.m : 0, X.m ? (double)run_written / X.m : 0,
+			pass_nr, t2 - t1, X.m ? (double)X.bytes_read / X.m : 0,
+			X.m / (t2 - t0));
+		if (N < X.n)
+			fprintf(stderr, "%u objects are left with COUNT > 0: there is a loop.\n",
+				X.n - N);
+		ext_free(&X);
+		return N < X.n ? EXIT_FAILURE : 0;
+	}
+	if (load_path) {
+		struct graph g;
+		unsigned int * out;
+		unsigned int * level = 0;
+		unsigned int level_nr;
+		unsigned int N;
+		double t0, t1, t2;
+		struct stat st;
+
+		t0 = seconds();
+		if (!graph_load(&g, load_path, thread_nr ? thread_nr : 1))
+			exit(EXIT_FAILURE);
+		t1 = seconds();
+		out = (unsigned int *)malloc(sizeof(unsigned int) * (g.n + 1));
+		assert(out);
+		if (thread_nr) {
+			level = (unsigned int *)malloc(sizeof(unsigned int) * (g.n + 1));
+			assert(level);
+			N = topo_levels(&g, out, level, &level_nr, thread_nr, ordered);
+		}
+		else {
+			N = topo_sort(&g, out);
+		}
+		t2 = seconds();
+		stat(load_path, &st);
+		fprintf(stderr, "%u objects, %zu pairs: read in %.3f s (%.0f MB/s, "
+			"%.2f ns/pair), sorted in %.3f s.\n", g.n, g.m, t1 - t0,
+			st.st_size / 1e6 / (t1 - t0), g.m ? (t1 - t0) * 1e9 / g.m : 0,
+			t2 - t1);
+		for (i = 0; i < (int)N; i++)
+			printf("%u\n", out[i]);
+		if (N < g.n) {
+			struct loops L;
+			topo_loops(&g, out, N, &L);
+			print_loops(stderr, &L, LOOP_PRINT);
+			loops_free(&L);
+		}
+		free(level);
+		free(out);
+		graph_free(&g);
+		return N < g.n ? EXIT_FAILURE : 0;
+	}
+	if (lex) {
+		struct pairs P;
+		struct graph g;
+		struct schedule S;
+		unsigned int out[LIMIT / 2];
+		unsigned int weight[LIMIT / 2];
+		unsigned int prio[LIMIT / 2];
+		unsigned int rank[LIMIT / 2];
+		unsigned int at[LIMIT / 2];
+		unsigned int N;
+
+		pairs_init(&P);
+		input_pairs(&P, input);
+		graph_build(&g, &P);
+		priority_ranks(g.n, 0, rank, at);
+		N = topo_priority(&g, rank, at, out);
+		printf("smallest first: ");
+		for (i = 0; i < (int)N; i++)
+			printf("%s%u", i ? ", " : "", out[i]);
+		printf(".\n");
+
+		/* the jobs of ``-e'', the latest start first */
+		for (i = 0; i <= (int)g.n; i++)
+			weight[i] = i;
+		topo_schedule(&g, weight, out, &S);
+		for (i = 1; i <= (int)g.n; i++)
+			prio[i] = S.LS[i];
+		priority_ranks(g.n, prio, rank, at);
+		N = topo_priority(&g, rank, at, out);
+		printf("by latest start (job k taking k units of time): ");
+		for (i = 0; i < (int)N; i++)
+			printf("%s%u", i ? ", " : "", out[i]);
+		printf(".\n");
+		schedule_free(&S);
+		graph_free(&g);
+		pairs_free(&P);
+		return 0;
+	}
+	if (schedule) {
+		struct pairs P;
+		struct graph g;
+		struct schedule S;
+		unsigned int out[LIMIT / 2];
+		unsigned int weight[LIMIT / 2];
+		unsigned int N;
+
+		pairs_init(&P);
+		input_pairs(&P, input);
+		graph_build(&g, &P);
+		for (i = 0; i <= (int)g.n; i++)
+			weight[i] = i;	/* job k takes k units of time */
+		N = topo_schedule(&g, weight, out, &S);
+		assert(N == g.n);
+		print_schedule(&S, weight, out, N);
+		schedule_free(&S);
+		graph_free(&g);
+		pairs_free(&P);
+		return 0;
+	}
+	if (extra_nr || closure) {
+		struct pairs P;
+		struct graph g;
+		struct loops L;
+		unsigned int out[LIMIT / 2];
+		unsigned int N;
+
+		if (extra_nr != change_nr) {
+			print_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		pairs_init(&P);
+		input_pairs(&P, input);
+		for (i = 0; i < change_nr; i++)
+			add_pair(&P, change[2 * i], change[2 * i + 1]);
+		graph_build(&g, &P);
+		N = topo_sort(&g, out);
+		printf("Output: ");
+		for (i = 0; i < N; i++)
+			printf("%s%u", i ? ", " : "", out[i]);
+		printf(".\n");
+		if (N < g.n) {
+			topo_loops(&g, out, N, &L);
+			print_loops(stdout, &L, LOOP_PRINT);
+			loops_free(&L);
+		}
+		else if (closure) {
+			struct closure C;
+			struct pairs red;
+			unsigned int k;
+			pairs_init(&red);
+			closure_build(&C, &g, out, &red);
+			for (i = 0; i < (int)N; i++) {
+				printf("%u reaches", out[i]);
+				for (k = 1; k <= g.n; k++)
+					if (reaches(&C, out[i], k))
+						printf(" %u", k);
+				printf(".\n");
+			}
+			printf("transitive reduction:");
+			for (i = 0; i < (int)red.nr; i++)
+				printf(" %u ≺ %u", red.jk[2 * i], red.jk[2 * i + 1]);
+			printf(" (%zu of %zu pairs).\n", red.nr, P.nr);
+			closure_free(&C);
+			pairs_free(&red);
+		}
+		graph_free(&g);
+		pairs_free(&P);
+		return 0;
+	}
+	if (change_nr) {
+		struct pairs P;
+		struct graph g;
+		struct dyn_topo D;
+		unsigned int out[LIMIT / 2];
+		unsigned int N;
+
+		pairs_init(&P);
+		input_pairs(&P, input);
+		graph_build(&g, &P);
+		N = topo_sort(&g, out);
+		assert(N == g.n);
+		(void)N;	/* only assert() reads it */
+		dyn_init(&D, &g, out);
+		for (i = 0; i < change_nr; i++) {
+			unsigned int j = change[2 * i];
+			unsigned int k = change[2 * i + 1];
+			unsigned int p;
+			if (change_op[i] == 'r') {
+				printf("%u ≺ %u %s.\n", j, k, dyn_delete(&D, j, k) ?
+				       "removed" : "is not there");
+			}
+			else if (dyn_insert(&D, j, k)) {
+				printf("%u ≺ %u added.\n", j, k);
+			}
+			else {
+				printf("%u ≺ %u rejected, it would make the loop ", j, k);
+				for (p = 0; p < D.path_nr; p++)
+					printf("%u ≺ ", D.path[p]);
+				printf("%u.\n", k);
+			}
+		}
+		printf("Output: ");
+		for (i = 0; i < D.n; i++)
+			printf("%s%u", i ? ", " : "", D.at[i]);
+		printf(".\n");
+		dyn_free(&D);
+		graph_free(&g);
+		pairs_free(&P);
+		return 0;
+	}
+	if (thread_nr) {
+		struct pairs P;
+		struct graph g;
+		unsigned int out[LIMIT / 2];
+		unsigned int level[LIMIT / 2 + 1];
+		unsigned int level_nr;
+		unsigned int N;
+
+		pairs_init(&P);
+		input_pairs(&P, input);
+		graph_build(&g, &P);
+		N = topo_levels(&g, out, level, &level_nr, thread_nr, ordered);
+		assert(N == g.n);
+		(void)N;	/* only assert() reads it */
+		print_levels(out, level, level_nr);
+		graph_free(&g);
+		pairs_free(&P);
+		return 0;
+	}
+
+	Algorithm_T(input);
+
+	free(change_op);
+	free(change);
+	return 0;
+}
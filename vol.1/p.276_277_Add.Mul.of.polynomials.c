@@ -3,17 +3,31 @@
  * Algorithm 2.2.4M @ TAOCP::p.277
  *
  * author: Forrest Y. Yu <forrest.yu@gmail.com>, http://forrestyu.net/
+ *
+ * The exponents of a term are packed into one 64-bit word, the ABC field of
+ * the book: the exponent of the first variable in the highest bits, so that
+ * the words compare as the terms are ordered, and the exponents of a
+ * product are the sum of the words. Every exponent has GUARD_BITS above it,
+ * which are 0 in a term; if an exponent of a product is too large, its carry
+ * goes into them, and mono_mul() says so instead of giving another term.
+ * The special node at the end of a list has ABC = -1, as in the book, which
+ * is why the word is signed: the exponents fit in the other 63 bits.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 /*
  * Macroes
  */
-#define POOL_SIZE	32
-#define ABC(t)		((t)->sign * ((t)->A << 8 | (t)->B << 4 | (t)->C))
+#define POOL_SIZE	128
+#define VARS		3		/* the number of variables */
+#define VAR_NAMES	"xyz"		/* how they are written */
+#define EXP_BITS	{19, 19, 19}	/* the bits of their exponents */
+#define GUARD_BITS	1		/* above every exponent, for a carry */
 #define ENABLE_COLOR(x)	{putchar(033); printf("[%sm", x);}
 #define DISABLE_COLOR()	{putchar(033); printf("[0m");}
 
@@ -22,28 +36,80 @@
  */
 struct PTerm {			/* polynomial term */
 	int		coef;	/* coefficient */
-	int		sign;	/* 1, -1 */
-	int		A;	/* exponent of x */
-	int		B;	/* exponent of y */
-	int		C;	/* exponent of z */
+	int64_t		ABC;	/* the exponents, see mono_init(); -1 at the end */
 	struct PTerm *	LINK;
 };
 
+/*
+ * Monomials
+ */
+const int mono_bits[VARS] = EXP_BITS;
+int mono_shift[VARS];		/* where the exponent of variable i is */
+int64_t mono_guard;		/* the guard bits of all the exponents */
+
+void mono_init()
+{
+	int i;
+	int shift = 0;
+
+	mono_guard = 0;
+	for (i = VARS - 1; i >= 0; i--) {
+		assert(mono_bits[i] >= 1 && mono_bits[i] + GUARD_BITS <= 63);
+		mono_shift[i] = shift;
+		shift += mono_bits[i];
+		mono_guard |= (((int64_t)1 << GUARD_BITS) - 1) << shift;
+		shift += GUARD_BITS;
+	}
+	assert(shift <= 63);	/* the sign is for the special node */
+	assert(strlen(VAR_NAMES) == VARS);
+}
+
+/* the exponent of variable i */
+int64_t mono_exp(int64_t ABC, int i)
+{
+	return (ABC >> mono_shift[i]) & (((int64_t)1 << mono_bits[i]) - 1);
+}
+
+/* ABC with the exponent of variable i set to e */
+int64_t mono_set(int64_t ABC, int i, int64_t e)
+{
+	if (e < 0 || e >= ((int64_t)1 << mono_bits[i])) {
+		fprintf(stderr, "the exponent %lld of %c has more than %d bits\n",
+			(long long)e, VAR_NAMES[i], mono_bits[i]);
+		exit(EXIT_FAILURE);
+	}
+	ABC &= ~((((int64_t)1 << mono_bits[i]) - 1) << mono_shift[i]);
+	return ABC | (int64_t)e << mono_shift[i];
+}
+
+/* the exponents of the product of two terms: one add, and a look at the guard bits */
+int64_t mono_mul(int64_t ABC1, int64_t ABC2)
+{
+	int64_t ABC = ABC1 + ABC2;
+	int i;
+
+	if (ABC & mono_guard) {
+		for (i = 0; i < VARS; i++)
+			if (mono_exp(ABC1, i) + mono_exp(ABC2, i) >= ((int64_t)1 << mono_bits[i]))
+				fprintf(stderr, "the exponent %lld of %c has more than %d bits\n",
+					(long long)(mono_exp(ABC1, i) + mono_exp(ABC2, i)),
+					VAR_NAMES[i], mono_bits[i]);
+		exit(EXIT_FAILURE);
+	}
+	return ABC;
+}
+
 /*
  * Memory Management
  */
-struct PTerm * Alloc_PTerm(int coef,
-			   int sign, int A, int B, int C,
-			   struct PTerm * LINK)
+struct PTerm * Alloc_PTerm(int coef, int64_t ABC, struct PTerm * LINK)
 {
 	static struct PTerm PT_Pool[POOL_SIZE];
 	static int pos = 0;
+	assert(pos < POOL_SIZE);
 	struct PTerm * t =  &PT_Pool[pos++];
 	t->coef = coef;
-	t->sign = sign;
-	t->A = A;
-	t->B = B;
-	t->C = C;
+	t->ABC = ABC;
 	t->LINK = LINK;
 	return t;
 }
@@ -58,13 +124,13 @@ void Free_PTerm(struct PTerm * t)
  */
 void print_PTerm(struct PTerm *t)
 {
+	int i;
 	assert(t);
 	printf("-------------------- %ph\n", t);
 	printf("%19d\n",  t->coef);
-	printf("%2d",     t->sign);
-	printf("%3d",     t->A);
-	printf("%2d",     t->B);
-	printf("%2d",     t->C);
+	printf("%2d",     t->ABC < 0 ? -1 : 1);
+	for (i = 0; i < VARS; i++)
+		printf(i ? "%2lld" : "%3lld", t->ABC < 0 ? 0LL : (long long)mono_exp(t->ABC, i));
 	printf("%9ph\n",  t->LINK);
 }
 
@@ -87,22 +153,19 @@ void assert_polynomial_valid(struct PTerm *PTR)
 {
 	struct PTerm *t;
 	assert(PTR->coef == 0   &&
-	       PTR->sign == -1  &&
-	       PTR->A    == 0   &&
-	       PTR->B    == 0   &&
-	       PTR->C    == 1);
+	       PTR->ABC  == -1);
 	for (t = PTR->LINK; t != PTR; t = t->LINK) {
-		assert(t->sign == 1 || t->sign == -1);
+		assert(t->ABC >= 0 && !(t->ABC & mono_guard));
 		assert(t->coef != 0);
 		assert(t->LINK);
 
-		if (!(ABC(t) > ABC(t->LINK))) {
-			printf("ABC(t): %d, ABC(t->LINK): %d\n",
-			       ABC(t), ABC(t->LINK));
+		if (!(t->ABC > t->LINK->ABC)) {
+			printf("ABC(t): %llx, ABC(t->LINK): %llx\n",
+			       (long long)t->ABC, (long long)t->LINK->ABC);
 			print_PTerm(t);
 			print_PTerm(t->LINK);
 		}
-		assert(ABC(t) > ABC(t->LINK));
+		assert(t->ABC > t->LINK->ABC);
 	}
 }
 
@@ -113,48 +176,41 @@ void assert_polynomial_valid(struct PTerm *PTR)
  */
 struct PTerm * str2polynomial(const char *s)
 {
-	int n;
-	int * e;
+	int64_t n;
+	int e;			/* the variable of an exponent */
+	const char * v;
 	enum NUM_TYPE {COEFFICIENT, EXPONENT} nt;
 
 	const char * p = s;
-	struct PTerm *PTR = Alloc_PTerm(0, -1, 0, 0, 1, 0);
+	struct PTerm *PTR = Alloc_PTerm(0, -1, 0);
 	struct PTerm *t = PTR;
 	
 	while (*p) {
 		if (*p != '-') { /* for the invisible leading '+' */
-			t->LINK = Alloc_PTerm(0, 1, 0, 0, 0, 0);
+			t->LINK = Alloc_PTerm(0, 0, 0);
 			t = t->LINK;
 			t->coef = 1;
 		}
 
-		e = 0;
+		e = -1;
 		nt = COEFFICIENT;
 
 		while (*p) {
-			switch (*p) {
-			case 'x':
+			if (*p >= 'a' && *p <= 'z') {
+				v = strchr(VAR_NAMES, *p);
+				assert(v);
 				if (p[1] == '^')
-					e = &t->A;
+					e = v - VAR_NAMES;
 				else
-					t->A = 1;
-				break;
-			case 'y':
-				if (p[1] == '^')
-					e = &t->B;
-				else
-					t->B = 1;
-				break;
-			case 'z':
-				if (p[1] == '^')
-					e = &t->C;
-				else
-					t->C = 1;
-				break;
+					t->ABC = mono_set(t->ABC, v - VAR_NAMES, 1);
+				p++;
+				continue;
+			}
+			switch (*p) {
 			case '+':
 			case '-':
 				/* '+' or '-' is the beginning of a new term */
-				t->LINK = Alloc_PTerm(0, 1, 0, 0, 0, 0);
+				t->LINK = Alloc_PTerm(0, 0, 0);
 				t = t->LINK;
 				nt = COEFFICIENT;
 				t->coef = (*p == '+' ? 1 : -1);
@@ -166,8 +222,13 @@ struct PTerm * str2polynomial(const char *s)
 				assert(*p >= '0' && *p <= '9');
 
 				n = 0;
-				while (*p && *p >= '0' && *p <= '9')
-					n = n * 10 + (*p++ - '0');
+				while (*p && *p >= '0' && *p <= '9') {
+					if (n <= (INT64_MAX - 9) / 10)
+						n = n * 10 + (*p - '0');
+					else
+						n = INT64_MAX;	/* too large anyway */
+					p++;
+				}
 				p--; /* this is important */
 
 				if (nt == COEFFICIENT) {
@@ -176,8 +237,8 @@ struct PTerm * str2polynomial(const char *s)
 				}
 				else {
 					assert(nt == EXPONENT);
-					assert(e);
-					*e = n;
+					assert(e >= 0);
+					t->ABC = mono_set(t->ABC, e, n);
 				}
 
 				break;
@@ -216,17 +277,19 @@ char * polynomial2str(char * ps, struct PTerm *PTR)
 		else if (t->coef != 1)
 			s += sprintf(s, "%d", t->coef);
 
-		int xyz[3];
-		xyz[0] = t->A;
-		xyz[1] = t->B;
-		xyz[2] = t->C;
-		for (i = 0; i < 3; i++) {
-			if (xyz[i] != 0) {
-				*s++ = 'x' + i;
-				if (xyz[i] > 1) {
-					int l = strlen(e[xyz[i]]);
-					memcpy(s, e[xyz[i]], l);
-					s += l;
+		for (i = 0; i < VARS; i++) {
+			int64_t x = mono_exp(t->ABC, i);
+			if (x != 0) {
+				*s++ = VAR_NAMES[i];
+				if (x > 1) {
+					char d[24];
+					char * c;
+					sprintf(d, "%lld", (long long)x);
+					for (c = d; *c; c++) {
+						int l = strlen(e[*c - '0']);
+						memcpy(s, e[*c - '0'], l);
+						s += l;
+					}
 				}
 			}
 		}
@@ -248,15 +311,15 @@ void add_polynomials(struct PTerm *P, struct PTerm *Q)
 	Q  = Q->LINK;
 
 	while (1) {
-		if (ABC(P) < ABC(Q)) { /* A2 */
-			printf("(%x < %x) ", ABC(P), ABC(Q));
+		if (P->ABC < Q->ABC) { /* A2 */
+			printf("(%llx < %llx) ", (long long)P->ABC, (long long)Q->ABC);
 
 			Q1 = Q;
 			Q  = Q->LINK;
-		} else if (ABC(P) == ABC(Q)) { /* A3 */
-			printf("(%x == %x) ", ABC(P), ABC(Q));
+		} else if (P->ABC == Q->ABC) { /* A3 */
+			printf("(%llx == %llx) ", (long long)P->ABC, (long long)Q->ABC);
 
-			if (ABC(P) < 0)
+			if (P->ABC < 0)
 				break;
 
 			Q->coef += P->coef;
@@ -275,12 +338,9 @@ void add_polynomials(struct PTerm *P, struct PTerm *Q)
 			}
 
 		} else {/* ABC(P) > ABC(Q) */ /* A5 */
-			printf("(%x > %x) ", ABC(P), ABC(Q));
+			printf("(%llx > %llx) ", (long long)P->ABC, (long long)Q->ABC);
 
-			struct PTerm * Q2 = Alloc_PTerm(P->coef,
-							P->sign,
-							P->A, P->B, P->C,
-							Q);
+			struct PTerm * Q2 = Alloc_PTerm(P->coef, P->ABC, Q);
 			Q1->LINK = Q2;
 			Q1 = Q2;
 			P = P->LINK;
@@ -299,10 +359,10 @@ void mul_polynomials(struct PTerm *P, struct PTerm *M, struct PTerm *Q)
 	while (1) {
 		/* M1 */
 		M = M->LINK;
-		if (ABC(M) < 0)
+		if (M->ABC < 0)
 			break;
 
-		assert(ABC(P) < 0 && ABC(Q) < 0);
+		assert(P->ABC < 0 && Q->ABC < 0);
 
 		/* M2 (a slightly modified add_polynomials()) */
 
@@ -312,16 +372,16 @@ void mul_polynomials(struct PTerm *P, struct PTerm *M, struct PTerm *Q)
 		Q  = Q->LINK;
 
 		while (1) {
-			int ABC_P = ABC(P) < 0 ? -1 : ABC(P) + ABC(M);
-			int ABC_Q = ABC(Q);
+			int64_t ABC_P = P->ABC < 0 ? -1 : mono_mul(P->ABC, M->ABC);
+			int64_t ABC_Q = Q->ABC;
 
 			if (ABC_P < ABC_Q) { /* A2 */
-				printf("(%x < %x) ", ABC_P, ABC_Q);
+				printf("(%llx < %llx) ", (long long)ABC_P, (long long)ABC_Q);
 
 				Q1 = Q;
 				Q  = Q->LINK;
 			} else if (ABC_P == ABC_Q) { /* A3 */
-				printf("(%x == %x) ", ABC_P, ABC_Q);
+				printf("(%llx == %llx) ", (long long)ABC_P, (long long)ABC_Q);
 
 				if (ABC_P < 0)
 					break;
@@ -342,16 +402,11 @@ void mul_polynomials(struct PTerm *P, struct PTerm *M, struct PTerm *Q)
 				}
 
 			} else {/* ABC_P > ABC_Q */ /* A5 */
-				printf("(%x > %x) ", ABC_P, ABC_Q);
+				printf("(%llx > %llx) ", (long long)ABC_P, (long long)ABC_Q);
 
-				assert(P->sign > 0 && M->sign >0);
+				assert(P->ABC >= 0 && M->ABC >= 0);
 				struct PTerm * Q2;
-				Q2 = Alloc_PTerm(P->coef * M->coef,
-						 P->sign,
-						 P->A + M->A,
-						 P->B + M->B,
-						 P->C + M->C,
-						 Q);
+				Q2 = Alloc_PTerm(P->coef * M->coef, ABC_P, Q);
 				Q1->LINK = Q2;
 				Q1 = Q2;
 				P = P->LINK;
@@ -518,8 +573,44 @@ void test_mul_3()
 	print_polynomial(Q);
 }
 
+void test_mul_4()
+{
+	char s1[128] = "";
+	char s2[128] = "";
+	char s3[128] = "";
+
+	/* exponents of more than 4 bits */
+	const char sP[] = "x^100y^3+z^17";
+	const char sM[] = "x^20-z^17";
+	const char sQ[] = "x^100y^3z^17";
+
+	struct PTerm * P = str2polynomial(sP);
+	printf("%s <%s>\n", sP, polynomial2str(s1, P));
+	print_polynomial(P);
+
+	struct PTerm * M = str2polynomial(sM);
+	printf("%s <%s>\n", sM, polynomial2str(s2, M));
+	print_polynomial(M);
+
+	struct PTerm * Q = str2polynomial(sQ);
+	printf("%s <%s>\n", sQ, polynomial2str(s2, Q));
+	print_polynomial(Q);
+
+	printf("\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
+	printf("(%s) + (%s) * (%s)\n",
+	       polynomial2str(s2, Q),
+	       polynomial2str(s1, P),
+	       polynomial2str(s3, M));
+	mul_polynomials(P, M, Q);
+
+	printf("(%s)\n", polynomial2str(s2, Q));
+	print_polynomial(Q);
+}
+
 int main()
 {
+	mono_init();
+
 	ENABLE_COLOR("31")
 	printf("##################################################\n");
 
@@ -545,6 +636,11 @@ int main()
 
 	test_mul_3();
 
+	ENABLE_COLOR("32")
+	printf("##################################################\n");
+
+	test_mul_4();
+
 	DISABLE_COLOR()
 
 	return 0;
@@ -6,18 +6,73 @@
  * date:   Jan.24,2011
  *
  * compile and run:
- *         $ gcc -g -Wall -o elevator p.283_elevator.c
+ *         $ gcc -g -Wall -o elevator p.283_elevator.c -lm -pthread
  *         $ ./elevator
  *
+ * choose the backend of the WAIT list (see ``wait_backends[]''):
+ *         $ ./elevator -w list		(the doubly linked list in the book)
+ *         $ ./elevator -w binheap	(default)
+ *         $ ./elevator -w pairing
+ *         $ ./elevator -w calendar
+ *     all backends execute the WAIT list in exactly the same order, so
+ *     the log files of any two of them should be identical. ``-C'' runs
+ *     a backend next to the list and compares every node they execute
+ *     (see compare_backends()):
+ *         $ ./elevator -C calendar
+ *         $ ./elevator -C pairing -n 1000000 -f 20 -c 4 -r 30 -g exp:2000
+ *
+ * simulate a taller building with more cars (see struct building):
+ *         $ ./elevator -f 64 -c 8 -h 2	(64 floors, 8 cars, home floor 2)
+ *     users[] below needs at least 5 floors, the other workloads 2.
+ *
+ * simulate 10^7 random users without log, to measure the events/s:
+ *         $ gcc -O2 -Wall -DNO_TRACE -o elevator p.283_elevator.c -lm
+ *         $ ./elevator -q -n 10000000 -f 20 -c 4 -r 30 -g exp:2000
+ *
+ * at night most of the steps take idle cars home; ``-Z'' skips them, with
+ * the same statistics (see idle_home()):
+ *         $ ./elevator -q -Z -n 300000 -f 20 -c 4 -r 20000 -g exp:1500
+ *
+ * compare 200 replications of 10^5 users each, on all the CPUs:
+ *         $ ./elevator -n 100000 -f 20 -c 4 -r 30 -g exp:2000 -R 200
+ *     every replication has its own struct sim, see run_replications().
+ *
+ * stress a crowded lobby: one car, tens of thousands of users waiting:
+ *         $ ./elevator -q -n 200000 -f 5 -c 1 -r 2 -g uniform:2000:40000
+ *     nobody is searched for in QUEUE[] or ELEVATOR, see out_QUEUE().
+ *     The same run with the searches of the book back, to compare (minutes):
+ *         $ gcc -O2 -Wall -DNO_TRACE -DSEARCH_USERS -o elevator-search p.283_elevator.c -lm
+ *         $ ./elevator-search -q -n 200000 -f 5 -c 1 -r 2 -g uniform:2000:40000
+ *
+ * replay the users of a file of ENTERTIME,IN,OUT,GIVEUPTIME rows, as is or
+ * converted to the binary form first (see replay_open()):
+ *         $ ./elevator -i lobby.csv -f 20 -c 4
+ *         $ ./elevator -e lobby.csv lobby.bin
+ *         $ ./elevator -q -i lobby.bin -f 20 -c 4
+ *
+ * simulate a campus of 64 banks that never interact, on all the CPUs,
+ * observed every 100000 units of TIME:
+ *         $ ./elevator -n 100000 -f 20 -c 4 -r 30 -K 64:100000
+ *     every bank has its own struct sim, see run_campus().
+ *
+ * simulate the warm-up once, then fork 100 branches from its end:
+ *         $ ./elevator -q -n 1000000 -f 20 -c 4 -r 30 -S 3000000:warm.snap
+ *         $ ./elevator -L warm.snap -F 100
+ *     see snapshot_write().
+ *
+ * write a binary trace instead of the log, and decode it afterwards:
+ *         $ ./elevator -t elevator.trace -n 1000000 -f 20 -c 4 -r 30
+ *         $ ./elevator -d elevator.trace | less
+ *     the trace can be compiled out completely with -DNO_TRACE.
+ *
  * profiling:
- *         $ gcc -g -Wall -pg -o elevator p.283_elevator.c
+ *         $ gcc -g -Wall -pg -o elevator p.283_elevator.c -lm -pthread
  *         $ ./elevator
  *         $ gprof ./elevator
  *
  * part of gprof output:
  *         calls    name    
  *          3224    xlog
- *          1152    get_func_info
  *           300    get_STATE_str
  *           288    alloc_WAIT_node
  *           288    in_WAIT
@@ -54,12 +109,23 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <limits.h>
 
 /*
  * TODO:
- *     1. rewrite alloc_XXXX_node() so that freed node can be reused.
- *     2. write ascii-art log to show an elevator system animation
+ *     1. write ascii-art log to show an elevator system animation
  */
 
 /****************************************************************************************************
@@ -297,10 +363,17 @@
 #define ENABLE_COLOR(x)		{putchar(033); printf("[%sm", x);}
 #define DISABLE_COLOR()		{putchar(033); printf("[0m");}
 #define DEFAULT_GIVEUPTIME	1000
-#define POOL_SIZE		8192
-#define FLOOR_NR		5
+#define DEFAULT_INTERTIME	100
+#define SLAB_CHUNK		1024
+#define SLAB_ALIGN		16
+#define NO_CAR			0
+#define DEFAULT_FLOOR_NR	5
+#define DEFAULT_HOME		2
+#define DEFAULT_CAR_NR		1
 #define MIN_FLOOR		0
-#define MAX_FLOOR		(FLOOR_NR - 1)
+#define MAX_FLOOR		(sim->B.floor_nr - 1)
+#define HOME			(sim->B.home)
+#define BS_BITS			64
 #define QL			LLINK2
 #define QR			RLINK2
 #define WL			LLINK1
@@ -308,6 +381,14 @@
 #define EL			LLINK2
 #define ER			RLINK2
 #define TIME			(current_step->ent_time)
+#define AGENDA_SIZE		8
+#define CALENDAR_MIN_NB		16
+#define REPLAY_MAGIC		0x594C5052	/* "RPLY" */
+#define SNAP_MAGIC		0x534C5645	/* "EVLS" */
+#define SNAP_VERSION		2
+#define HDR_SUB_BITS		7	/* 128 sub-buckets a power of 2, see hdr_index() */
+#define HDR_TOP			40	/* larger values than 2^41 - 1 are clamped */
+#define HDR_BUCKETS		((HDR_TOP - HDR_SUB_BITS + 2) << HDR_SUB_BITS)
 
 /* this enum must correspond with ``state_str[]'' in get_STATE_str(): */
 enum elevator_state	{NEUTRAL = 0, GOINGUP = 1, GOINGDOWN = 2};
@@ -317,36 +398,89 @@ enum log_type		{LOG_CLOSE,
 			 LOG_PLAIN, LOG_U, LOG_E, LOG_FUNC_NAME,
 			 LOG_TIME, LOG_STATE, LOG_FLOOR, LOG_FLAG0, LOG_FLAG1};
 
-/* see get_func_info() */
-enum func_info_action	{GET_FUNC_NAME, GET_FUNC_DESC};
+/** the coroutines, a node of the WAIT list runs coroutines[inst], the order
+ *  is the one of ``func'' in the binary trace, see struct trace_rec
+ */
+enum coroutine_id	{CO_NONE,
+			 CO_U1, CO_U2, CO_U3, CO_U4, CO_U5, CO_U6,
+			 CO_E1, CO_E2, CO_E3, CO_E4, CO_E5, CO_E6,
+			 CO_E7, CO_E7A, CO_E8, CO_E8A, CO_E9,
+			 CO_DUMMY, COROUTINE_NR};
 
 /* structs and typedefs */
+struct car;
+
 struct user_info {
 	int	IN;
 	int	OUT;
-	int	ENTERTIME;
+	long	ENTERTIME;
 	int	GIVEUPTIME;
 	char	name[32];
+	struct wait_node * giveup;	/* the pending U4, see out_WAIT() */
+	struct car *	car;	/* the only car he/she may take, see U2() */
+	struct user_node * node;	/* in QUEUE[IN] or ELEVATOR, see out_QUEUE() */
+	int	generated;	/* allocated by next_user() */
+	long	id;		/* ``User <id>'' */
+	long	BOARDTIME;	/* when he/she got in, see U5() */
 };
 
-/** conceptually: waiting_func = funcU | funcE
- *    - waiting_func, as the name suggests, is used in the WAIT list, or in
- *      any cases where funcU and funcE are not distinguished.
+/** conceptually: a coroutine is funcU | funcE, see struct coroutine
+ *    - the WAIT list keeps only its enum coroutine_id
  *    - funcU and funcE are only used when being called.
  */
-typedef void *		waiting_func;
 typedef void (*funcU)  (struct user_info *);
-typedef void (*funcE)  (void);
+typedef void (*funcE)  (struct car *);
 
-/* node in the WAIT list */
+/** node in the WAIT list
+ *  LLINK1 and RLINK1 are used by the list and the calendar queue backends,
+ *  and as ``previous'' and ``next sibling'' by the pairing heap backend.
+ */
 typedef struct wait_node {
 	struct wait_node *	LLINK1;
 	struct wait_node *	RLINK1;
-	int			ent_time;
-	waiting_func		inst;
-	struct user_info *	arg;
+	struct wait_node *	CHILD;	/* pairing heap only */
+	long			ent_time;
+	unsigned int		seq;	/* nodes with the same ent_time are
+					 * executed in the order of in_WAIT()
+					 */
+	int			pos;	/* binary heap only: index in heap[] */
+	int			slot;	/* index in car->agenda[], see U2() */
+	enum coroutine_id	inst;
+	struct car *		car;	/* elevator actions only */
+	struct user_info *	arg;	/* user actions only */
 } WAIT_NODE;
 
+/** a backend of the WAIT list
+ *  A backend only needs to keep the nodes in the order of wait_before(),
+ *  the handles (i.e. the WAIT_NODE pointers) are kept by in_WAIT() and
+ *  out_WAIT().
+ */
+struct wait_backend {
+	const char *	name;
+	void		(*init)(void);
+	void		(*insert)(WAIT_NODE *);
+	WAIT_NODE *	(*pop)(void);		/* returns 0 if empty */
+	void		(*remove)(WAIT_NODE *);
+};
+
+/** a dispatch policy, i.e. who answers a hall call and where a car heads for
+ *  If ``shared'', car->CALLUP and car->CALLDOWN are B.CALLUP and B.CALLDOWN
+ *  for every car, so any car passing by answers any call, as in the book.
+ *  Otherwise every car has its own, and U2() sets the button in the car
+ *  returned by assign() only.
+ */
+struct dispatch_policy {
+	const char *	name;
+	int		shared;
+	int		reserved;	/* the user may only take the assigned car */
+
+	/* the car that answers the call of the user, NO_CAR means every car */
+	struct car *	(*assign)(struct user_info *);
+
+	/* D3: the floor the car should head for, -1 if there is no call */
+	int		(*target)(struct car *);
+};
+
 /* node in QUEUE[0..4] and ELEVATOR lists */
 typedef struct user_node {
 	struct user_node *	LLINK2;
@@ -354,28 +488,197 @@ typedef struct user_node {
 	struct user_info *	uinfo;
 } USER_NODE;
 
+/** an elevator (car)
+ *  Everything that the book keeps in globals for its only elevator is here,
+ *  except CALLUP[] and CALLDOWN[], which are buttons on the floors and are
+ *  shared by all the cars (see struct building).
+ */
+struct car {
+	int			id;
+	enum elevator_state	STATE;
+	int			FLOOR;	/* the current position of the elevator */
+	int			D1;	/* is zero except during the time people are
+					 * getting in or out of the elevator
+					 */
+	int			D2;	/* becomes zero if the elevator has sat on
+					 * one floor without moving for 30s or more
+					 */
+	int			D3;	/* is zero except when the doors are open but
+					 * nobody is getting in or out of the elevator
+					 */
+	uint64_t *		CALLUP;		/* the hall calls this car answers, */
+	uint64_t *		CALLDOWN;	/* see struct dispatch_policy */
+	uint64_t *		CALLCAR;	/* bitset, see bs_test() */
+	USER_NODE *		ELEVATOR;	/* ELEVATOR[j]: the users in the car
+						 * with OUT == j, in order of entry,
+						 * so that E4() need not search them
+						 */
+	int			riders;		/* users in ELEVATOR */
+	int			current_elevator_step;	/* 0xE1~0xE9 means E1~E9 */
+	int			dormant;
+
+	/** the pending actions of this elevator (i.e. nodes in the WAIT list
+	 *  whose ``car'' is this one), so that U2() and out_WAIT() need not
+	 *  search the whole WAIT list.
+	 */
+	struct wait_node *	agenda[AGENDA_SIZE];
+	int			agenda_nr;
+};
+
+/** the building, sized at runtime by building_init()
+ *  The CALL variables are bitsets of floor_nr bits, so that ``is there any
+ *  call above/below FLOOR'' is answered a word (64 floors) at a time, see
+ *  bs_next() and bs_prev().
+ */
+struct building {
+	int			floor_nr;
+	int			home;	/* where the elevators are dormant */
+	int			car_nr;
+	int			word_nr;	/* words in a bitset */
+	USER_NODE *		QUEUE;		/* QUEUE[floor_nr] */
+	long			queued;		/* users in QUEUE[] */
+	uint64_t *		CALLUP;
+	uint64_t *		CALLDOWN;
+	uint64_t *		zero;		/* an empty bitset */
+	struct car *		cars;		/* cars[car_nr] */
+};
+
+/* a slab of nodes, see slab_alloc() */
+struct slab {
+	const char *	name;
+	size_t		size;		/* node size, rounded up to SLAB_ALIGN */
+	void *		free_list;
+	void *		chunks;		/* linked by the first word of the chunk */
+	char *		cur;		/* the next uncarved node */
+	char *		end;		/* the end of the newest chunk */
+
+	/* statistics */
+	long		chunk_nr;
+	long		in_use;
+	long		high_water;	/* max of in_use */
+	long		alloc_nr;
+	long		reuse_nr;	/* allocs served by the free list */
+};
+
+
+/* see next_user() */
+enum giveup_dist	{GIVEUP_FIXED, GIVEUP_UNIFORM, GIVEUP_EXP};
+
+/** a row of a replay file (see replay_row()), the binary form is a
+ *  struct replay_head followed by these
+ */
+struct replay_rec {
+	int64_t		time;		/* ENTERTIME */
+	int32_t		patience;	/* GIVEUPTIME */
+	uint16_t	in;
+	uint16_t	out;
+};
+
+struct replay_head {
+	uint32_t	magic;		/* REPLAY_MAGIC */
+	uint32_t	rec_size;	/* sizeof(struct replay_rec) */
+};
+
+struct workload {
+	long			user_nr;	/* 0 means users[] */
+	long			generated;
+	double			intertime;	/* mean of INTERTIME */
+	enum giveup_dist	giveup;
+	double			giveup_a;	/* FIXED: a, UNIFORM: [a, b], */
+	double			giveup_b;	/* EXP: mean a */
+	double *		origin_cdf;	/* origin_cdf[floor_nr] */
+	double *		dest_cdf;	/* dest_cdf[IN * floor_nr + OUT] */
+	uint64_t		rng;
+	long			next_time;	/* ENTERTIME of the next user */
+	int			table_pos;	/* the next user in users[] */
+
+	/* ``-i'', see replay_open() */
+	const char *		replay_file;
+	const char *		replay;		/* the mapped file */
+	size_t			replay_size;
+	size_t			replay_pos;	/* the next row */
+	long			replay_line;	/* for the messages */
+	int			replay_bin;	/* binary, not CSV */
+
+	/* statistics */
+	long			in_system;
+	long			max_in_system;
+	long			gave_up;
+	long			delivered;
+	double			journey_sum;	/* from U1 to U6 */
+};
+
+/** a histogram of fixed size (HDR_BUCKETS counts), whose buckets are as wide
+ *  as 1/128 of their values, see hdr_index()
+ */
+struct hdr {
+	uint64_t	counts[HDR_BUCKETS];
+	long		n;
+	double		sum;
+	long		min;
+	long		max;
+};
+
+/** the statistics of a simulation, see metrics_dump(). they take no memory
+ *  per user, and a few stores per event.
+ */
+struct metrics {
+	struct hdr	wait;		/* from U1 to U5 */
+	struct hdr	ride;		/* from U5 to U6 */
+
+	/* per floor */
+	long *		arrived;	/* U2 */
+	long *		gave_up;	/* U4 */
+	long *		boarded;	/* U5 (by E4) */
+	long *		alighted;	/* U6 (by E4) */
+	long *		queue_len;	/* of QUEUE[], see metrics_queue() */
+	long *		queue_max;
+	long *		queue_since;	/* TIME of the last change of queue_len */
+	double *	queue_area;	/* of queue_len over TIME */
+
+	/* per car */
+	long *		moves;		/* E7, E8 */
+
+	long		start;		/* TIME when the metrics started */
+	long		period;		/* of ``-M'', 0 if only at the end */
+	long		next_dump;
+	FILE *		out;
+};
+
+/* the calendar queue backend of the WAIT list, see calendar_link() */
+struct calendar {
+	WAIT_NODE *	bucket;		/* nb list heads */
+	int		nb;		/* number of buckets, a power of 2 */
+	long		width;		/* width of a bucket */
+	int		nr;		/* number of nodes */
+	int		last_bucket;	/* the bucket being executed */
+	long		bucket_top;	/* end of last_bucket in this ``year'' */
+	long		last_time;	/* ent_time of the last popped node */
+	int		resizing;
+};
+
 /* prototype */
-void D(void);
+void D(struct car * c);
 void U1(struct user_info * p);
 void U2(struct user_info * p);
 void U3(struct user_info * p);
 void U4(struct user_info * p);
-void U5(struct user_info * p);
-void U6(struct user_info * p);
+void U5(struct user_info * p, struct car * c);
+void U6(struct user_info * p, struct car * c);
 void U7(struct user_info * p);
 void U8(struct user_info * p);
 void U9(struct user_info * p);
-void E1(void);
-void E2(void);
-void E3(void);
-void E4(void);
-void E5(void);
-void E6(void);
-void E7(void);
-void E7A(void);
-void E8(void);
-void E8A(void);
-void E9(void);
+void E1(struct car * c);
+void E2(struct car * c);
+void E3(struct car * c);
+void E4(struct car * c);
+void E5(struct car * c);
+void E6(struct car * c);
+void E7(struct car * c);
+void E7A(struct car * c);
+void E8(struct car * c);
+void E8A(struct car * c);
+void E9(struct car * c);
 void dummy_func(void);
 
 /* globals */
@@ -406,1076 +709,4060 @@ struct user_info users[] = {
 	{   0,  0,      9999, DEFAULT_GIVEUPTIME, "DUMMY"}
 };
 
-/** THE double linked lists.
- *  These three lists are what the book wants to teach in this section.
+/** a simulation
+ *  Everything that changes while a simulation runs is here, so that one
+ *  process can run several simulations at the same time, one per thread
+ *  (see run_replications()). ``sim'' is the simulation of the calling
+ *  thread. Only the names of the book (WAIT, and current_step for TIME)
+ *  and the counters around them are kept by the macros below; everything
+ *  else is written sim->B, sim->heap, ...
  */
-WAIT_NODE	WAIT;
-USER_NODE	QUEUE[FLOOR_NR];
-USER_NODE	ELEVATOR;
-
-enum elevator_state STATE = NEUTRAL;
-int FLOOR =  2;	/* the current position of the elevator */
-int D1	  =  0; /* is zero except during the time people are getting
-		 * in or out of the elevator
-		 */
-int D2	  =  0; /* becomes zero if the elevator has sat on one floor
-		 * without moving for 30s or more
-		 */
-int D3	  =  0; /* is zero except when the doors are open but nobody is getting
-		 * in or out of the elevator
-		 */
-int CALLUP[FLOOR_NR];
-int CALLDOWN[FLOOR_NR];
-int CALLCAR[FLOOR_NR];
-
-WAIT_NODE *	current_step = 0;
-int		current_elevator_step = 0;	/* 0xE1~0xE9 means E1~E9 respectively */
-int		dormant = 1;
-
-#define DECLARE_ALLOC_NODE(x) x##_NODE * alloc_##x##_node() \
-	{					    \
-	static x##_NODE node_pool[POOL_SIZE];	    \
-	static int i = 0;			    \
-	assert(i < POOL_SIZE);	/** if this assert fails, either the POOL_SIZE \
-				 *  should be enlarged, or it is time to improve \
-				 *  the node allocation mechanism to make nodes	\
-				 *  reusable.				\
-				 */					\
-	return &node_pool[i++];						\
-	}
+struct sim {
+	/** THE double linked lists.
+	 *  These three lists are what the book wants to teach in this section.
+	 *  The WAIT list is kept by one of the ``wait_backends[]'', and WAIT
+	 *  itself is only used by the ``list'' backend.
+	 */
+	WAIT_NODE		WAIT;
+	struct building		B;	/* QUEUE[] is B.QUEUE[], ELEVATOR is B.cars[i].ELEVATOR */
+	struct workload		W;
+
+	const struct wait_backend * WQ;
+	const struct dispatch_policy * DP;
+	unsigned int		wait_seq;
+	WAIT_NODE *		current_step;
+	long			event_nr;	/* number of executed nodes */
+	long			elided_nr;	/* number of nodes skipped, see idle_home() */
+	WAIT_NODE *		arrival;	/* the U1 in the WAIT list, if any */
+
+	/* node allocation, see DECLARE_ALLOC_NODE() */
+	struct slab		WAIT_slab;
+	struct slab		USER_slab;
+	struct slab		user_info_slab;
+
+	/* the backends of the WAIT list */
+	WAIT_NODE **		heap;
+	int			heap_nr;
+	int			heap_max;
+	WAIT_NODE *		pairing_root;
+	struct calendar		cal;
+
+	struct metrics		M;
+};
 
-/* node allocation routines */
-DECLARE_ALLOC_NODE(WAIT)
-DECLARE_ALLOC_NODE(USER)
-	
-/* logging routine */
-void xlog(enum log_type lt, const char *fmt, ...)
-{
-	va_list args;
-	va_start(args, fmt);
+struct sim		main_sim;	/* the simulation of main() */
+__thread struct sim *	sim = 0;
 
-	static FILE * logf = 0;
-	if (!logf) {
-		char logfilename[FILENAME_MAX];
-		char * p;
-		strcpy(logfilename, __FILE__);
-		for (p = logfilename + strlen(logfilename); *p != '.'; p--);
-		strcpy(p, ".log");
-		fprintf(stderr, "logfile: %s\n", logfilename);
+#define WAIT			(sim->WAIT)
+#define wait_seq		(sim->wait_seq)
+#define current_step		(sim->current_step)
+#define event_nr		(sim->event_nr)
+#define elided_nr		(sim->elided_nr)
 
-		logf = fopen(logfilename, "w");
-		assert(logf);
-		fprintf(logf, "%%%% %s - %s\n%%%% %s (%s)\n\n",
-			__DATE__, __TIME__, logfilename, __FILE__);
-	}
-	else {
-		vfprintf(logf, fmt, args);
-	}
+int		quiet = 0;	/* no log at all, see xlog() */
+int		idle_skip = 0;	/* ``-Z'', see idle_home() */
+FILE *		compare_out = 0;	/* ``-C'', see compare_backends() */
 
-	if (lt == LOG_CLOSE) {
-		assert(logf);
-		fclose(logf);
-		fprintf(stderr, "log file closed.\n");
-		logf = 0;
-	}
-	else if (lt == LOG_PLAIN) {
-		DISABLE_COLOR();
-	}
-	else if (lt == LOG_U) {
-		ENABLE_COLOR("1;35"); /* cyan (underscored) */
-	}
-	else if (lt == LOG_E) {
-		ENABLE_COLOR("36"); /* cyan */
-	}
-	else if (lt == LOG_FUNC_NAME) {
-		ENABLE_COLOR("31"); /* red */
-	}
-	else if (lt == LOG_TIME) {
-		ENABLE_COLOR("43"); /* /yellow */
-	}
-	else if (lt == LOG_STATE) {
-		ENABLE_COLOR("47"); /* /gray */
-	}
-	else if (lt == LOG_FLOOR) {
-		ENABLE_COLOR("43"); /* /yellow */
-	}
-	else if (lt == LOG_FLAG0) {
-		ENABLE_COLOR("1;37;47"); /* white/gray */
+void compare_write(const WAIT_NODE * w);
+
+/****************************************************************************************************
+ * Node allocation.
+ *
+ *     Nodes are carved out of chunks of SLAB_CHUNK nodes. A freed node is
+ *     pushed onto the free list of its slab (the first word of a free node
+ *     is the link), and alloc reuses it before carving a new one, so the
+ *     memory is bounded by the number of nodes alive at the same time, not
+ *     by the number of nodes ever allocated.
+ ****************************************************************************************************/
+void slab_init(struct slab * s, const char * name, size_t size)
+{
+	memset(s, 0, sizeof(struct slab));
+	s->name = name;
+	s->size = (size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+}
+
+/* frees all the chunks, i.e. all the nodes of s */
+void slab_destroy(struct slab * s)
+{
+	while (s->chunks) {
+		void * next = *(void **)s->chunks;
+		free(s->chunks);
+		s->chunks = next;
 	}
-	else if (lt == LOG_FLAG1) {
-		ENABLE_COLOR("47"); /* /gray */
+	s->free_list = 0;
+	s->cur = s->end = 0;
+	s->in_use = 0;
+}
+
+void * slab_alloc(struct slab * s)
+{
+	void * p;
+
+	if (s->free_list) {
+		p = s->free_list;
+		s->free_list = *(void **)p;
+		s->reuse_nr++;
 	}
 	else {
-		assert(0);
+		if (s->cur == s->end) {
+			char * chunk = (char *)malloc(SLAB_ALIGN + s->size * SLAB_CHUNK);
+			assert(chunk);
+			*(void **)chunk = s->chunks;
+			s->chunks = chunk;
+			s->cur = chunk + SLAB_ALIGN;
+			s->end = s->cur + s->size * SLAB_CHUNK;
+			s->chunk_nr++;
+		}
+		p = s->cur;
+		s->cur += s->size;
 	}
-        vprintf(fmt, args);
-	DISABLE_COLOR();
 
-	va_end(args);
+	s->alloc_nr++;
+	if (++s->in_use > s->high_water)
+		s->high_water = s->in_use;
+	return p;
 }
 
-const char * get_func_info(waiting_func fp, enum func_info_action a)
+void slab_free(struct slab * s, void * p)
 {
-	int i;
-	static const char * names[] = {
-		"",
-		"U1()", "U2()", "U3()", "U4()", "U5()", "U6()",
-		"E1()", "E2()", "E3()", "E4()", "E5()", "E6()",
-		"E7()", "E7A()", "E8()", "E8A()", "E9()",
-		"dummy_func()"
-	};
-	static const char * desc[] = {
-		"",
-		"U1. [Enter, prepare for successor.]",
-		"U2. [Signal and wait.]",
-		"U3. [Enter queue.]",
-		"U4. [Give up.]",
-		"U5. [Get in.]",
-		"U6. [Get out.]",
-		"E1. [Wait for call.]",
-		"E2. [Change of state?]",
-		"E3. [Open doors.]",
-		"E4. [Let people out, in.]",
-		"E5. [Close doors.]",
-		"E6. [Prepare to move.]",
-		"E7. [Go up a floor.]",
-		"E7A. [Go up a floor.]",
-		"E8. [Go down a floor.]",
-		"E8A. [Go down a floor.]",
-		"E9. [Set inaction indicator.]",
-		"dummy_func. [DUMMY.]"
-	};
-	static const waiting_func fps[] = {0,
-				     U1, U2, U3, U4, U5, U6,
-				     E1, E2, E3, E4, E5, E6, E7, E7A, E8, E8A, E9,
-				     dummy_func};
-
-	assert((sizeof(names)/sizeof(names[0])) == (sizeof(fps)/sizeof(fps[0])));
-	assert((sizeof(desc)/sizeof(desc[0]))	== (sizeof(fps)/sizeof(fps[0])));
-
-	for (i = 0; i < sizeof(fps)/sizeof(fps[0]); i++) {
-		if (fp == fps[i]) {
-			if (a == GET_FUNC_NAME)
-				return names[i];
-			else if (a == GET_FUNC_DESC)
-				return desc[i];
-			else
-				assert(0);
-		}
-	}
+	assert(s->in_use > 0);
+	*(void **)p = s->free_list;
+	s->free_list = p;
+	s->in_use--;
+}
 
-	/* should not reach here */
-	/* for (i = 0; i < sizeof(fps)/sizeof(fps[0]); i++) */
-	/* 	xlog(LOG_PLAIN, "%s: 0x%X. ", names[i], (int)fps[i]); */
-	/* xlog(LOG_PLAIN, "\nunknown func: 0x%X.\n", (int)fp); */
-	assert(0);
-	return 0;
+void slab_report(const struct slab * s)
+{
+	fprintf(stderr,
+		"%-10s %9ld in use, at most %9ld, %ld chunks of %d, "
+		"%ld allocs (%ld reused)\n",
+		s->name, s->in_use, s->high_water, s->chunk_nr, SLAB_CHUNK,
+		s->alloc_nr, s->reuse_nr);
 }
 
-/* void xlog_node(struct node288 *x, char struct_type) */
-/* { */
-/* 	const char * pending[] = {"", */
-/* 				  "\t\t\t\t\t\t", */
-/* 				  "\t\t\t\t\t\t\t\t\t\t\t\t" */
-/* 	}; */
-/* 	const char * p; */
-/* 	switch (struct_type) { */
-/* 	case 'W':	/\* WAIT *\/ */
-/* 		p = pending[0]; */
-/* 		break; */
-/* 	case 'Q':	/\* QUEUE[0..4] *\/ */
-/* 		p = pending[1]; */
-/* 		break; */
-/* 	case 'E':	/\* ELEVATOR *\/ */
-/* 		p = pending[2]; */
-/* 		break; */
-/* 	default: */
-/* 		assert(0); */
-/* 		break; */
-/* 	} */
+#define DECLARE_ALLOC_NODE(x)						\
+	x##_NODE * alloc_##x##_node()					\
+	{								\
+		return (x##_NODE *)slab_alloc(&sim->x##_slab);		\
+	}								\
+	void free_##x##_node(x##_NODE * p)				\
+	{								\
+		slab_free(&sim->x##_slab, p);				\
+	}
 
-/* 	if (!x) { */
-/* 		xlog(LOG_PLAIN, "%s=============================================\n", p); */
-/* 		return; */
-/* 	} */
+/* node allocation routines */
+DECLARE_ALLOC_NODE(WAIT)
+DECLARE_ALLOC_NODE(USER)
 
-/* 	xlog(LOG_PLAIN, "%s---------------------------------------------\n", p); */
-/* 	xlog(LOG_PLAIN, "%s %8X", p, (int)x); */
-/* 	xlog(LOG_PLAIN, "%12d    %8X    %8X\n", x->IN, (int)x->LLINK1, (int)x->RLINK1); */
-/* 	xlog(LOG_TIME, "%s%45d\n", p, x->ent_time); */
-/* 	xlog(LOG_FUNC_NAME, "%s%21s%24s\n", p, "", get_func_info(x->inst, GET_FUNC_NAME)); */
-/* 	xlog(LOG_PLAIN, "%s%21d    %8X    %8X\n", p, x->OUT, (int)x->LLINK2, (int)x->RLINK2); */
-/* 	xlog(LOG_PLAIN, "%s%21d            \"%10s\"\n", p, x->giveup_time, x->name); */
-/* } */
+/*
+ * bitsets of floors
+ */
+int bs_test(const uint64_t * s, int j)
+{
+	return (s[j / BS_BITS] >> (j % BS_BITS)) & 1;
+}
 
-void in_QUEUE(struct user_info *p)
+void bs_set(uint64_t * s, int j)
 {
-	int in = p->IN;
-	USER_NODE * q = alloc_USER_node();
+	s[j / BS_BITS] |= (uint64_t)1 << (j % BS_BITS);
+}
 
-	assert((in >= MIN_FLOOR) && (in <= MAX_FLOOR));
+void bs_clear(uint64_t * s, int j)
+{
+	s[j / BS_BITS] &= ~((uint64_t)1 << (j % BS_BITS));
+}
 
-	q->uinfo = p;
+/* the smallest j >= from such that j is in a, b or c; -1 if no such j */
+int bs_next(const uint64_t * a, const uint64_t * b, const uint64_t * c, int from)
+{
+	int i;
+	uint64_t mask;
+
+	if (from < 0)
+		from = 0;
+	if (from >= sim->B.floor_nr)
+		return -1;
+	i = from / BS_BITS;
+	mask = ~(uint64_t)0 << (from % BS_BITS);
+	for (; i < sim->B.word_nr; i++, mask = ~(uint64_t)0) {
+		uint64_t x = (a[i] | b[i] | c[i]) & mask;
+		if (x)
+			return i * BS_BITS + __builtin_ctzll(x);
+	}
+	return -1;
+}
+
+/* the largest j <= to such that j is in a, b or c; -1 if no such j */
+int bs_prev(const uint64_t * a, const uint64_t * b, const uint64_t * c, int to)
+{
+	int i;
+	uint64_t mask;
+
+	if (to < 0)
+		return -1;
+	if (to >= sim->B.floor_nr)
+		to = sim->B.floor_nr - 1;
+	i = to / BS_BITS;
+	mask = ~(uint64_t)0 >> (BS_BITS - 1 - to % BS_BITS);
+	for (; i >= 0; i--, mask = ~(uint64_t)0) {
+		uint64_t x = (a[i] | b[i] | c[i]) & mask;
+		if (x)
+			return i * BS_BITS + BS_BITS - 1 - __builtin_clzll(x);
+	}
+	return -1;
+}
 
-	q->QL = QUEUE[in].QL;
-	q->QR = &QUEUE[in];
-	QUEUE[in].QL->QR = q;
-	QUEUE[in].QL = q;
+/* is there any call (CALLUP, CALLDOWN or CALLCAR of c) above / below FLOOR? */
+int calls_above(struct car * c)
+{
+	return bs_next(c->CALLUP, c->CALLDOWN, c->CALLCAR, c->FLOOR + 1) >= 0;
+}
 
-	xlog(LOG_U, "      %s (%d->%d) is inserted into QUEUE[%d].\n",
-	     p->name, p->IN, p->OUT, p->IN);
+int calls_below(struct car * c)
+{
+	return bs_prev(c->CALLUP, c->CALLDOWN, c->CALLCAR, c->FLOOR - 1) >= 0;
+}
+
+uint64_t * alloc_bitset(void)
+{
+	uint64_t * s = (uint64_t *)calloc(sim->B.word_nr, sizeof(uint64_t));
+	assert(s);
+	return s;
 }
 
-USER_NODE * out_QUEUE(int in, struct user_info * p)
+void building_init(int floor_nr, int home, int car_nr)
 {
-	USER_NODE * q = 0;
-	if (p == 0) {
-		q = QUEUE[in].QR;
-		QUEUE[in].QR = QUEUE[in].QR->QR;
-		QUEUE[in].QR->QL = &QUEUE[in];
+	int i, j;
+
+	assert(floor_nr >= 2 && home >= 0 && home < floor_nr && car_nr >= 1);
+	sim->B.floor_nr = floor_nr;
+	sim->B.home     = home;
+	sim->B.car_nr   = car_nr;
+	sim->B.word_nr  = (floor_nr + BS_BITS - 1) / BS_BITS;
+
+	sim->B.QUEUE = (USER_NODE *)malloc(sizeof(USER_NODE) * floor_nr);
+	assert(sim->B.QUEUE);
+	sim->B.queued = 0;
+	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++) {
+		sim->B.QUEUE[i].QL = &sim->B.QUEUE[i];
+		sim->B.QUEUE[i].QR = &sim->B.QUEUE[i];
 	}
-	else {
-		assert(in == p->IN);
-		for (q = QUEUE[in].QR; q != &QUEUE[in]; q = q->QR) {
-			if (q->uinfo == p) {
-				q->QL->QR = q->QR;
-				q->QR->QL = q->QL;
-			}
+	sim->B.CALLUP   = alloc_bitset();
+	sim->B.CALLDOWN = alloc_bitset();
+	sim->B.zero     = alloc_bitset();
+
+	sim->B.cars = (struct car *)calloc(car_nr, sizeof(struct car));
+	assert(sim->B.cars);
+	for (i = 0; i < car_nr; i++) {
+		struct car * c = &sim->B.cars[i];
+		c->id = i;
+		c->STATE = NEUTRAL;
+		c->FLOOR = home;
+		c->CALLUP   = sim->DP->shared ? sim->B.CALLUP : alloc_bitset();
+		c->CALLDOWN = sim->DP->shared ? sim->B.CALLDOWN : alloc_bitset();
+		c->CALLCAR  = alloc_bitset();
+		c->ELEVATOR = (USER_NODE *)malloc(sizeof(USER_NODE) * floor_nr);
+		assert(c->ELEVATOR);
+		for (j = MIN_FLOOR; j <= MAX_FLOOR; j++) {
+			c->ELEVATOR[j].EL = &c->ELEVATOR[j];
+			c->ELEVATOR[j].ER = &c->ELEVATOR[j];
 		}
+		c->dormant = 1;
 	}
+}
 
-	xlog(LOG_U, "      %s (%d->%d) is removed from QUEUE[%d].\n",
-	     p->name, p->IN, p->OUT, p->IN);
-
-	return q;
+/****************************************************************************************************
+ * Metrics. The coroutines count what happens as it happens, so that no log
+ * has to be read afterwards:
+ *
+ *     wait, ride       HDR histograms (see hdr_index()) of the time from U1
+ *                      to U5, and from U5 to U6
+ *     per floor        arrivals (U2), give-ups (U4), boardings and alightings
+ *                      (U5 and U6, by E4), and the length of QUEUE[] averaged
+ *                      over TIME (see metrics_queue())
+ *     per car          floors moved (E7, E8)
+ *
+ * The memory is fixed: a histogram is HDR_BUCKETS counts however many users
+ * there are. ``-M file'' writes them at the end, ``-M period:file'' every
+ * ``period'' units of TIME as well (see sim_loop()).
+ ****************************************************************************************************/
+/** the bucket of v: the values below 2^HDR_SUB_BITS have a bucket each, and
+ *  every power of 2 above is split into 2^HDR_SUB_BITS buckets, so a bucket
+ *  is as wide as 1/128 of its values at most
+ */
+int hdr_index(long v)
+{
+	int e;
+
+	if (v < (1L << HDR_SUB_BITS))
+		return v < 0 ? 0 : v;
+	if (v >= (2L << HDR_TOP))
+		v = (2L << HDR_TOP) - 1;
+	e = 63 - __builtin_clzl(v);	/* 2^e <= v < 2^(e+1) */
+	return ((e - HDR_SUB_BITS + 1) << HDR_SUB_BITS) +
+		(int)(v >> (e - HDR_SUB_BITS)) - (1 << HDR_SUB_BITS);
 }
 
-void in_WAIT(int ent_time, waiting_func inst, struct user_info * arg)
+/* the smallest value of bucket i */
+long hdr_value(int i)
 {
-	WAIT_NODE * w = alloc_WAIT_node();
-	w->ent_time = ent_time;
-	w->inst = inst;
-	w->arg  = arg;
+	int e;
 
-	xlog(LOG_PLAIN, "%s will be scheduled at TIME %d\n",
-	     get_func_info(inst, GET_FUNC_NAME), ent_time);
+	if (i < (1 << HDR_SUB_BITS))
+		return i;
+	e = (i >> HDR_SUB_BITS) + HDR_SUB_BITS - 1;
+	return ((long)(i & ((1 << HDR_SUB_BITS) - 1)) + (1L << HDR_SUB_BITS))
+		<< (e - HDR_SUB_BITS);
+}
 
-	WAIT_NODE * p = WAIT.WL;
-	while (ent_time < p->ent_time)
-		p = p->WL;
+/* adds the values of o to h */
+void hdr_merge(struct hdr * h, const struct hdr * o)
+{
+	int i;
 
-	/* insert to the right of p */
-	w->WL = p;
-	w->WR = p->WR;
-	p->WR->WL = w;
-	p->WR = w;
+	if (o->n == 0)
+		return;
+	for (i = 0; i < HDR_BUCKETS; i++)
+		h->counts[i] += o->counts[i];
+	if (h->n == 0 || o->min < h->min)
+		h->min = o->min;
+	if (h->n == 0 || o->max > h->max)
+		h->max = o->max;
+	h->n   += o->n;
+	h->sum += o->sum;
 }
 
-void out_WAIT(waiting_func inst, struct user_info * arg)
+void hdr_record(struct hdr * h, long v)
 {
-	WAIT_NODE * p = WAIT.WR;
-	assert(p != &WAIT);	/* WAIT list should not be empty */
-	int cnt = 0;
-	for (; p != &WAIT; p = p->WR) {
-		if (p->ent_time < TIME)
-			continue;
+	h->counts[hdr_index(v)]++;
+	if (h->n == 0 || v < h->min)
+		h->min = v;
+	if (h->n == 0 || v > h->max)
+		h->max = v;
+	h->n++;
+	h->sum += v;
+}
 
-		if ((p->inst == inst) && (p->arg == arg)) {
-			assert(cnt == 0);
-			cnt++;
-			p->WL->WR = p->WR;
-			p->WR->WL = p->WL;
-			/* xlog(LOG_PLAIN, "%s (#%d) cancelled (TIME %d)\n", */
-			/*      get_func_info(inst, GET_FUNC_NAME), cnt, p->ent_time); */
-			xlog(LOG_PLAIN, "%s is cancelled (TIME %d)\n",
-			     get_func_info(inst, GET_FUNC_NAME), p->ent_time);
-		}
-	}
-	if (cnt == 0) {
-		xlog(LOG_PLAIN, "%s is not in the WAIT list.\n",
-		     get_func_info(inst, GET_FUNC_NAME));
+/* the q-quantile (0 <= q <= 1), within 1/128 */
+long hdr_percentile(const struct hdr * h, double q)
+{
+	long rank = (long)(q * (h->n - 1) + 0.5);
+	long cum = 0;
+	int i;
+
+	if (h->n == 0)
+		return 0;
+	for (i = 0; i < HDR_BUCKETS; i++) {
+		cum += h->counts[i];
+		if (cum > rank)
+			break;
 	}
+	if (hdr_value(i) < h->min)
+		return h->min;
+	return hdr_value(i) > h->max ? h->max : hdr_value(i);
 }
 
-void in_ELEVATOR(struct user_info * p)
+double hdr_mean(const struct hdr * h)
 {
-	USER_NODE * e = alloc_USER_node();
-
-	e->uinfo = p;
+	return h->n ? h->sum / h->n : 0;
+}
 
-	e->EL = ELEVATOR.EL;
-	e->ER = &ELEVATOR;
-	ELEVATOR.EL->ER = e;
-	ELEVATOR.EL = e;
+/* the metrics of ``sim'', which has B, start from TIME start */
+void metrics_init(long start)
+{
+	int n = sim->B.floor_nr;
+	int i;
+	long * p = (long *)calloc(n * 7 + sim->B.car_nr, sizeof(long));
+
+	assert(p);
+	memset(&sim->M.wait, 0, sizeof(sim->M.wait));
+	memset(&sim->M.ride, 0, sizeof(sim->M.ride));
+	sim->M.arrived     = p;
+	sim->M.gave_up     = p + n;
+	sim->M.boarded     = p + n * 2;
+	sim->M.alighted    = p + n * 3;
+	sim->M.queue_len   = p + n * 4;
+	sim->M.queue_max   = p + n * 5;
+	sim->M.queue_since = p + n * 6;
+	sim->M.moves       = p + n * 7;
+	sim->M.queue_area  = (double *)calloc(n, sizeof(double));
+	assert(sim->M.queue_area);
+	for (i = 0; i < n; i++)
+		sim->M.queue_since[i] = start;
+	sim->M.start = start;
+	sim->M.next_dump = start + sim->M.period;
 }
 
-void out_ELEVATOR(struct user_info * p)
+void metrics_free(void)
 {
-	USER_NODE * e = ELEVATOR.ER;
-	assert(e != &ELEVATOR);	/* ELEVATOR list should not be empty */
-	for (; e != &ELEVATOR; e = e->ER) {
-		if (e->uinfo == p) {
-			e->EL->ER = e->ER;
-			e->ER->EL = e->EL;
-			return;
-		}
-	}
+	free(sim->M.arrived);
+	free(sim->M.queue_area);
 }
 
-/* /\* log double-linked list *\/ */
-/* void xlog_DLL(struct node288 *p, char struct_type) */
-/* { */
-/* 	struct node288 * x = p; */
-/* 	do { */
-/* 		xlog_node(x, struct_type); */
+/* the length of QUEUE[f] changes by d, see in_QUEUE() and out_QUEUE() */
+void metrics_queue(int f, int d)
+{
+	long t = current_step ? TIME : 0;
 
-/* 		switch (struct_type) { */
-/* 		case 'W':	/\* WAIT *\/ */
-/* 			x = x->WR; */
-/* 			break; */
-/* 		case 'Q':	/\* QUEUE[0..4] *\/ */
-/* 			x = x->QR; */
-/* 			break; */
-/* 		case 'E':	/\* ELEVATOR *\/ */
-/* 			x = x->ER; */
-/* 			break; */
-/* 		default: */
-/* 			assert(0); */
-/* 			break; */
-/* 		} */
-/* 	} while (x != p); */
-/* 	xlog_node(0, struct_type); */
-/* } */
+	sim->M.queue_area[f] += (double)sim->M.queue_len[f] * (t - sim->M.queue_since[f]);
+	sim->M.queue_since[f] = t;
+	sim->M.queue_len[f] += d;
+	if (sim->M.queue_len[f] > sim->M.queue_max[f])
+		sim->M.queue_max[f] = sim->M.queue_len[f];
+}
 
-const char * get_STATE_str(void)
+void metrics_hdr(FILE * fp, const char * name, const struct hdr * h)
 {
-	/* this array must correspond with ``enum elevator_state'': */
-	static const char * state_str[] = {"NEUTRAL", "GOINGUP", "GOINGDOWN"};
-	assert(STATE < sizeof(state_str)/sizeof(state_str[0]));
-	return state_str[STATE];
+	fprintf(fp, "%-8s %10ld %10.1f %10ld %10ld %10ld %10ld %10ld %10ld\n",
+		name, h->n, hdr_mean(h), h->n ? h->min : 0,
+		hdr_percentile(h, 0.50), hdr_percentile(h, 0.90),
+		hdr_percentile(h, 0.95), hdr_percentile(h, 0.99),
+		h->n ? h->max : 0);
 }
 
-void xlog_state(const char * s, int level)
+/* writes the metrics from M.start to TIME t to M.out */
+void metrics_dump(long t)
 {
-	if (level > 1)
-		xlog(LOG_PLAIN, "\n%s\n", s);
+	FILE * fp = sim->M.out;
+	int i;
 
-	if (level > 0) {
-		xlog(LOG_TIME, "[TIME:%d]", TIME);
-		xlog(LOG_STATE, "[STATE:%s]", get_STATE_str());
-		xlog(LOG_FLOOR, "[FLOOR:%d]", FLOOR);
-		xlog(LOG_FLAG1, "[");
-		if (D1)
-			xlog(LOG_FLAG1, "[D1(peopleIO):%d ", D1);
-		else
-			xlog(LOG_FLAG0, "[D1(peopleIO):%d ", D1);
-		if (D2)
-			xlog(LOG_FLAG1, "D2(stopped30s):%d ", D2);
-		else
-			xlog(LOG_FLAG0, "D2(stopped30s):%d ", D2);
-		if (D3)
-			xlog(LOG_FLAG1, "D3(nobody):%d", D3);
+	fprintf(fp, "# TIME %ld (from %ld)\n", t, sim->M.start);
+	fprintf(fp, "%-8s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+		"", "n", "mean", "min", "p50", "p90", "p95", "p99", "max");
+	metrics_hdr(fp, "wait", &sim->M.wait);
+	metrics_hdr(fp, "ride", &sim->M.ride);
+	fprintf(fp, "%-8s %10s %10s %10s %10s %10s %10s\n",
+		"floor", "arrived", "gave up", "boarded", "alighted",
+		"queue", "queue max");
+	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++) {
+		double area = sim->M.queue_area[i] +
+			(double)sim->M.queue_len[i] * (t - sim->M.queue_since[i]);
+		fprintf(fp, "%-8d %10ld %10ld %10ld %10ld %10.3f %10ld\n",
+			i, sim->M.arrived[i], sim->M.gave_up[i], sim->M.boarded[i],
+			sim->M.alighted[i], t > sim->M.start ? area / (t - sim->M.start) : 0,
+			sim->M.queue_max[i]);
+	}
+	fprintf(fp, "%-8s %10s\n", "car", "moves");
+	for (i = 0; i < sim->B.car_nr; i++)
+		fprintf(fp, "%-8d %10ld\n", i, sim->M.moves[i]);
+	fprintf(fp, "\n");
+}
+
+/****************************************************************************************************
+ * Workload. U1 asks next_user() for the user who enters the system next,
+ * who is the next one in users[], the next row of a replay file (if ``-i''
+ * is given, see replay_open()), or a random one (if ``-n'' is given):
+ *
+ *     INTERTIME   exponential with mean W.intertime, i.e. Poisson arrivals
+ *     IN, OUT     weighted by the origin/destination matrix od[IN][OUT],
+ *                 see workload_init()
+ *     GIVEUPTIME  fixed, uniform or exponential, see parse_giveup()
+ *
+ * A generated user is freed as soon as he/she leaves the system (see
+ * leave_system()), and so are all the nodes (see slab_alloc()), so the memory
+ * is bounded by the number of users in the system, no matter how many users
+ * are simulated.
+ ****************************************************************************************************/
+/* splitmix64, returns a double in [0, 1) */
+double rand_uniform(void)
+{
+	uint64_t z = (sim->W.rng += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double rand_exp(double mean)
+{
+	return -mean * log(1.0 - rand_uniform());
+}
+
+/* the smallest i such that u < cdf[i] */
+int rand_pick(const double * cdf, int n)
+{
+	double u = rand_uniform() * cdf[n - 1];
+	int lo = 0;
+	int hi = n - 1;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (u < cdf[mid])
+			hi = mid;
 		else
-			xlog(LOG_FLAG0, "D3(nobody):%d", D3);
-		xlog(LOG_FLAG1, "]");
-		/* xlog(LOG_PLAIN, "\n"); */
+			lo = mid + 1;
 	}
+	return lo;
+}
 
-	/* if (level > 1) { */
-	/* 	xlog(LOG_PLAIN, "\nWAIT:\n"); */
-	/* 	xlog_DLL(&WAIT, 'W'); */
-	/* 	xlog(LOG_PLAIN, "\nQUEUE[0..4]:\n"); */
-	/* 	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++) */
-	/* 		xlog_DLL(&QUEUE[i], 'Q'); */
-	/* 	xlog(LOG_PLAIN, "\nELEVATOR:\n"); */
-	/* 	xlog_DLL(&ELEVATOR, 'E'); */
-	/* } */
+/* ``fixed:1000'', ``uniform:500:1500'' or ``exp:1000'' */
+int parse_giveup(const char * s)
+{
+	if (sscanf(s, "fixed:%lf", &sim->W.giveup_a) == 1)
+		sim->W.giveup = GIVEUP_FIXED;
+	else if (sscanf(s, "uniform:%lf:%lf", &sim->W.giveup_a, &sim->W.giveup_b) == 2)
+		sim->W.giveup = GIVEUP_UNIFORM;
+	else if (sscanf(s, "exp:%lf", &sim->W.giveup_a) == 1)
+		sim->W.giveup = GIVEUP_EXP;
+	else
+		return 0;
+	return 1;
 }
 
+/** od_file: floor_nr lines of floor_nr weights, od[IN][OUT]. if od_file is 0,
+ *  half of the users enter at the home floor, and half of the others go to
+ *  the home floor; all the other (IN, OUT) pairs are equally likely.
+ */
+void workload_init(const char * od_file)
+{
+	int i;
+	int j;
+	int n = sim->B.floor_nr;
+	FILE * fp = 0;
+
+	sim->W.origin_cdf = (double *)malloc(sizeof(double) * n);
+	sim->W.dest_cdf   = (double *)malloc(sizeof(double) * n * n);
+	assert(sim->W.origin_cdf && sim->W.dest_cdf);
+
+	if (od_file) {
+		fp = fopen(od_file, "r");
+		if (!fp) {
+			fprintf(stderr, "%s: %s\n", od_file, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		double row = 0;
+		for (j = 0; j < n; j++) {
+			double od;
+			if (fp) {
+				if (fscanf(fp, "%lf", &od) != 1 || od < 0) {
+					fprintf(stderr, "%s: bad od[%d][%d]\n",
+						od_file, i, j);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (i == HOME)
+				od = 1;
+			else
+				od = (j == HOME) ? n - 2 : 1;
+			if (i == j)
+				od = 0;	/* OUT != IN */
+			row += od;
+			sim->W.dest_cdf[i * n + j] = row;
+		}
+		if (!fp && i == HOME)
+			row *= n - 1;
+		sim->W.origin_cdf[i] = (i ? sim->W.origin_cdf[i - 1] : 0) + row;
+	}
+	if (fp)
+		fclose(fp);
+	if (sim->W.origin_cdf[n - 1] <= 0) {
+		fprintf(stderr, "the origin/destination matrix is empty\n");
+		exit(EXIT_FAILURE);
+	}
+}
 
 /****************************************************************************************************
- * Subroutine D (DECISION subroutine) This subroutine is performed at certain
- * critical times, as specified in the coroutines above, when a decision about the
- * elevator's next direction is to be made.
+ * Replay (``-i file''). The users are read from a file of rows
+ *
+ *     ENTERTIME,IN,OUT,GIVEUPTIME
+ *
+ * one user a row, in the order of ENTERTIME. Blank lines and lines beginning
+ * with ``#'' are skipped, and so is the first line if it is not a row (i.e.
+ * a CSV header). ``-e csv_file bin_file'' converts such a file to the binary
+ * form (see struct replay_head), which -i recognizes by REPLAY_MAGIC and
+ * reads without parsing.
+ *
+ * The file is mapped instead of read, and a row becomes a user only when U1
+ * needs it (see next_user()), so a replay takes no memory for the users who
+ * have not entered yet, no matter how long the file is.
  ****************************************************************************************************/
-void D()
+void replay_open(const char * filename)
 {
-	/*
-	 * D1. [Decision necessary?] If STATE != NEUTRAL, exit from this subroutine.
-	 */
-	xlog(LOG_PLAIN, "--------D1\n");
-	if (STATE != NEUTRAL) {
-		xlog(LOG_PLAIN, "--------STATE != NEUTRAL. Do nothing.\n");
-		return;
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	sim->W.replay_file = filename;
+	sim->W.replay_size = st.st_size;
+	sim->W.replay_pos  = 0;
+	sim->W.replay_line = 0;
+	sim->W.replay_bin  = 0;
+	sim->W.replay      = "";
+	if (sim->W.replay_size) {
+		void * m = mmap(0, sim->W.replay_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		madvise(m, sim->W.replay_size, MADV_SEQUENTIAL);
+		sim->W.replay = (const char *)m;
+	}
+	close(fd);
+
+	const struct replay_head * h = (const struct replay_head *)sim->W.replay;
+	if (sim->W.replay_size >= sizeof(*h) && h->magic == REPLAY_MAGIC) {
+		if (h->rec_size != sizeof(struct replay_rec)) {
+			fprintf(stderr, "%s: not a replay file of this program\n",
+				filename);
+			exit(EXIT_FAILURE);
+		}
+		sim->W.replay_bin = 1;
+		sim->W.replay_pos = sizeof(*h);
 	}
+}
 
-	/*
-	 * D2. [Should doors open?] If the elevator is positioned at E1 and if CALLUP[2],
-	 *     CALLCAR[2], and CALLDOWN[2] are not all zero, cause the elevator to start
-	 *     its activity E3 after 20 units of time, and exit from this subroutine. (if
-	 *     the DECISION subroutine is currently being invoked by the independent
-	 *     activity E9, it is possible for the elevator coroutine to be positioned at E1.)
-	 */
-	/** this happens when:
-	 *      1. elevator is dormant
-	 *      2. new user arrives at floor 2
-	 */
-	xlog(LOG_PLAIN, "--------D2\n");
-	if ((current_elevator_step == 0xE1) && (CALLUP[2] || CALLCAR[2] || CALLDOWN[2])) {
-		in_WAIT(TIME + 20, E3, NO_ARG);
-		return;
+void replay_close(void)
+{
+	if (sim->W.replay_size)
+		munmap((void *)sim->W.replay, sim->W.replay_size);
+	sim->W.replay_file = 0;
+	sim->W.replay = 0;
+	sim->W.replay_size = 0;
+}
+
+/** parses an unsigned number and the separator after it (``,'', or the end
+ *  of the line if last), returns the position after them, 0 if there is
+ *  none. the file is not NUL-terminated, so s never goes beyond e.
+ */
+const char * replay_field(const char * s, const char * e, long * v, int last)
+{
+	long x = 0;
+	int digits = 0;
+
+	while (s < e && (*s == ' ' || *s == '\t'))
+		s++;
+	for (; s < e && *s >= '0' && *s <= '9'; s++, digits++)
+		x = x * 10 + (*s - '0');
+	if (digits == 0 || digits > 18)
+		return 0;
+	while (s < e && (*s == ' ' || *s == '\t' || *s == '\r'))
+		s++;
+	if (!last) {
+		if (s == e || *s != ',')
+			return 0;
+		s++;
 	}
+	else if (s < e) {
+		if (*s != '\n')
+			return 0;
+		s++;
+	}
+	*v = x;
+	return s;
+}
 
-	/*
-	 * D3. [Any calls?] Find the smallest j != FLOOR for which CALLUP[j], CALLCAR[j],
-	 *     or CALLDOWN[j] is nonzero, and go on to step D4. But if no such j exists,
-	 *     then set j <- 2 if the DECISION subroutine is currently being invoked by
-	 *     step E6; otherwise exit from this subroutine.
-	 */
-	xlog(LOG_PLAIN, "--------D3\n");
-	int j;
-	int flag = 0;
-	for (j = MIN_FLOOR; j <= MAX_FLOOR; j++) {
-		if (CALLUP[j] || CALLCAR[j] || CALLDOWN[j]) {
-			flag = 1;
-			break;
+/* reads the next row into r, returns 0 if there is no more */
+int replay_row(struct replay_rec * r)
+{
+	long v[4];
+
+	if (sim->W.replay_bin) {
+		if (sim->W.replay_pos + sizeof(*r) > sim->W.replay_size) {
+			if (sim->W.replay_pos != sim->W.replay_size) {
+				fprintf(stderr, "%s: truncated\n", sim->W.replay_file);
+				exit(EXIT_FAILURE);
+			}
+			return 0;
+		}
+		memcpy(r, sim->W.replay + sim->W.replay_pos, sizeof(*r));
+		sim->W.replay_pos += sizeof(*r);
+		sim->W.replay_line++;
+		v[0] = r->time;
+		v[3] = r->patience;
+	}
+	else {
+		const char * s = sim->W.replay + sim->W.replay_pos;
+		const char * e = sim->W.replay + sim->W.replay_size;
+		const char * t;
+		int i;
+
+		for (;;) {	/* skips blank lines, comments and the header */
+			if (s == e)
+				return 0;
+			sim->W.replay_line++;
+			for (t = s; t < e && (*t == ' ' || *t == '\t' || *t == '\r'); t++)
+				;
+			if (t < e && *t != '\n' && *t != '#' &&
+			    (sim->W.replay_line > 1 || (*t >= '0' && *t <= '9')))
+				break;
+			while (s < e && *s++ != '\n')
+				;
+		}
+		for (i = 0; i < 4 && s; i++)
+			s = replay_field(s, e, &v[i], i == 3);
+		if (!s || v[1] > UINT16_MAX || v[2] > UINT16_MAX ||
+		    v[3] > INT32_MAX) {
+			fprintf(stderr, "%s:%ld: bad row, expected "
+				"ENTERTIME,IN,OUT,GIVEUPTIME\n",
+				sim->W.replay_file, sim->W.replay_line);
+			exit(EXIT_FAILURE);
+		}
+		sim->W.replay_pos = s - sim->W.replay;
+		r->time     = v[0];
+		r->in       = v[1];
+		r->out      = v[2];
+		r->patience = v[3];
+	}
+	/** W.next_time is the ENTERTIME of the last row here */
+	if (v[0] < sim->W.next_time || v[3] < 0) {
+		fprintf(stderr, "%s:%ld: %s\n", sim->W.replay_file, sim->W.replay_line,
+			v[3] < 0 ? "negative GIVEUPTIME" :
+			"ENTERTIME is less than the one of the last row");
+		exit(EXIT_FAILURE);
+	}
+	sim->W.next_time = v[0];
+	return 1;
+}
+
+/* ``-e'': converts a CSV replay file to the binary form */
+void replay_encode(const char * csv_file, const char * bin_file)
+{
+	struct replay_head h = {REPLAY_MAGIC, sizeof(struct replay_rec)};
+	struct replay_rec r;
+	long n = 0;
+	FILE * fp = fopen(bin_file, "wb");
+
+	if (!fp) {
+		fprintf(stderr, "%s: %s\n", bin_file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	replay_open(csv_file);
+	if (sim->W.replay_bin) {
+		fprintf(stderr, "%s: already binary\n", csv_file);
+		exit(EXIT_FAILURE);
+	}
+	fwrite(&h, sizeof(h), 1, fp);
+	for (; replay_row(&r); n++)
+		fwrite(&r, sizeof(r), 1, fp);
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "%s: %s\n", bin_file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "%s: %ld rows\n", bin_file, n);
+	replay_close();
+}
+
+/* returns the user who enters the system next, 0 if there is no more */
+struct user_info * next_user(void)
+{
+	struct user_info * p;
+	int n = sim->B.floor_nr;
+
+	if (sim->W.replay_file) {
+		struct replay_rec r;
+		if (!replay_row(&r))
+			return 0;
+		if (r.in >= n || r.out >= n) {
+			fprintf(stderr, "%s:%ld: no floor %d in this building\n",
+				sim->W.replay_file, sim->W.replay_line,
+				r.in >= n ? r.in : r.out);
+			exit(EXIT_FAILURE);
 		}
+		p = (struct user_info *)slab_alloc(&sim->user_info_slab);
+		sim->W.generated++;
+
+		p->IN  = r.in;
+		p->OUT = r.out;
+		p->ENTERTIME  = r.time;
+		p->GIVEUPTIME = r.patience;
+		p->id = sim->W.generated;
+		snprintf(p->name, sizeof(p->name), "User %ld", p->id);
+		p->giveup = 0;
+		p->car = NO_CAR;
+		p->node = 0;
+		p->generated = 1;
+	}
+	else if (sim->W.user_nr == 0) {
+		/* the last one in users[] is DUMMY */
+		if (sim->W.table_pos >= sizeof(users) / sizeof(users[0]) - 1)
+			return 0;
+		p = &users[sim->W.table_pos++];
+		p->id = sim->W.table_pos;
 	}
-	if (!flag) {		/* no such j exists */
-		if (current_elevator_step == 0xE6)
-			j = 2;
+	else {
+		if (sim->W.generated >= sim->W.user_nr)
+			return 0;
+		p = (struct user_info *)slab_alloc(&sim->user_info_slab);
+		sim->W.generated++;
+
+		p->IN  = rand_pick(sim->W.origin_cdf, n);
+		p->OUT = rand_pick(&sim->W.dest_cdf[p->IN * n], n);
+		p->ENTERTIME = sim->W.next_time;
+		sim->W.next_time += (long)(rand_exp(sim->W.intertime) + 0.5);
+		if (sim->W.giveup == GIVEUP_FIXED)
+			p->GIVEUPTIME = (int)sim->W.giveup_a;
+		else if (sim->W.giveup == GIVEUP_UNIFORM)
+			p->GIVEUPTIME = (int)(sim->W.giveup_a + rand_uniform() *
+					      (sim->W.giveup_b - sim->W.giveup_a));
 		else
-			return;
+			p->GIVEUPTIME = (int)(rand_exp(sim->W.giveup_a) + 0.5);
+		p->id = sim->W.generated;
+		snprintf(p->name, sizeof(p->name), "User %ld", p->id);
+		p->giveup = 0;
+		p->car = NO_CAR;
+		p->node = 0;
+		p->generated = 1;
 	}
 
-	/*
-	 * D4. [Set STATE.] If FLOOR > j, set STATE <-- GOINGDOWN; if FLOOR < j, set
-	 *     STATE <-- GOINGUP.
-	 */
-	xlog(LOG_PLAIN, "--------D4. FLOOR:%d, j:%d\n", FLOOR, j);
-	if (FLOOR > j)
-		STATE = GOINGDOWN;
-	else if (FLOOR < j)
-		STATE = GOINGUP;
-	else
-		;		/* do nothing */
+	if (++sim->W.in_system > sim->W.max_in_system)
+		sim->W.max_in_system = sim->W.in_system;
+	return p;
+}
+
+/* the user leaves the simulated system */
+void leave_system(struct user_info * p)
+{
+	assert(p->giveup == 0 && p->node == 0);
+	sim->W.in_system--;
+	if (p->generated)
+		slab_free(&sim->user_info_slab, p);
+}
+
+/* logging routine */
+void xlog(enum log_type lt, const char *fmt, ...)
+{
+	va_list args;
+	va_list args2;
+
+	if (quiet)
+		return;
+
+	va_start(args, fmt);
+
+	static FILE * logf = 0;
+	if (!logf) {
+		char logfilename[FILENAME_MAX];
+		char * p;
+		strcpy(logfilename, __FILE__);
+		for (p = logfilename + strlen(logfilename); *p != '.'; p--);
+		strcpy(p, ".log");
+		fprintf(stderr, "logfile: %s\n", logfilename);
+
+		logf = fopen(logfilename, "w");
+		assert(logf);
+		fprintf(logf, "%%%% %s - %s\n%%%% %s (%s)\n\n",
+			__DATE__, __TIME__, logfilename, __FILE__);
+	}
+	/* ``args'' cannot be used twice, see vprintf() below */
+	va_copy(args2, args);
+	vfprintf(logf, fmt, args2);
+	va_end(args2);
+
+	if (lt == LOG_CLOSE) {
+		assert(logf);
+		fclose(logf);
+		fprintf(stderr, "log file closed.\n");
+		logf = 0;
+	}
+	else if (lt == LOG_PLAIN) {
+		DISABLE_COLOR();
+	}
+	else if (lt == LOG_U) {
+		ENABLE_COLOR("1;35"); /* cyan (underscored) */
+	}
+	else if (lt == LOG_E) {
+		ENABLE_COLOR("36"); /* cyan */
+	}
+	else if (lt == LOG_FUNC_NAME) {
+		ENABLE_COLOR("31"); /* red */
+	}
+	else if (lt == LOG_TIME) {
+		ENABLE_COLOR("43"); /* /yellow */
+	}
+	else if (lt == LOG_STATE) {
+		ENABLE_COLOR("47"); /* /gray */
+	}
+	else if (lt == LOG_FLOOR) {
+		ENABLE_COLOR("43"); /* /yellow */
+	}
+	else if (lt == LOG_FLAG0) {
+		ENABLE_COLOR("1;37;47"); /* white/gray */
+	}
+	else if (lt == LOG_FLAG1) {
+		ENABLE_COLOR("47"); /* /gray */
+	}
+	else {
+		assert(0);
+	}
+        vprintf(fmt, args);
+	DISABLE_COLOR();
+
+	va_end(args);
+}
+
+/** the coroutines, indexed by enum coroutine_id
+ *  ``step'' is what the coroutine sets current_elevator_step to, 0 for the
+ *  independent activity E9 and for the users. only the coroutines that are
+ *  scheduled by in_WAIT() have a handler, the others are called directly.
+ */
+struct coroutine {
+	const char *	name;
+	const char *	desc;
+	funcU		fu;
+	funcE		fe;
+	int		step;
+};
+
+const struct coroutine coroutines[COROUTINE_NR] = {
+	[CO_NONE]  = {"", "", 0, 0, 0},
+	[CO_U1]    = {"U1()",  "U1. [Enter, prepare for successor.]", U1, 0, 0},
+	[CO_U2]    = {"U2()",  "U2. [Signal and wait.]",              U2, 0, 0},
+	[CO_U3]    = {"U3()",  "U3. [Enter queue.]",                  U3, 0, 0},
+	[CO_U4]    = {"U4()",  "U4. [Give up.]",                      U4, 0, 0},
+	[CO_U5]    = {"U5()",  "U5. [Get in.]",                       0,  0, 0},
+	[CO_U6]    = {"U6()",  "U6. [Get out.]",                      0,  0, 0},
+	[CO_E1]    = {"E1()",  "E1. [Wait for call.]",         0, E1,  0xE1},
+	[CO_E2]    = {"E2()",  "E2. [Change of state?]",       0, E2,  0xE2},
+	[CO_E3]    = {"E3()",  "E3. [Open doors.]",            0, E3,  0xE3},
+	[CO_E4]    = {"E4()",  "E4. [Let people out, in.]",    0, E4,  0xE4},
+	[CO_E5]    = {"E5()",  "E5. [Close doors.]",           0, E5,  0xE5},
+	[CO_E6]    = {"E6()",  "E6. [Prepare to move.]",       0, E6,  0xE6},
+	[CO_E7]    = {"E7()",  "E7. [Go up a floor.]",         0, E7,  0xE7},
+	[CO_E7A]   = {"E7A()", "E7A. [Go up a floor.]",        0, E7A, 0xE7},
+	[CO_E8]    = {"E8()",  "E8. [Go down a floor.]",       0, E8,  0xE8},
+	[CO_E8A]   = {"E8A()", "E8A. [Go down a floor.]",      0, E8A, 0xE8},
+	[CO_E9]    = {"E9()",  "E9. [Set inaction indicator.]", 0, E9, 0},
+	[CO_DUMMY] = {"dummy_func()", "dummy_func. [DUMMY.]",  0, 0,   0},
+};
+
+#ifndef NO_TRACE
+/****************************************************************************************************
+ * Binary trace.
+ *
+ *     With ``-t file'', xlog() is turned off, and a fixed-size trace_rec is
+ *     recorded instead for every node that is executed, scheduled or
+ *     cancelled. The records go into a ring of the recording thread, and a
+ *     flusher thread writes the rings to the file, so the simulation pays
+ *     only a few stores for a record. ``-d file'' renders a trace in the
+ *     format of the log file.
+ *
+ *     Compile with -DNO_TRACE to remove the trace completely.
+ ****************************************************************************************************/
+#define TRACE_MAGIC		0x54564C45	/* "ELVT" */
+#define TRACE_RING_SIZE		65536		/* records, a power of 2 */
+
+enum trace_kind	{TR_EXEC, TR_SCHED, TR_CANCEL};
+
+struct trace_rec {
+	int64_t		time;	/* TIME */
+	int64_t		when;	/* ent_time of the node */
+	uint32_t	user;	/* user id, 0 for elevator actions */
+	int32_t		floor;	/* FLOOR of the car */
+	uint16_t	car;
+	uint16_t	ring;	/* the recording thread */
+	uint8_t		kind;	/* enum trace_kind */
+	uint8_t		func;	/* enum coroutine_id */
+	uint8_t		state;	/* STATE of the car */
+	uint8_t		flags;	/* bit i-1 is set iff Di != 0 */
+};
+
+struct trace_head {
+	uint32_t	magic;
+	uint32_t	rec_size;
+	int32_t		floor_nr;
+	int32_t		car_nr;
+};
+
+/* one producer (the recording thread), one consumer (the flusher) */
+struct trace_ring {
+	struct trace_rec	rec[TRACE_RING_SIZE];
+	unsigned long		head;	/* written by the producer only */
+	unsigned long		tail;	/* written by the flusher only */
+	int			id;
+	struct trace_ring *	next;
+};
+
+struct trace {
+	FILE *			fp;	/* 0 if the trace is off */
+	pthread_t		flusher;
+	pthread_mutex_t		lock;	/* of rings */
+	struct trace_ring *	rings;
+	int			ring_nr;
+	int			stop;
+	long			rec_nr;
+	long			stall_nr;	/* a ring was full */
+} T;
+
+__thread struct trace_ring * my_ring = 0;
+
+#define TRACE(kind, w)	do { if (T.fp) trace_rec(kind, w); } while (0)
+
+void trace_rec(enum trace_kind kind, const WAIT_NODE * w)
+{
+	struct trace_ring * r = my_ring;
+	struct car * c = w->car ? w->car : &sim->B.cars[0];
+	struct trace_rec * t;
+	unsigned long h;
+
+	if (!r) {
+		r = my_ring = (struct trace_ring *)calloc(1, sizeof(struct trace_ring));
+		assert(r);
+		pthread_mutex_lock(&T.lock);
+		r->id = T.ring_nr++;
+		r->next = T.rings;
+		T.rings = r;
+		pthread_mutex_unlock(&T.lock);
+	}
+
+	h = r->head;
+	while (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+		__atomic_fetch_add(&T.stall_nr, 1, __ATOMIC_RELAXED);
+		sched_yield();
+	}
+
+	t = &r->rec[h & (TRACE_RING_SIZE - 1)];
+	t->time  = current_step ? TIME : 0;
+	t->when  = w->ent_time;
+	t->user  = w->arg ? w->arg->id : 0;
+	t->floor = c->FLOOR;
+	t->car   = c->id;
+	t->ring  = r->id;
+	t->kind  = kind;
+	t->func  = w->inst;
+	t->state = c->STATE;
+	t->flags = (c->D1 != 0) | (c->D2 != 0) << 1 | (c->D3 != 0) << 2;
+
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&T.rec_nr, 1, __ATOMIC_RELAXED);
+}
+
+/* writes the records of r to the file, returns the number of them */
+unsigned long trace_drain(struct trace_ring * r)
+{
+	unsigned long t = r->tail;
+	unsigned long n = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - t;
+	unsigned long i = t & (TRACE_RING_SIZE - 1);
+
+	if (i + n > TRACE_RING_SIZE) {
+		fwrite(&r->rec[i], sizeof(struct trace_rec), TRACE_RING_SIZE - i, T.fp);
+		fwrite(&r->rec[0], sizeof(struct trace_rec), i + n - TRACE_RING_SIZE, T.fp);
+	}
+	else if (n) {
+		fwrite(&r->rec[i], sizeof(struct trace_rec), n, T.fp);
+	}
+
+	__atomic_store_n(&r->tail, t + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+void * trace_flusher(void * unused)
+{
+	struct timespec nap = {0, 1000000};	/* 1ms */
+
+	for (;;) {
+		/* read ``stop'' first, so the last records are drained */
+		int stop = __atomic_load_n(&T.stop, __ATOMIC_ACQUIRE);
+		unsigned long n = 0;
+		struct trace_ring * r;
+
+		pthread_mutex_lock(&T.lock);
+		for (r = T.rings; r; r = r->next)
+			n += trace_drain(r);
+		pthread_mutex_unlock(&T.lock);
+
+		if (n == 0) {
+			if (stop)
+				break;
+			nanosleep(&nap, 0);
+		}
+	}
+	return 0;
+}
+
+void trace_open(const char * filename)
+{
+	struct trace_head h = {TRACE_MAGIC, sizeof(struct trace_rec),
+			       sim->B.floor_nr, sim->B.car_nr};
+
+	T.fp = fopen(filename, "wb");
+	if (!T.fp) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fwrite(&h, sizeof(h), 1, T.fp);
+
+	pthread_mutex_init(&T.lock, 0);
+	if (pthread_create(&T.flusher, 0, trace_flusher, 0) != 0) {
+		fprintf(stderr, "cannot create the flusher thread\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void trace_close(void)
+{
+	struct trace_ring * r;
+
+	if (!T.fp)
+		return;
+
+	__atomic_store_n(&T.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(T.flusher, 0);
+	fclose(T.fp);
+	T.fp = 0;
+
+	while ((r = T.rings) != 0) {
+		T.rings = r->next;
+		free(r);
+	}
+	my_ring = 0;
+
+	fprintf(stderr, "trace: %ld records, the rings were full %ld times.\n",
+		T.rec_nr, T.stall_nr);
+}
+
+/* the offline decoder, writes the trace to stdout as xlog() would do */
+void trace_decode(const char * filename)
+{
+	static const char * state_str[] = {"NEUTRAL", "GOINGUP", "GOINGDOWN"};
+	struct trace_head h;
+	struct trace_rec t;
+	FILE * fp = fopen(filename, "rb");
+
+	if (!fp) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    h.magic != TRACE_MAGIC || h.rec_size != sizeof(struct trace_rec)) {
+		fprintf(stderr, "%s: not a trace of this program\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fread(&t, sizeof(t), 1, fp) == 1) {
+		assert(t.func < COROUTINE_NR);
+		assert(t.state < sizeof(state_str)/sizeof(state_str[0]));
+		if (t.ring)
+			printf("[RING:%d]", t.ring);
+		if (t.kind == TR_SCHED) {
+			printf("%s will be scheduled at TIME %ld\n",
+			       coroutines[t.func].name, (long)t.when);
+		}
+		else if (t.kind == TR_CANCEL) {
+			printf("%s is cancelled (TIME %ld)\n",
+			       coroutines[t.func].name, (long)t.when);
+		}
+		else {
+			printf("[TIME:%ld]", (long)t.time);
+			if (h.car_nr > 1)
+				printf("[CAR:%d]", t.car);
+			printf("[STATE:%s][FLOOR:%d]"
+			       "[[D1(peopleIO):%d D2(stopped30s):%d D3(nobody):%d]"
+			       " %s - %s\n",
+			       state_str[t.state], t.floor,
+			       t.flags & 1, (t.flags >> 1) & 1, (t.flags >> 2) & 1,
+			       coroutines[t.func].name, coroutines[t.func].desc);
+		}
+	}
+	fclose(fp);
+}
+#else
+#define TRACE(kind, w)	do { } while (0)
+#endif
+
+/* void xlog_node(struct node288 *x, char struct_type) */
+/* { */
+/* 	const char * pending[] = {"", */
+/* 				  "\t\t\t\t\t\t", */
+/* 				  "\t\t\t\t\t\t\t\t\t\t\t\t" */
+/* 	}; */
+/* 	const char * p; */
+/* 	switch (struct_type) { */
+/* 	case 'W':	/\* WAIT *\/ */
+/* 		p = pending[0]; */
+/* 		break; */
+/* 	case 'Q':	/\* QUEUE[0..4] *\/ */
+/* 		p = pending[1]; */
+/* 		break; */
+/* 	case 'E':	/\* ELEVATOR *\/ */
+/* 		p = pending[2]; */
+/* 		break; */
+/* 	default: */
+/* 		assert(0); */
+/* 		break; */
+/* 	} */
+
+/* 	if (!x) { */
+/* 		xlog(LOG_PLAIN, "%s=============================================\n", p); */
+/* 		return; */
+/* 	} */
+
+/* 	xlog(LOG_PLAIN, "%s---------------------------------------------\n", p); */
+/* 	xlog(LOG_PLAIN, "%s %8X", p, (int)x); */
+/* 	xlog(LOG_PLAIN, "%12d    %8X    %8X\n", x->IN, (int)x->LLINK1, (int)x->RLINK1); */
+/* 	xlog(LOG_TIME, "%s%45d\n", p, x->ent_time); */
+/* 	xlog(LOG_FUNC_NAME, "%s%21s%24s\n", p, "", coroutines[x->inst].name); */
+/* 	xlog(LOG_PLAIN, "%s%21d    %8X    %8X\n", p, x->OUT, (int)x->LLINK2, (int)x->RLINK2); */
+/* 	xlog(LOG_PLAIN, "%s%21d            \"%10s\"\n", p, x->giveup_time, x->name); */
+/* } */
+
+void in_QUEUE(struct user_info *p)
+{
+	int in = p->IN;
+	USER_NODE * q = alloc_USER_node();
+
+	assert((in >= MIN_FLOOR) && (in <= MAX_FLOOR));
+
+	q->uinfo = p;
+	p->node  = q;
+
+	q->QL = sim->B.QUEUE[in].QL;
+	q->QR = &sim->B.QUEUE[in];
+	sim->B.QUEUE[in].QL->QR = q;
+	sim->B.QUEUE[in].QL = q;
+	sim->B.queued++;
+	metrics_queue(in, 1);
+
+	xlog(LOG_U, "      %s (%d->%d) is inserted into QUEUE[%d].\n",
+	     p->name, p->IN, p->OUT, p->IN);
+}
+
+/** the user's node is found by his/her handle ``node'' instead of a search
+ *  of QUEUE[in], so a crowded floor costs nothing when someone gives up;
+ *  -DSEARCH_USERS brings the searches back, see RIDERS()
+ */
+void out_QUEUE(int in, struct user_info * p)
+{
+	USER_NODE * q = p->node;
+
+	assert(in == p->IN);
+	assert(q && q->uinfo == p);
+#ifdef SEARCH_USERS
+	for (q = sim->B.QUEUE[in].QR; q->uinfo != p; q = q->QR)
+		assert(q != &sim->B.QUEUE[in]);
+#endif
+	q->QL->QR = q->QR;
+	q->QR->QL = q->QL;
+	p->node = 0;
+	sim->B.queued--;
+	metrics_queue(in, -1);
+
+	xlog(LOG_U, "      %s (%d->%d) is removed from QUEUE[%d].\n",
+	     p->name, p->IN, p->OUT, p->IN);
+
+	free_USER_node(q);
+}
+
+/****************************************************************************************************
+ * Backends of the WAIT list.
+ *
+ *     The WAIT list in the book is a doubly linked list sorted by ent_time,
+ *     so in_WAIT() costs O(n) and out_WAIT() has to search the whole list.
+ *     The backends below keep exactly the same order (see wait_before()):
+ *
+ *             backend         in_WAIT()       next_WAIT()     out_WAIT()
+ *             --------        ---------       -----------     ----------
+ *             list            O(n)            O(1)            O(1)
+ *             binheap         O(log n)        O(log n)        O(log n)
+ *             pairing         O(1)            O(log n) am.    O(log n) am.
+ *             calendar        O(1) avg.       O(1) avg.       O(1)
+ *
+ *     out_WAIT() never searches for the node it cancels: every node that
+ *     may be cancelled has a handle (see ``giveup'' in struct user_info,
+ *     and ``agenda[]''). Unlinking it then costs what the table says.
+ ****************************************************************************************************/
+/* is ``a'' executed before ``b''? */
+int wait_before(const WAIT_NODE * a, const WAIT_NODE * b)
+{
+	return (a->ent_time < b->ent_time ||
+		(a->ent_time == b->ent_time && a->seq < b->seq));
+}
+
+/*
+ * list: the doubly linked list in TAOCP p.288
+ */
+void list_init(void)
+{
+	WAIT.WL = &WAIT;
+	WAIT.WR = &WAIT;
+	WAIT.ent_time = 0;
+	WAIT.inst = CO_DUMMY;
+}
+
+void list_insert(WAIT_NODE * w)
+{
+	WAIT_NODE * p = WAIT.WL;
+	while (p != &WAIT && wait_before(w, p))
+		p = p->WL;
+
+	/* insert to the right of p */
+	w->WL = p;
+	w->WR = p->WR;
+	p->WR->WL = w;
+	p->WR = w;
+}
+
+void list_remove(WAIT_NODE * w)
+{
+	w->WL->WR = w->WR;
+	w->WR->WL = w->WL;
+}
+
+WAIT_NODE * list_pop(void)
+{
+	WAIT_NODE * w = WAIT.WR;
+	if (w == &WAIT)
+		return 0;
+	list_remove(w);
+	return w;
+}
+
+/*
+ * binheap: an implicit binary heap, heap[0] is the next node to execute
+ */
+void binheap_init(void)
+{
+	sim->heap_nr = 0;
+}
+
+void heap_set(int i, WAIT_NODE * w)
+{
+	sim->heap[i] = w;
+	w->pos = i;
+}
+
+void heap_sift_up(int i)
+{
+	WAIT_NODE * w = sim->heap[i];
+	while (i > 0 && wait_before(w, sim->heap[(i - 1) / 2])) {
+		heap_set(i, sim->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(i, w);
+}
+
+void heap_sift_down(int i)
+{
+	WAIT_NODE * w = sim->heap[i];
+	int c;
+	while ((c = 2 * i + 1) < sim->heap_nr) {
+		if (c + 1 < sim->heap_nr && wait_before(sim->heap[c + 1], sim->heap[c]))
+			c++;
+		if (!wait_before(sim->heap[c], w))
+			break;
+		heap_set(i, sim->heap[c]);
+		i = c;
+	}
+	heap_set(i, w);
+}
+
+void binheap_insert(WAIT_NODE * w)
+{
+	if (sim->heap_nr == sim->heap_max) {
+		sim->heap_max = sim->heap_max ? sim->heap_max * 2 : 256;
+		sim->heap = (WAIT_NODE **)realloc(sim->heap, sizeof(WAIT_NODE *) * sim->heap_max);
+		assert(sim->heap);
+	}
+	heap_set(sim->heap_nr++, w);
+	heap_sift_up(sim->heap_nr - 1);
+}
+
+void binheap_remove(WAIT_NODE * w)
+{
+	int i = w->pos;
+	assert(i < sim->heap_nr && sim->heap[i] == w);
+	if (i == --sim->heap_nr)
+		return;
+	heap_set(i, sim->heap[sim->heap_nr]);
+	if (i > 0 && wait_before(sim->heap[i], sim->heap[(i - 1) / 2]))
+		heap_sift_up(i);
+	else
+		heap_sift_down(i);
+}
+
+WAIT_NODE * binheap_pop(void)
+{
+	if (sim->heap_nr == 0)
+		return 0;
+	WAIT_NODE * w = sim->heap[0];
+	binheap_remove(w);
+	return w;
+}
+
+/*
+ * pairing: a pairing heap (Fredman, Sedgewick, Sleator & Tarjan, 1986)
+ *     CHILD:  the leftmost child
+ *     RLINK1: the next sibling
+ *     LLINK1: the previous sibling, or the parent if it is the leftmost child
+ */
+
+void pairing_init(void)
+{
+	sim->pairing_root = 0;
+}
+
+/* meld two trees, returns the new root */
+WAIT_NODE * pairing_meld(WAIT_NODE * a, WAIT_NODE * b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (wait_before(b, a)) {
+		WAIT_NODE * t = a;
+		a = b;
+		b = t;
+	}
+	/* b becomes the leftmost child of a */
+	b->LLINK1 = a;
+	b->RLINK1 = a->CHILD;
+	if (a->CHILD)
+		a->CHILD->LLINK1 = b;
+	a->CHILD = b;
+	a->LLINK1 = 0;
+	a->RLINK1 = 0;
+	return a;
+}
+
+/* the standard two-pass pairing of a list of siblings */
+WAIT_NODE * pairing_merge_pairs(WAIT_NODE * first)
+{
+	WAIT_NODE * pairs = 0;	/* melded pairs, linked by RLINK1 in reverse */
+	WAIT_NODE * a;
+	WAIT_NODE * b;
+	WAIT_NODE * next;
+
+	/* pass 1: left to right */
+	while (first) {
+		a = first;
+		b = a->RLINK1;
+		next = b ? b->RLINK1 : 0;
+		a->LLINK1 = a->RLINK1 = 0;
+		if (b)
+			b->LLINK1 = b->RLINK1 = 0;
+		a = pairing_meld(a, b);
+		a->RLINK1 = pairs;
+		pairs = a;
+		first = next;
+	}
+
+	/* pass 2: right to left */
+	WAIT_NODE * root = 0;
+	while (pairs) {
+		next = pairs->RLINK1;
+		pairs->RLINK1 = 0;
+		root = pairing_meld(root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+void pairing_insert(WAIT_NODE * w)
+{
+	w->LLINK1 = w->RLINK1 = w->CHILD = 0;
+	sim->pairing_root = pairing_meld(sim->pairing_root, w);
+}
+
+void pairing_remove(WAIT_NODE * w)
+{
+	if (w == sim->pairing_root) {
+		sim->pairing_root = pairing_merge_pairs(w->CHILD);
+		return;
+	}
+
+	/* cut the subtree rooted at w */
+	if (w->LLINK1->CHILD == w)
+		w->LLINK1->CHILD = w->RLINK1;
+	else
+		w->LLINK1->RLINK1 = w->RLINK1;
+	if (w->RLINK1)
+		w->RLINK1->LLINK1 = w->LLINK1;
+
+	sim->pairing_root = pairing_meld(sim->pairing_root,
+				    pairing_merge_pairs(w->CHILD));
+}
+
+WAIT_NODE * pairing_pop(void)
+{
+	WAIT_NODE * w = sim->pairing_root;
+	if (w)
+		pairing_remove(w);
+	return w;
+}
+
+/*
+ * calendar: a calendar queue (R. Brown, CACM 31(10), 1988)
+ *     Bucket i holds the nodes whose ent_time / width % nb == i, every bucket
+ *     is a sorted doubly linked list like the WAIT list in the book.
+ */
+void calendar_link(WAIT_NODE * w)
+{
+	WAIT_NODE * head = &sim->cal.bucket[(w->ent_time / sim->cal.width) & (sim->cal.nb - 1)];
+	WAIT_NODE * p = head->WL;
+	while (p != head && wait_before(w, p))
+		p = p->WL;
+	w->WL = p;
+	w->WR = p->WR;
+	p->WR->WL = w;
+	p->WR = w;
+	sim->cal.nr++;
+}
+
+void calendar_locate(long t)
+{
+	sim->cal.last_time   = t;
+	sim->cal.last_bucket = (t / sim->cal.width) & (sim->cal.nb - 1);
+	sim->cal.bucket_top  = (t / sim->cal.width + 1) * sim->cal.width;
+}
+
+WAIT_NODE * calendar_unlink_first(void)
+{
+	int i = sim->cal.last_bucket;
+	long top = sim->cal.bucket_top;
+	int n;
+	WAIT_NODE * w;
+
+	if (sim->cal.nr == 0)
+		return 0;
+
+	for (n = 0; n < sim->cal.nb; n++) {
+		w = sim->cal.bucket[i].WR;
+		if (w != &sim->cal.bucket[i] && w->ent_time < top)
+			goto found;
+		i = (i + 1) & (sim->cal.nb - 1);
+		top += sim->cal.width;
+	}
+
+	/* nothing in this year, search the heads of all buckets directly */
+	w = 0;
+	for (i = 0; i < sim->cal.nb; i++) {
+		WAIT_NODE * p = sim->cal.bucket[i].WR;
+		if (p != &sim->cal.bucket[i] && (!w || wait_before(p, w)))
+			w = p;
+	}
+found:
+	w->WL->WR = w->WR;
+	w->WR->WL = w->WL;
+	sim->cal.nr--;
+	calendar_locate(w->ent_time);
+	return w;
+}
+
+/* rebuild the calendar with nb buckets, the width is estimated from the
+ * separation of the first few nodes, as suggested by Brown
+ */
+void calendar_resize(int nb)
+{
+	WAIT_NODE * sample[25];
+	WAIT_NODE * all = 0;
+	int n = 0;
+	int i;
+	long saved_time = sim->cal.last_time;
+
+	sim->cal.resizing = 1;
+
+	/* estimate the new width */
+	while (n < (int)(sizeof(sample)/sizeof(sample[0])) && sim->cal.nr > 0)
+		sample[n++] = calendar_unlink_first();
+	if (n > 1) {
+		long sum = 0;
+		int cnt = 0;
+		long avg = (sample[n-1]->ent_time - sample[0]->ent_time) / (n - 1);
+		for (i = 1; i < n; i++) {
+			long d = sample[i]->ent_time - sample[i-1]->ent_time;
+			if (d <= 2 * avg) {
+				sum += d;
+				cnt++;
+			}
+		}
+		sim->cal.width = cnt ? 3 * sum / cnt : 1;
+		if (sim->cal.width < 1)
+			sim->cal.width = 1;
+	}
+
+	/* collect all the nodes, linked by RLINK1 */
+	for (i = 0; i < n; i++) {
+		sample[i]->WR = all;
+		all = sample[i];
+	}
+	for (i = 0; i < sim->cal.nb; i++) {
+		WAIT_NODE * head = &sim->cal.bucket[i];
+		while (head->WR != head) {
+			WAIT_NODE * w = head->WR;
+			head->WR = w->WR;
+			w->WR = all;
+			all = w;
+		}
+	}
+
+	/* rebucket */
+	sim->cal.bucket = (WAIT_NODE *)realloc(sim->cal.bucket, sizeof(WAIT_NODE) * nb);
+	assert(sim->cal.bucket);
+	sim->cal.nb = nb;
+	for (i = 0; i < nb; i++)
+		sim->cal.bucket[i].WL = sim->cal.bucket[i].WR = &sim->cal.bucket[i];
+	sim->cal.nr = 0;
+	while (all) {
+		WAIT_NODE * next = all->WR;
+		calendar_link(all);
+		all = next;
+	}
+	calendar_locate(saved_time);
+
+	sim->cal.resizing = 0;
+}
+
+void calendar_init(void)
+{
+	sim->cal.nb = 0;
+	sim->cal.nr = 0;
+	sim->cal.width = 1;
+	sim->cal.last_time = 0;
+	calendar_resize(CALENDAR_MIN_NB);
+}
+
+void calendar_insert(WAIT_NODE * w)
+{
+	calendar_link(w);
+	if (!sim->cal.resizing && sim->cal.nr > 2 * sim->cal.nb)
+		calendar_resize(sim->cal.nb * 2);
+}
+
+void calendar_remove(WAIT_NODE * w)
+{
+	w->WL->WR = w->WR;
+	w->WR->WL = w->WL;
+	sim->cal.nr--;
+	if (!sim->cal.resizing && sim->cal.nb > CALENDAR_MIN_NB && sim->cal.nr < sim->cal.nb / 2)
+		calendar_resize(sim->cal.nb / 2);
+}
+
+WAIT_NODE * calendar_pop(void)
+{
+	WAIT_NODE * w = calendar_unlink_first();
+	if (w && sim->cal.nb > CALENDAR_MIN_NB && sim->cal.nr < sim->cal.nb / 2)
+		calendar_resize(sim->cal.nb / 2);
+	return w;
+}
+
+const struct wait_backend wait_backends[] = {
+	{"list",     list_init,     list_insert,     list_pop,     list_remove},
+	{"binheap",  binheap_init,  binheap_insert,  binheap_pop,  binheap_remove},
+	{"pairing",  pairing_init,  pairing_insert,  pairing_pop,  pairing_remove},
+	{"calendar", calendar_init, calendar_insert, calendar_pop, calendar_remove},
+};
+
+/*
+ * the WAIT list interface
+ */
+void agenda_add(WAIT_NODE * w)
+{
+	struct car * c = w->car;
+	assert(c->agenda_nr < AGENDA_SIZE);
+	w->slot = c->agenda_nr;
+	c->agenda[c->agenda_nr++] = w;
+}
+
+void agenda_del(WAIT_NODE * w)
+{
+	struct car * c = w->car;
+	assert(c->agenda[w->slot] == w);
+	c->agenda[w->slot] = c->agenda[--c->agenda_nr];
+	c->agenda[w->slot]->slot = w->slot;
+}
+
+/** the node is leaving the WAIT list (executed or cancelled),
+ *  so its handle should be dropped
+ */
+void drop_handle(WAIT_NODE * w)
+{
+	if (w->car != NO_CAR)
+		agenda_del(w);
+	else if (w->arg->giveup == w)
+		w->arg->giveup = 0;
+}
+
+/* the next action of elevator c, 0 if there is none */
+WAIT_NODE * next_elevator_action(struct car * c)
+{
+	int i;
+	WAIT_NODE * w = 0;
+	for (i = 0; i < c->agenda_nr; i++)
+		if (!w || wait_before(c->agenda[i], w))
+			w = c->agenda[i];
+	return w;
+}
+
+/* is the elevator action ``inst'' of c in the WAIT list? */
+int pending(struct car * c, enum coroutine_id inst)
+{
+	int i;
+	for (i = 0; i < c->agenda_nr; i++)
+		if (c->agenda[i]->inst == inst)
+			return 1;
+	return 0;
+}
+
+/** an elevator action is scheduled with (c, NO_ARG),
+ *  a user action is scheduled with (NO_CAR, p)
+ */
+void in_WAIT(long ent_time, enum coroutine_id inst,
+	     struct car * c, struct user_info * arg)
+{
+	WAIT_NODE * w = alloc_WAIT_node();
+	w->ent_time = ent_time;
+	w->seq  = wait_seq++;
+	w->inst = inst;
+	w->car  = c;
+	w->arg  = arg;
+
+	xlog(LOG_PLAIN, "%s will be scheduled at TIME %ld\n",
+	     coroutines[inst].name, ent_time);
+
+	if (c != NO_CAR) {
+		assert(arg == NO_ARG);
+		agenda_add(w);
+	}
+	else if (inst == CO_U4) {
+		assert(arg->giveup == 0);
+		arg->giveup = w;
+	}
+	else if (inst == CO_U1)
+		sim->arrival = w;
+
+	sim->WQ->insert(w);
+	TRACE(TR_SCHED, w);
+}
+
+/* returns the next node to execute, 0 if the WAIT list is empty */
+WAIT_NODE * next_WAIT(void)
+{
+	WAIT_NODE * w = sim->WQ->pop();
+	if (w)
+		drop_handle(w);
+	if (w && w == sim->arrival)
+		sim->arrival = 0;
+	return w;
+}
+
+/* puts back w, which next_WAIT() has returned but has not been executed */
+void again_WAIT(WAIT_NODE * w)
+{
+	if (w->car != NO_CAR)
+		agenda_add(w);
+	else if (w->inst == CO_U4)
+		w->arg->giveup = w;
+	else if (w->inst == CO_U1)
+		sim->arrival = w;
+	sim->WQ->insert(w);
+}
+
+void out_WAIT(enum coroutine_id inst, struct car * c, struct user_info * arg)
+{
+	int i;
+	WAIT_NODE * p = 0;
+
+	if (c != NO_CAR) {
+		for (i = 0; i < c->agenda_nr; i++) {
+			if (c->agenda[i]->inst == inst) {
+				assert(p == 0);
+				p = c->agenda[i];
+			}
+		}
+	}
+	else {
+		assert(inst == CO_U4);
+		p = arg->giveup;
+	}
+
+	if (p) {
+		drop_handle(p);
+		sim->WQ->remove(p);
+		TRACE(TR_CANCEL, p);
+		xlog(LOG_PLAIN, "%s is cancelled (TIME %ld)\n",
+		     coroutines[inst].name, p->ent_time);
+		free_WAIT_node(p);
+	}
+	else {
+		xlog(LOG_PLAIN, "%s is not in the WAIT list.\n",
+		     coroutines[inst].name);
+	}
+}
+
+/** the list of the users in car c who get out at floor j; with -DSEARCH_USERS
+ *  everyone is in ELEVATOR[MIN_FLOOR], one list as in the book, and E4() and
+ *  out_ELEVATOR() search it
+ */
+#ifdef SEARCH_USERS
+#define RIDERS(c, j)	(&(c)->ELEVATOR[MIN_FLOOR])
+#else
+#define RIDERS(c, j)	(&(c)->ELEVATOR[j])
+#endif
+
+void in_ELEVATOR(struct car * c, struct user_info * p)
+{
+	USER_NODE * h = RIDERS(c, p->OUT);
+	USER_NODE * e = alloc_USER_node();
+
+	e->uinfo = p;
+	p->node  = e;
+
+	e->EL = h->EL;
+	e->ER = h;
+	h->EL->ER = e;
+	h->EL = e;
+	c->riders++;
+}
+
+void out_ELEVATOR(struct car * c, struct user_info * p)
+{
+	USER_NODE * e = p->node;
+	/* ELEVATOR list should not be empty */
+	assert(RIDERS(c, p->OUT)->ER != RIDERS(c, p->OUT));
+	assert(e && e->uinfo == p);
+#ifdef SEARCH_USERS
+	for (e = RIDERS(c, p->OUT)->ER; e->uinfo != p; e = e->ER)
+		assert(e != RIDERS(c, p->OUT));
+#endif
+	e->EL->ER = e->ER;
+	e->ER->EL = e->EL;
+	p->node = 0;
+	c->riders--;
+	free_USER_node(e);
+}
+
+/* /\* log double-linked list *\/ */
+/* void xlog_DLL(struct node288 *p, char struct_type) */
+/* { */
+/* 	struct node288 * x = p; */
+/* 	do { */
+/* 		xlog_node(x, struct_type); */
+
+/* 		switch (struct_type) { */
+/* 		case 'W':	/\* WAIT *\/ */
+/* 			x = x->WR; */
+/* 			break; */
+/* 		case 'Q':	/\* QUEUE[0..4] *\/ */
+/* 			x = x->QR; */
+/* 			break; */
+/* 		case 'E':	/\* ELEVATOR *\/ */
+/* 			x = x->ER; */
+/* 			break; */
+/* 		default: */
+/* 			assert(0); */
+/* 			break; */
+/* 		} */
+/* 	} while (x != p); */
+/* 	xlog_node(0, struct_type); */
+/* } */
+
+const char * get_STATE_str(struct car * c)
+{
+	/* this array must correspond with ``enum elevator_state'': */
+	static const char * state_str[] = {"NEUTRAL", "GOINGUP", "GOINGDOWN"};
+	assert(c->STATE < sizeof(state_str)/sizeof(state_str[0]));
+	return state_str[c->STATE];
+}
+
+/* a bitset of floors as ``CALLUP[0..4]:1,0,0,0,0'', in buf */
+char * sprint_bitset(char * buf, const char * name, const uint64_t * s)
+{
+	int j;
+	char * p = buf + sprintf(buf, "%s[0..%d]:", name, MAX_FLOOR);
+	for (j = MIN_FLOOR; j <= MAX_FLOOR; j++)
+		p += sprintf(p, j < MAX_FLOOR ? "%d," : "%d", bs_test(s, j));
+	return buf;
+}
+
+/* one line, as the E7A and E8A of a single elevator logged it */
+void xlog_calls(const char * step, struct car * c)
+{
+	size_t size = 32 + 2 * sim->B.floor_nr;
+	char * buf;
+
+	if (quiet)
+		return;
+	buf = (char *)malloc(3 * size);
+	assert(buf);
+	xlog(LOG_E,
+	     "%s. "
+	     "FLOOR:%d. CALLCAR[%d]:%d. "
+	     "CALLUP[%d]:%d. CALLDOWN[%d]:%d. "
+	     "%s. %s.%s.\n",
+	     step,
+	     c->FLOOR, c->FLOOR, bs_test(c->CALLCAR, c->FLOOR),
+	     c->FLOOR, bs_test(c->CALLUP, c->FLOOR),
+	     c->FLOOR, bs_test(c->CALLDOWN, c->FLOOR),
+	     sprint_bitset(buf, "CALLUP", c->CALLUP),
+	     sprint_bitset(buf + size, "CALLDOWN", c->CALLDOWN),
+	     sprint_bitset(buf + 2 * size, "CALLCAR", c->CALLCAR));
+	free(buf);
+}
+
+/** c is the elevator whose state is logged,
+ *  the car id is logged only if there are more than one elevators
+ */
+void xlog_state(const char * s, int level, struct car * c)
+{
+	if (level > 1)
+		xlog(LOG_PLAIN, "\n%s\n", s);
+
+	if (level > 0) {
+		xlog(LOG_TIME, "[TIME:%ld]", TIME);
+		if (sim->B.car_nr > 1)
+			xlog(LOG_STATE, "[CAR:%d]", c->id);
+		xlog(LOG_STATE, "[STATE:%s]", get_STATE_str(c));
+		xlog(LOG_FLOOR, "[FLOOR:%d]", c->FLOOR);
+		xlog(LOG_FLAG1, "[");
+		if (c->D1)
+			xlog(LOG_FLAG1, "[D1(peopleIO):%d ", c->D1);
+		else
+			xlog(LOG_FLAG0, "[D1(peopleIO):%d ", c->D1);
+		if (c->D2)
+			xlog(LOG_FLAG1, "D2(stopped30s):%d ", c->D2);
+		else
+			xlog(LOG_FLAG0, "D2(stopped30s):%d ", c->D2);
+		if (c->D3)
+			xlog(LOG_FLAG1, "D3(nobody):%d", c->D3);
+		else
+			xlog(LOG_FLAG0, "D3(nobody):%d", c->D3);
+		xlog(LOG_FLAG1, "]");
+		/* xlog(LOG_PLAIN, "\n"); */
+	}
+
+	/* if (level > 1) { */
+	/* 	xlog(LOG_PLAIN, "\nWAIT:\n"); */
+	/* 	xlog_DLL(&WAIT, 'W'); */
+	/* 	xlog(LOG_PLAIN, "\nQUEUE[0..4]:\n"); */
+	/* 	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++) */
+	/* 		xlog_DLL(&QUEUE[i], 'Q'); */
+	/* 	xlog(LOG_PLAIN, "\nELEVATOR:\n"); */
+	/* 	xlog_DLL(&ELEVATOR, 'E'); */
+	/* } */
+}
+
+
+/****************************************************************************************************
+ * Subroutine D (DECISION subroutine) This subroutine is performed at certain
+ * critical times, as specified in the coroutines above, when a decision about the
+ * elevator's next direction is to be made.
+ ****************************************************************************************************/
+void D(struct car * c)
+{
+	/*
+	 * D1. [Decision necessary?] If STATE != NEUTRAL, exit from this subroutine.
+	 */
+	xlog(LOG_PLAIN, "--------D1\n");
+	if (c->STATE != NEUTRAL) {
+		xlog(LOG_PLAIN, "--------STATE != NEUTRAL. Do nothing.\n");
+		return;
+	}
+
+	/*
+	 * D2. [Should doors open?] If the elevator is positioned at E1 and if CALLUP[2],
+	 *     CALLCAR[2], and CALLDOWN[2] are not all zero, cause the elevator to start
+	 *     its activity E3 after 20 units of time, and exit from this subroutine. (if
+	 *     the DECISION subroutine is currently being invoked by the independent
+	 *     activity E9, it is possible for the elevator coroutine to be positioned at E1.)
+	 */
+	/** this happens when:
+	 *      1. elevator is dormant
+	 *      2. new user arrives at floor 2
+	 */
+	/** the elevator stays ``positioned at E1'' until E3 or E6 below is
+	 *  executed, so D2 and D5 must not send it twice if more users call
+	 *  it in the meantime. once E3 is on its way, E6 will decide after the
+	 *  doors close; an E6 from D5 now would move the car with its doors open.
+	 */
+	xlog(LOG_PLAIN, "--------D2\n");
+	if (c->current_elevator_step == 0xE1 && pending(c, CO_E3))
+		return;
+	if ((c->current_elevator_step == 0xE1) &&
+	    (bs_test(c->CALLUP, HOME) || bs_test(c->CALLCAR, HOME) ||
+	     bs_test(c->CALLDOWN, HOME))) {
+		in_WAIT(TIME + 20, CO_E3, c, NO_ARG);
+		return;
+	}
+
+	/*
+	 * D3. [Any calls?] Find the smallest j != FLOOR for which CALLUP[j], CALLCAR[j],
+	 *     or CALLDOWN[j] is nonzero, and go on to step D4. But if no such j exists,
+	 *     then set j <- 2 if the DECISION subroutine is currently being invoked by
+	 *     step E6; otherwise exit from this subroutine.
+	 */
+	/** the rule above is knuth_target(), other dispatch policies may
+	 *  choose another j, see struct dispatch_policy
+	 */
+	xlog(LOG_PLAIN, "--------D3\n");
+	int j = sim->DP->target(c);
+	if (j < 0) {		/* no such j exists */
+		if (c->current_elevator_step == 0xE6)
+			j = HOME;
+		else
+			return;
+	}
+
+	/*
+	 * D4. [Set STATE.] If FLOOR > j, set STATE <-- GOINGDOWN; if FLOOR < j, set
+	 *     STATE <-- GOINGUP.
+	 */
+	xlog(LOG_PLAIN, "--------D4. FLOOR:%d, j:%d\n", c->FLOOR, j);
+	if (c->FLOOR > j)
+		c->STATE = GOINGDOWN;
+	else if (c->FLOOR < j)
+		c->STATE = GOINGUP;
+	else
+		;		/* do nothing */
+
+	/*
+	 * D5. [Elevator dormant?] If the elevator coroutine is positioned at step E1, and
+	 *     if j != 2, set the elevator to perform step E6 after 20 units of time. Exit
+	 *     from the subroutine.  ▍
+	 */
+	/** this happens when:
+	 *      1. elevator is dormant
+	 *      2. new user arrives at floor X (X!=2)
+	 */
+	xlog(LOG_PLAIN, "--------D5\n");
+	if ((c->current_elevator_step == 0xE1) && (j != HOME) && !pending(c, CO_E6)) {
+		in_WAIT(TIME + 20, CO_E6, c, NO_ARG);
+	}
+}
+
+/****************************************************************************************************
+ * Dispatch policies (``-P''). The book has only one elevator, so it only
+ * needs to decide where it goes next (D3). With more cars, a policy also
+ * decides which car answers a hall call (see U2()):
+ *
+ *     knuth        the book: every car answers every call, and heads for
+ *                  the lowest floor with a call
+ *     collective   every car stops for every call on its way, but a new call
+ *                  only wakes up the most suitable car, which heads for the
+ *                  nearest call
+ *     nearest      nearest car: every call is assigned to the most suitable
+ *                  car (the figure of suitability), which alone answers it
+ *     destination  destination dispatch: the user tells OUT at the hall, and
+ *                  is assigned to the car that would serve him/her at the
+ *                  least cost; he/she takes no other car
+ ****************************************************************************************************/
+#define DD_STOP_COST		2	/* a stop costs as much as 2 floors */
+
+/* the book's rule, see D3 */
+int knuth_target(struct car * c)
+{
+	return bs_next(c->CALLUP, c->CALLCAR, c->CALLDOWN, MIN_FLOOR);
+}
+
+/* the nearest floor with a call, the upper one if there are two */
+int nearest_target(struct car * c)
+{
+	int up   = bs_next(c->CALLUP, c->CALLCAR, c->CALLDOWN, c->FLOOR);
+	int down = bs_prev(c->CALLUP, c->CALLCAR, c->CALLDOWN, c->FLOOR);
+	if (up < 0)
+		return down;
+	if (down < 0 || up - c->FLOOR <= c->FLOOR - down)
+		return up;
+	return down;
+}
+
+/** the figure of suitability of car c for a call at floor f, the larger the
+ *  better: a car coming towards f in the same direction as the call is the
+ *  best, then a car coming towards f or an idle car, the nearer the better,
+ *  and a car going away is the worst.
+ */
+int suitability(struct car * c, int f, enum elevator_state dir)
+{
+	int n = sim->B.floor_nr;
+	int d = abs(c->FLOOR - f);
+
+	if (c->STATE == NEUTRAL)
+		return n + 1 - d;
+	if ((c->STATE == GOINGUP && f > c->FLOOR) ||
+	    (c->STATE == GOINGDOWN && f < c->FLOOR))
+		return c->STATE == dir ? n + 2 - d : n + 1 - d;
+	return 1;
+}
+
+struct car * nearest_assign(struct user_info * p)
+{
+	enum elevator_state dir = p->OUT > p->IN ? GOINGUP : GOINGDOWN;
+	struct car * best = &sim->B.cars[0];
+	int i;
+
+	for (i = 1; i < sim->B.car_nr; i++)
+		if (suitability(&sim->B.cars[i], p->IN, dir) >
+		    suitability(best, p->IN, dir))
+			best = &sim->B.cars[i];
+	return best;
+}
+
+/** the cost of serving p by car c, in floors: the way to IN (through the
+ *  farthest stop if c is going away from IN) and DD_STOP_COST for every stop
+ *  c has to make, but a stop at IN or OUT that c makes anyway is free.
+ */
+int destination_cost(struct car * c, struct user_info * p)
+{
+	int far = -1;
+	int way;
+	int stops = 0;
+	int i;
+
+	if (c->STATE == GOINGUP && p->IN < c->FLOOR)
+		far = bs_prev(c->CALLUP, c->CALLDOWN, c->CALLCAR, MAX_FLOOR);
+	else if (c->STATE == GOINGDOWN && p->IN > c->FLOOR)
+		far = bs_next(c->CALLUP, c->CALLDOWN, c->CALLCAR, MIN_FLOOR);
+	if (far >= 0)
+		way = abs(far - c->FLOOR) + abs(far - p->IN);
+	else
+		way = abs(c->FLOOR - p->IN);
+
+	for (i = 0; i < sim->B.word_nr; i++)
+		stops += __builtin_popcountll(c->CALLUP[i] | c->CALLDOWN[i] |
+					      c->CALLCAR[i]);
+	if (bs_test(c->CALLUP, p->IN) || bs_test(c->CALLDOWN, p->IN) ||
+	    bs_test(c->CALLCAR, p->IN))
+		stops--;
+	if (bs_test(c->CALLCAR, p->OUT))
+		stops--;
+
+	return way + DD_STOP_COST * stops;
+}
+
+struct car * destination_assign(struct user_info * p)
+{
+	struct car * best = &sim->B.cars[0];
+	int cost = destination_cost(best, p);
+	int i;
+
+	for (i = 1; i < sim->B.car_nr; i++) {
+		int x = destination_cost(&sim->B.cars[i], p);
+		if (x < cost) {
+			best = &sim->B.cars[i];
+			cost = x;
+		}
+	}
+	return best;
+}
+
+const struct dispatch_policy dispatch_policies[] = {
+	/* name,        shared, reserved, assign,             target */
+	{"knuth",       1,      0,        0,                  knuth_target},
+	{"collective",  1,      0,        nearest_assign,     nearest_target},
+	{"nearest",     0,      0,        nearest_assign,     nearest_target},
+	{"destination", 0,      1,        destination_assign, nearest_target},
+};
+
+/****************************************************************************************************
+ * Coroutine U (Users). Everyone who enters the system begins to perform the
+ * actions specified below, starting at step U1.
+ ****************************************************************************************************/
+/*
+ * U1. [Enter, prepare for successor.] The following quantities are determined in
+ *     some manner that will not be specified here:
+ *
+ *     IN, the floor on which the new user has entered the system;
+ *     OUT, the floor to which this user wants to go (OUT != IN);
+ *     GIVEUPTIME, the amount of time this user will wait for the elevator before
+ *         running out of patience and deciding to walk;
+ *     INTERTIME, the amount of time before another user will enter the system.
+ *
+ *     After these quantities have been computed, the simulation program sets
+ *     things up so that another user enters the system at TIME+INTERTIME
+ */
+/** ptr: &uinfo[] */
+void U1(struct user_info * p)
+{
+	struct user_info * q = next_user();
+
+	xlog(LOG_PLAIN, "IN:%d; OUT:%d; GIVEUPTIME:%d; INTERTIME: %ld; %s\n",
+	     p->IN, p->OUT, p->GIVEUPTIME,
+	     q ? q->ENTERTIME - p->ENTERTIME : 0, p->name);
+	xlog(LOG_U, "U1(). %s arrives at floor %d, destination is %d.\n",
+	     p->name, p->IN, p->OUT);
+
+	/* another user enters the system at TIME+INTERTIME */
+	if (q)
+		in_WAIT(q->ENTERTIME, CO_U1, NO_CAR, q);
+
+	U2(p);
+}
+
+/*
+ * U2. [Signal and wait.] (The purpose of this step is to call for the elevator; some
+ *     special cases arise if the elevator is already on the right floor.)
+ */
+void U2(struct user_info * p)
+{
+	/* xlog_node(p, 'Q'); */
+	xlog(LOG_U, "U2(). %s (%d->%d).\n", p->name, p->IN, p->OUT);
+	sim->M.arrived[p->IN]++;
+
+	/* If FLOOR == IN and if the elevator's next action is step E6 below
+	 *    (that is, if the elevator doors are now closing),
+	 * send the elevator immediately to its step E3 and cancel its activity E6.
+	 * (This means that the doors will open again before the elevator moves.)
+	 */
+	/** with more than one elevator, the first one on floor IN whose
+	 *  doors are closing (or, if there is none, whose doors are open) is
+	 *  the one the user sees.
+	 */
+	int i;
+	struct car * c;
+	struct car * closing = 0;
+	struct car * open = 0;
+
+	/** the dispatch policy decides which car answers this call */
+	struct car * a = sim->DP->assign ? sim->DP->assign(p) : NO_CAR;
+	assert(a != NO_CAR || sim->DP->shared);
+	if (a != NO_CAR)
+		xlog(LOG_U, "U2(). %s is assigned to CAR %d.\n", p->name, a->id);
+	if (sim->DP->reserved)
+		p->car = a;
+
+	for (i = 0; i < sim->B.car_nr; i++) {
+		c = &sim->B.cars[i];
+		if (p->car && p->car != c)
+			continue;
+		WAIT_NODE * w = next_elevator_action(c);
+		if (w && sim->B.car_nr > 1)
+			xlog(LOG_U, "U2(). the next action of CAR %d - %s.\n",
+			     c->id, coroutines[w->inst].name);
+		else if (w)
+			xlog(LOG_U, "U2(). the elevator's next action - %s.\n",
+			     coroutines[w->inst].name);
+		if (c->FLOOR != p->IN)
+			continue;
+		if (w && w->inst == CO_E6 && !closing)
+			closing = c;
+		if (c->D3 != 0 && !open)
+			open = c;
+	}
+	if (closing) {
+		in_WAIT(TIME, CO_E3, closing, NO_ARG);
+
+		/** cancel E6. to keep uniformity, out_WAIT() is used instead
+		 *  of WQ->remove(w):
+		 */
+		out_WAIT(CO_E6, closing, NO_ARG);
+
+		xlog(LOG_U, "U2(). Doors will open again.\n");
+	}
+	/* If FLOOR == IN and if D3 != 0, set D3 <-- 0, set D1 to a nonzero value,
+	 * and start up the elevator's activity E4 again. (This means that the elevator
+	 * doors are open on this floor, but everyone else has already gotten on or
+	 * off. Elevator step E4 is a sequencing step that grants people permission to
+	 * enter the elevator according to normal laws of courtesy; therefore, restarting
+	 * E4 gives this user a chance to get in before the doors close.)
+	 */
+	else if (open) {
+		open->D3 = 0;
+		open->D1 = 1;
+		in_WAIT(TIME, CO_E4, open, NO_ARG);
+	}
+	/* In all other
+	 * cases, the user sets CALLUP[IN] <-- 1 or CALLDOWN[IN] <-- 1, according as
+	 * OUT > IN or OUT < IN; and if D2 == 0 or the elevator is in its ``dormant''
+	 * position E1, the DECISION subroutine specified below is performed. (The
+	 * DECISION subroutine is used to take the elevator out of NEUTRAL state at
+	 * certain critical times.)
+	 */
+	else {
+		/* if the calls are shared, a->CALLUP is B.CALLUP */
+		if (p->OUT > p->IN) {
+			bs_set(a ? a->CALLUP : sim->B.CALLUP, p->IN);
+			xlog(LOG_U, "U2(). %s pressed button UP.\n", p->name);
+		}
+		else if (p->OUT < p->IN) {
+			bs_set(a ? a->CALLDOWN : sim->B.CALLDOWN, p->IN);
+			xlog(LOG_U, "U2(). %s pressed button Down.\n", p->name);
+		}
+		else {
+			xlog(LOG_U, "U2(). No elevator is needed since %d==%d. "
+			     "%s is stupid.\n",
+			     p->IN, p->OUT, p->name);
+			leave_system(p);
+			return;
+		}
+
+		for (i = 0; i < sim->B.car_nr; i++) {
+			c = &sim->B.cars[i];
+			if (a && a != c)
+				continue;
+			if ((c->D2 == 0) || (c->current_elevator_step == 0xE1)) {
+				D(c);
+			}
+		}
+	}
+	U3(p);
+}
+
+/*
+ * U3. [Enter queue.] Insert this user at the rear of QUEUE[IN], which is a linear
+ *     list representing the people waiting on this floor. Now the user waits
+ *     patiently for GIVEUPTIME units of time, unless the elevator arrives first --
+ *     more precisely, unless step E4 of the elevator routine below sends this user
+ *     to U5 and cancels the scheduled activity U4.
+ */
+void U3(struct user_info * p)
+{
+	in_WAIT(p->ENTERTIME + p->GIVEUPTIME, CO_U4, NO_CAR, p);
+	in_QUEUE(p);
+}
+
+/*
+ * U4. [Give up.] 
+ */
+void U4(struct user_info * p)
+{
+	xlog(LOG_U, "U4(). %s (%d->%d) gives up.\n", p->name, p->IN, p->OUT);
+
+	/* If FLOOR != IN or D1 == 0, delete this user from QUEUE[IN]
+	 * and from the simulated system. (The user has decided that the elevator is
+	 * too slow, or that a bit of exercise will be better than an elevator ride.)
+	 */
+	int i;
+	struct car * c = 0;
+	for (i = 0; i < sim->B.car_nr; i++)
+		if ((sim->B.cars[i].FLOOR == p->IN) && (sim->B.cars[i].D1 != 0))
+			c = &sim->B.cars[i];
+	if (!c) {
+		out_QUEUE(p->IN, p);
+		sim->W.gave_up++;
+		sim->M.gave_up[p->IN]++;
+		leave_system(p);
+	}
+	/* If FLOOR == IN and D1 != 0, the user stays and waits (knowing that the wait
+	 * won't be long).
+	 */
+	else {
+		assert((c->FLOOR == p->IN) && (c->D1 != 0));
+		xlog(LOG_U, "U4(). %s (%d->%d) changes his/her mind to stay and wait.\n",
+		     p->name, p->IN, p->OUT);
+	}
+}
+
+/*
+ * U5. [Get in.] 
+ */
+void U5(struct user_info * p, struct car * c)
+{
+	xlog(LOG_U, "U5(). %s (%d->%d) gets in the elevator. (FLOOR:%d)\n",
+	     p->name, p->IN, p->OUT, c->FLOOR);
+
+	/* This user now leaves QUEUE[IN] and enters ELEVATOR, which is
+	 * a stack-like list representing the people now on board the elevator. Set
+	 * CALLCAR[OUT] <-- 1.
+	 */
+	out_QUEUE(p->IN, p);
+	in_ELEVATOR(c, p);
+	p->BOARDTIME = TIME;
+	sim->M.boarded[p->IN]++;
+	hdr_record(&sim->M.wait, TIME - p->ENTERTIME);
+
+	bs_set(c->CALLCAR, p->OUT);
+
+	/*     Now if STATE == NEUTRAL, set STATE <-- GOINGUP or GOINGDOWN as
+	 * appropriate, and set the elevator's activity E5 to be executed after 25 units
+	 * of time. (This is a special feature of the elevator, allowing the doors to close
+	 * faster than usual if the elevator is in NEUTRAL state when the user selects a
+	 * destination floor. The 25-unit time interval gives step E4 the opportunity
+	 * to make sure that D1 is properly set up by the time step E5, the door-closing
+	 * action, occurs.)
+	 */
+	if (c->STATE == NEUTRAL) {
+		if (p->OUT > p->IN)
+			c->STATE = GOINGUP;
+		else if (p->OUT < p->IN)
+			c->STATE = GOINGDOWN;
+		else
+			assert(0);
+
+		xlog(LOG_U, "U5(). STATE: NEUTRAL --> %s\n", get_STATE_str(c));
+
+		out_WAIT(CO_E5, c, NO_ARG);
+		in_WAIT(TIME + 25, CO_E5, c, NO_ARG); /** when this E5 is excuted, U5's caller E4
+						 *  must have set D1 = 0, so that the door
+						 *  will be closed.
+						 */
+	}
+
+	/*     Now the user waits until being sent to step U6 by step E4 below, when
+	 * the elevator has reached the desired floor.
+	 */
+	/** ``waits'' means no source code */
+}
+
+/*
+ * U6. [Get out.] Delete this user from the ELEVATOR list and from the simulated
+ *     system.  ▍
+ */
+void U6(struct user_info * p, struct car * c)
+{
+	xlog(LOG_U, "U6(). %s (%d->%d) gets out of the elevator. (FLOOR:%d)\n",
+	     p->name, p->IN, p->OUT, c->FLOOR);
+
+	out_ELEVATOR(c, p);
+
+	/** if ``*p'' is allocated dynamically, it's the right time and place
+	 *  to free the memory.
+	 */
+	sim->W.delivered++;
+	sim->W.journey_sum += TIME - p->ENTERTIME;
+	sim->M.alighted[p->OUT]++;
+	hdr_record(&sim->M.ride, TIME - p->BOARDTIME);
+	leave_system(p);
+}
+
+/****************************************************************************************************
+ * Coroutine E (Elevator). This coroutine represents the actions of the elevator;
+ * step E4 also handles the control of when people get in and out.
+ ****************************************************************************************************/
+/*
+ * E1. [Wait for call.] (At this point the elevator is sitting at floor 2 with the doors
+ *     closed, waiting for something to happen.) If someone presses a button, the
+ *     DECISION subroutine will take us to step E3 or E6. Meanwhile, wait.
+ */
+void E1(struct car * c)
+{
+	int flag;
+
+	xlog(LOG_E, "E1(). Elevator is waiting for call. (FLOOR:%d)\n", c->FLOOR);
+
+	/* If someone presses a button, the
+	 * DECISION subroutine will take us to step E3 or E6. Meanwhile, wait. */
+	flag = bs_next(c->CALLUP, c->CALLDOWN, sim->B.zero, MIN_FLOOR) >= 0;
+
+	if (flag) {
+		D(c);
+	}
+	else {
+		c->dormant = 1;
+		xlog(LOG_E, "E1(). Elevator dormant.\n");
+	}
+}
+
+/*
+ * E2. [Change of state?] 
+ */
+void E2(struct car * c)
+{
+	xlog(LOG_E, "E2(). Elevator stops.\n");
+	xlog(LOG_E, "E2(). STATE: %s --> ", get_STATE_str(c));
+
+	/* If STATE == GOINGUP and
+	 * CALLUP[j] == CALLDOWN[j] == CALLCAR[j] == 0 for all j > FLOOR
+	 */
+	if (c->STATE == GOINGUP) {
+		int flag1 = calls_above(c);
+		if (!flag1) {
+			/** !flag1 (i.e. flag1 == 0) means
+			 *         CALLUP[FLOOR..4]   ==
+			 *         CALLDOWN[FLOOR..4] ==
+			 *         CALLCAR[FLOOR..4]  == 0
+			 */
+			/** there's nobody upstairs */
+			/* to avoid confusion, don't reuse flag1 */
+			int flag2 = bs_prev(c->CALLCAR, sim->B.zero, sim->B.zero,
+					    c->FLOOR - 1) >= 0;
+			/** !flag2 (i.e. flag2 == 0) means
+			 *         CALLCAR[0..FLOOR] == 0
+			 */
+			/* then set STATE <-- NEUTRAL or STATE <-- GOINGDOWN,
+			 * according as CALLCAR[j] == 0 for all j < FLOOR or not,
+			 */
+			if (!flag2)
+				/** there's no person going down in the car */
+				c->STATE = NEUTRAL;
+			else
+				c->STATE = GOINGDOWN;
+
+			/* and set all CALL variables for the current floor to zero. */
+			bs_clear(c->CALLUP, c->FLOOR);
+			bs_clear(c->CALLDOWN, c->FLOOR);
+			bs_clear(c->CALLCAR, c->FLOOR);
+		}
+	}
+
+	/* If STATE == GOINGDOWN, do similar actions with directions reversed. */
+	if (c->STATE == GOINGDOWN) {
+		int flag1 = calls_below(c);
+		/* xlog(LOG_E, "(%s)", flag1 ? "flag1" : ""); */
+		if (!flag1) {
+			/** !flag1 (i.e. flag1 == 0) means
+			 *         CALLUP[0..FLOOR]   ==
+			 *         CALLDOWN[0..FLOOR] ==
+			 *         CALLCAR[0..FLOOR]  == 0
+			 */
+			/** there's nobody downstairs */
+			/* to avoid confusion, don't reuse flag1 */
+			int flag2 = bs_next(c->CALLCAR, sim->B.zero, sim->B.zero,
+					    c->FLOOR + 1) >= 0;
+			/* xlog(LOG_E, "(%s)", flag2 ? "flag2" : ""); */
+			/** !flag2 (i.e. flag2 == 0) means
+			 *         CALLCAR[FLOOR..4] == 0
+			 */
+			/* then set STATE <-- NEUTRAL or STATE <-- GOINGUP,
+			 * according as CALLCAR[j] == 0 for all j > FLOOR or not,
+			 */
+			if (!flag2)
+				/** there's no person going down in the car */
+				c->STATE = NEUTRAL;
+			else
+				c->STATE = GOINGUP;
+
+			/* and set all CALL variables for the current floor to zero. */
+			bs_clear(c->CALLUP, c->FLOOR);
+			bs_clear(c->CALLDOWN, c->FLOOR);
+			bs_clear(c->CALLCAR, c->FLOOR);
+		}
+	}
+
+	xlog(LOG_E, "%s.\n", get_STATE_str(c));
+
+	in_WAIT(TIME, CO_E3, c, NO_ARG);			/** open doors */
+}
+
+/*
+ * E3. [Open doors.] Set D1 and D2 to any nonzero values. Set elevator activity
+ *     E9 to start up independently after 300 units of time. (This activity may be
+ *     canceled in step E6 below before it occurs. If it has already been scheduled
+ *     and not canceled, we cancel it and reschedule it.) Also set elevator activity
+ *     E5 to start up independently after 76 units of time. Then wait 20 units of
+ *     time (to simulate opening of the doors) and go to E4.
+ */
+void E3(struct car * c)
+{
+	xlog(LOG_E, "E3(). Open doors.\n");
+
+	c->D1 = 1;
+	c->D2 = 1;
+	if (c->dormant) {
+		c->dormant = 0;
+		xlog(LOG_E, "E3(). Elevator no more dormant.\n");
+	}
+
+	in_WAIT(TIME + 20, CO_E4, c, NO_ARG); /** let people out, in */
+	in_WAIT(TIME + 76, CO_E5, c, NO_ARG); /** close doors */
+	out_WAIT(CO_E9, c, NO_ARG);		/** cancel E9 if it has been scheduled */
+	in_WAIT(TIME + 300, CO_E9, c, NO_ARG); /** set inaction indicator */
+}
+
+/*
+ * E4. [Let people out, in.] If anyone in the ELEVATOR list has OUT == FLOOR, send
+ *     the user of this type who has most recently entered immediately to step U6,
+ *     wait 25 units, and repeat step E4. If no such users exist, but QUEUE[FLOOR]
+ *     is not empty, send the front person of that queue immediately to step U5
+ *     instead of U4, wait 25 units, and repeat step E4. But if QUEUE[FLOOR]
+ *     is empty, set D1 <-- 0, make D3 nonzero, and wait for some other activity
+ *     to initiate further action. (Step E5 will send us to E6, or step U2 will
+ *     restart E4.)
+ */
+void E4(struct car * c)
+{
+	/** the one who has entered first, rather than most recently: the
+	 *  order does not matter to the statistics
+	 */
+	USER_NODE * h = RIDERS(c, c->FLOOR);
+	USER_NODE * p = h->ER;
+#ifdef SEARCH_USERS
+	while (p != h && p->uinfo->OUT != c->FLOOR)
+		p = p->ER;
+#endif
+	if (p != h) {
+		xlog(LOG_E, "E4(). %s is sent to U6().\n",
+		     p->uinfo->name);
+		U6(p->uinfo, c);
+		in_WAIT(TIME + 25, CO_E4, c, NO_ARG); /** empty the elevator */
+		return;
+	}
+
+	/** the first one in QUEUE[FLOOR] who may take this car */
+	p = sim->B.QUEUE[c->FLOOR].ER;
+	while (p != &sim->B.QUEUE[c->FLOOR] && p->uinfo->car && p->uinfo->car != c)
+		p = p->ER;
+	if (p != &sim->B.QUEUE[c->FLOOR]) { /** QUEUE[FLOOR] is not empty */
+		xlog(LOG_E, "E4(). %s is sent to U5().\n",
+		     p->uinfo->name);
+		out_WAIT(CO_U4, NO_CAR, p->uinfo);	     /** fortunately the elevator comes */
+
+		/** the sequence of these two lines cannot be exchanged, because
+		 *  it should be guarranteed that ``E5'' in this line (called in U5):
+		 *      in_WAIT(TIME + 25, CO_E5, NO_ARG);
+		 *  should be scheduled after ``E4'' of in the following in_WAIT():
+		 */
+		in_WAIT(TIME + 25, CO_E4, c, NO_ARG); /** fill the elevator */
+		U5(p->uinfo, c);
+	}
+	else {
+		c->D1 = 0;
+		c->D3 = 1;
+		xlog(LOG_E, "E4(). Nobody is here. "
+		     "wait for some other activity to initiate further action\n");
+		return;
+	}
+}
+
+/*
+ * E5. [Close doors.] If D1 != 0, wait 40 units and repeat this step (the doors flutter
+ *     a little, but they spring open again, since someone is still getting out or in).
+ *     Otherwise set D3 <-- 0 and set the elevator to start at step E6 after 20 units
+ *     of time. (This simulates closing the doors after people have finished getting
+ *     in or out; but if a new user enters on this floor while the doors are closing,
+ *     they will open again as stated in step U2.)
+ */
+void E5(struct car * c)
+{
+	if (c->D1) {
+		xlog(LOG_E, "E5(). Doors flutter.\n");
+		in_WAIT(TIME + 40, CO_E5, c, NO_ARG); /** close the door later */
+		return;
+	}
+	c->D3 = 0;
+	in_WAIT(TIME + 20, CO_E6, c, NO_ARG); /** prepare to move */
+
+	xlog(LOG_E, "E5(). Doors closed.\n");
+}
+
+/** ``-Z'': E6 has found no call and heads for HOME (or stays there). If
+ *  the car is empty and nobody waits in QUEUE[], nobody can call it before
+ *  the U1 in the WAIT list (the users in the other cars press CALLCAR of
+ *  their own cars only), and the car does what the book says without
+ *  anybody to serve:
+ *
+ *      E7 (or E8), E7A (or E8A) at every floor up to HOME, E2, E3, E4, E5,
+ *      E6, E1, and E9 300 units after E3
+ *
+ *  or E1 and the pending E9 if the car is at HOME already. If all of them
+ *  come before the U1, they are not scheduled at all: the car is put where
+ *  they would leave it, and TIME goes on to the next node at once. Returns
+ *  1 if so; the statistics are those of the steps, which are counted in
+ *  elided_nr instead of event_nr.
+ */
+int idle_home(struct car * c)
+{
+	int d = abs(c->FLOOR - HOME);
+	int e9 = pending(c, CO_E9);
+	long end;		/* TIME of the last of the steps */
+	long nr;		/* number of the steps */
+
+	if (!sim->arrival || sim->B.queued || c->riders || c->agenda_nr != e9 ||
+	    bs_next(c->CALLUP, c->CALLDOWN, c->CALLCAR, MIN_FLOOR) >= 0)
+		return 0;
+	if (c->FLOOR < HOME && c->STATE == GOINGUP) {
+		end = TIME + 15 + 51 * d + 14 + 300;
+		nr  = d + 8;
+	}
+	else if (c->FLOOR > HOME && c->STATE == GOINGDOWN) {
+		end = TIME + 15 + 61 * d + 23 + 300;
+		nr  = d + 8;
+	}
+	else if (d == 0 && c->STATE == NEUTRAL) {
+		end = e9 ? next_elevator_action(c)->ent_time : TIME;
+		nr  = 1 + e9;
+	}
+	else
+		return 0;
+	if (end >= sim->arrival->ent_time)
+		return 0;
+
+	if (e9)
+		out_WAIT(CO_E9, c, NO_ARG); /** canceled by E6, or executed */
+	if (d) {
+		c->FLOOR  = HOME;
+		c->D1     = 0;	/* E4 */
+		c->D3     = 0;	/* E5 */
+		sim->M.moves[c->id] += d;
+	}
+	if (d || e9)
+		c->D2 = 0;	/* E9 */
+	c->STATE   = NEUTRAL;
+	c->dormant = 1;
+	c->current_elevator_step = 0xE1;
+	elided_nr += nr;
+	xlog(LOG_E, "E6(). Idle at floor %d till TIME %ld, %ld steps elided.\n",
+	     HOME, end, nr);
+	return 1;
+}
+
+/*
+ * E6. [Prepare to move.] Set CALLCAR[FLOOR] to zero; also set CALLUP[FLOOR]
+ *     to zero if STATE != GOINGDOWN, and also set CALLDOWN[FLOOR] to zero if
+ *     STATE != GOINGUP. (Note: If STATE == GOINGUP, the elevator does not clear
+ *     out CALLDOWN, since it assumes that people who are going down will not
+ *     have entered; but see exercise 6.) Now perform the DECISION subroutine.
+ *         If STATE == NEUTRAL even after the DECISION subroutine has acted, go
+ *     to E1. Otherwise, if D2 != 0, cancel the elevator activity E9. Finally, if
+ *     STATE == GOINGUP, wait 15 units of time (for the elevator to build up speed)
+ *     and go to E7; if STATE == GOINGDOWN, wait 15 units and go to E8.
+ */
+void E6(struct car * c)
+{
+	xlog(LOG_E, "E6(). Prepare to move.\n");
+
+	if (c->dormant) {
+		c->dormant = 0;
+		xlog(LOG_E, "E6(). Elevator no more dormant.\n");
+	}
+
+	bs_clear(c->CALLCAR, c->FLOOR);
+	if (c->STATE != GOINGDOWN)
+		bs_clear(c->CALLUP, c->FLOOR);
+	if (c->STATE != GOINGUP)
+		bs_clear(c->CALLDOWN, c->FLOOR);
+
+	D(c);
+
+	if (idle_skip && idle_home(c))
+		return;
+
+	if (c->STATE == NEUTRAL) {
+		in_WAIT(TIME, CO_E1, c, NO_ARG); /** wait for call */
+		return;
+	}
+	else {
+		if (c->D2) {
+			out_WAIT(CO_E9, c, NO_ARG); /** cancel E9 */
+			xlog(LOG_E, "E6(). cancelled E9()\n");
+		}
+	}
+
+	if (c->STATE == GOINGUP) {
+		in_WAIT(TIME + 15, CO_E7, c, NO_ARG); /** go up a floor */
+	} else if (c->STATE == GOINGDOWN) {
+		in_WAIT(TIME + 15, CO_E8, c, NO_ARG); /** go down a floor */
+	} else {
+		assert(0);
+	}
+}
+
+/*
+ * E7. [Go up a floor.] Set FLOOR <-- FLOOR + 1 and wait 51 units of time. If
+ *     now CALLCAR[FLOOR] == 1 or CALLUP[FLOOR] == 1, or
+ *     if ((FLOOR == 2 or CALLDOWN[FLOOR] == 1) and
+ *         CALLUP[j] == CALLDOWN[j] == CALLCAR[j] == 0 for all j > FLOOR),
+ *     wait 14 units (for deceleration) and go to E2. Otherwise,
+ *     repeat this step.
+ */
+void E7A(struct car * c)
+{
+	int all_zero = !calls_above(c);
+	/** c->FLOOR == MAX_FLOOR never happens with one elevator, but with
+	 *  more elevators the calls above may have been served by others
+	 */
+	if (bs_test(c->CALLCAR, c->FLOOR) || bs_test(c->CALLUP, c->FLOOR) ||
+	    ((c->FLOOR == HOME || bs_test(c->CALLDOWN, c->FLOOR)) && all_zero) ||
+	    c->FLOOR == MAX_FLOOR) {
+		xlog_calls("E7A()", c);
+
+		in_WAIT(TIME + 14, CO_E2, c, NO_ARG); /** change state */
+		return;
+	}
+	else {
+		E7(c);		/** repeat E7 */
+	}
+}
+void E7(struct car * c)
+{
+	c->FLOOR++;
+	assert(c->FLOOR <= MAX_FLOOR);
+	sim->M.moves[c->id]++;
+
+	xlog(LOG_E, "E7(). Elevator goes up a floor. (%d->%d)\n", c->FLOOR-1, c->FLOOR);
+
+	in_WAIT(TIME + 51, CO_E7A, c, NO_ARG); /** wait 51 units of time */
+}
+
+/*
+ * E8. [Go down a floor.] This step is like E7 with directions reversed, and also
+ *     the times 51 and 14 are changed to 61 and 23, respectively. (It takes the
+ *     elevator longer to go down than up.)
+ */
+void E8A(struct car * c)
+{
+	/** if !all_zero, the car need not go downstairs anymore
+	 *  because nobody's there and nobody's getting there
+	 */
+	int all_zero = !calls_below(c);
+	xlog_calls("E8A()", c);
+	if (bs_test(c->CALLCAR, c->FLOOR) || bs_test(c->CALLDOWN, c->FLOOR) ||
+	    ((c->FLOOR == HOME || bs_test(c->CALLUP, c->FLOOR)) && all_zero) ||
+	    c->FLOOR == MIN_FLOOR) {
+		in_WAIT(TIME + 23, CO_E2, c, NO_ARG); /** change state */
+		return;
+	}
+	else {
+		E8(c);		/** repeat E8 */
+	}
+}
+void E8(struct car * c)
+{
+	c->FLOOR--;
+	assert(c->FLOOR >= MIN_FLOOR);
+	sim->M.moves[c->id]++;
+
+	xlog(LOG_E, "E8(). Elevator goes down a floor. (%d->%d)\n", c->FLOOR+1, c->FLOOR);
+
+	in_WAIT(TIME + 61, CO_E8A, c, NO_ARG); /** wait 61 units of time */
+}
+
+/*
+ * E9. [Set inaction indicator.] Set D2 <-- 0 and perform the DECISION subroutine.
+ *     ( This independent action is initiated in step E3 but it is almost always
+ *     canceled in step E6. See exercise 4.)  ▍
+ */
+void E9(struct car * c)
+{
+	xlog(LOG_E, "E9(). Set inaction indicator.\n");
 
-	/*
-	 * D5. [Elevator dormant?] If the elevator coroutine is positioned at step E1, and
-	 *     if j != 2, set the elevator to perform step E6 after 20 units of time. Exit
-	 *     from the subroutine.  ▍
-	 */
-	/** this happens when:
-	 *      1. elevator is dormant
-	 *      2. new user arrives at floor X (X!=2)
+	/** E9 is not considered as an elevator step, so
+	 *  current_elevator_step is not changed by main() for E9.
+	 *  Usually the elevator is in ``dormant'' position E1 now, but not
+	 *  always: if many people get in or out, the doors may have been open
+	 *  for more than 300 units of time (see exercise 4).
 	 */
-	xlog(LOG_PLAIN, "--------D5\n");
-	if ((current_elevator_step == 0xE1) && (j != 2)) {
-		in_WAIT(TIME + 20, E6, NO_ARG);
-	}
+	c->D2 = 0;
+	D(c);
 }
 
 /****************************************************************************************************
- * Coroutine U (Users). Everyone who enters the system begins to perform the
- * actions specified below, starting at step U1.
+ * A simulation: sim_init(), sim_run() and sim_free() work on ``sim'' of the
+ * calling thread, whose W and WQ must be set before sim_init().
  ****************************************************************************************************/
-/*
- * U1. [Enter, prepare for successor.] The following quantities are determined in
- *     some manner that will not be specified here:
- *
- *     IN, the floor on which the new user has entered the system;
- *     OUT, the floor to which this user wants to go (OUT != IN);
- *     GIVEUPTIME, the amount of time this user will wait for the elevator before
- *         running out of patience and deciding to walk;
- *     INTERTIME, the amount of time before another user will enter the system.
- *
- *     After these quantities have been computed, the simulation program sets
- *     things up so that another user enters the system at TIME+INTERTIME
- */
-/** ptr: &uinfo[] */
-void U1(struct user_info * p)
+void sim_init(int floor_nr, int home, int car_nr, const char * od_file)
 {
-	xlog(LOG_U, "U1(). %s arrives at floor %d, destination is %d.\n",
-	     p->name, p->IN, p->OUT);
+	slab_init(&sim->WAIT_slab, "WAIT_NODE", sizeof(WAIT_NODE));
+	slab_init(&sim->USER_slab, "USER_NODE", sizeof(USER_NODE));
+	slab_init(&sim->user_info_slab, "user_info", sizeof(struct user_info));
+
+	building_init(floor_nr, home, car_nr);
+	metrics_init(0);
+	if (sim->W.user_nr)
+		workload_init(od_file);
+	sim->WQ->init();
+}
 
-	U2(p);
+/* schedules the elevators and the first user */
+void sim_start(void)
+{
+	int i;
+
+	/* xlog_state("***** data structures *****"); */
+
+	for (i = 0; i < sim->B.car_nr; i++)
+		in_WAIT(0, CO_E1, &sim->B.cars[i], NO_ARG);
+
+	/* the first user, U1 will bring in the others one by one */
+	struct user_info * first = next_user();
+	if (first)
+		in_WAIT(first->ENTERTIME, CO_U1, NO_CAR, first);
+
+	/* xlog_state("***** data structures *****"); */
+
+	xlog(LOG_PLAIN, "\n"
+	     "=================================================="
+	     "execute the WAIT list"
+	     "=================================================="
+	     "\n");
 }
 
-/*
- * U2. [Signal and wait.] (The purpose of this step is to call for the elevator; some
- *     special cases arise if the elevator is already on the right floor.)
+/** executes the WAIT list up to TIME ``until''. returns the first node later
+ *  than that, which has left the WAIT list but has not been executed (see
+ *  snapshot_write()), or 0 if the WAIT list is empty.
  */
-void U2(struct user_info * p)
+WAIT_NODE * sim_loop(long until)
 {
-	/* xlog_node(p, 'Q'); */
-	xlog(LOG_U, "U2(). %s (%d->%d).\n", p->name, p->IN, p->OUT);
+	for (;;) {
+		WAIT_NODE * w = next_WAIT();
+		if (!w || w->ent_time > until)
+			return w;
+		while (sim->M.period && w->ent_time >= sim->M.next_dump) {
+			metrics_dump(sim->M.next_dump);
+			sim->M.next_dump += sim->M.period;
+		}
+		/* TIME is current_step->ent_time, so the node executed
+		 * last is freed only when the next one is taken */
+		if (current_step)
+			free_WAIT_node(current_step);
+		current_step = w;
+		event_nr++;
+		if (compare_out)
+			compare_write(w);
+
+		/* the state of the elevator of this node is logged */
+		struct car * c = current_step->car ? current_step->car : &sim->B.cars[0];
+
+		const struct coroutine * co = &coroutines[current_step->inst];
+		if (co->step)
+			c->current_elevator_step = co->step;
+		TRACE(TR_EXEC, w);
+		xlog_state("", 1, c);
+		xlog(LOG_FUNC_NAME, " %s - %s\n", co->name, co->desc);
 
-	/* If FLOOR == IN and if the elevator's next action is step E6 below
-	 *    (that is, if the elevator doors are now closing),
-	 * send the elevator immediately to its step E3 and cancel its activity E6.
-	 * (This means that the doors will open again before the elevator moves.)
-	 */
-	int next_is_E6 = 0;
-	WAIT_NODE * w = current_step->WR;
-	for (; w != &WAIT; w = w->WR) {
-		const char * p = get_func_info(w->inst, GET_FUNC_NAME);
-		xlog(LOG_U, "U2(). traversing - %s.\n", p);
-		if (p[0] == 'E') {
-			if (p[1] == '6') { /* E6 */
-				next_is_E6 = 1;
-				break;
-			}
-			else {	         /* E[1-5,7-9] */
-				assert(!next_is_E6);
-				break;
-			}
+		/* execute this node */
+		if (co->fe) {
+			assert(current_step->arg == 0);
+			co->fe(c);
 		}
-		else {		/* not the elevator's action */
-			continue;
+		else {
+			assert(co->fu);
+			co->fu(current_step->arg);
 		}
+
+		assert(c->current_elevator_step != 0xE9); /* see E9() */
 	}
-	if ((p->IN == FLOOR) && next_is_E6) {
-		in_WAIT(TIME, E3, NO_ARG);
+}
 
-		/** cancel E6. these two lines will work:
-		 *		w->WL->WR = w->WR;
-		 *		w->WR->WL = w->WL;
-		 *  however, to keep uniformity, out_WAIT() is used instead:
-		 */
-		out_WAIT(E6, 0);
+/* schedules the elevators and the first user, and executes the WAIT list */
+void sim_run(void)
+{
+	sim_start();
+	sim_loop(LONG_MAX);
+}
 
-		xlog(LOG_U, "U2(). Doors will open again.\n");
-	}
-	/* If FLOOR == IN and if D3 != 0, set D3 <-- 0, set D1 to a nonzero value,
-	 * and start up the elevator's activity E4 again. (This means that the elevator
-	 * doors are open on this floor, but everyone else has already gotten on or
-	 * off. Elevator step E4 is a sequencing step that grants people permission to
-	 * enter the elevator according to normal laws of courtesy; therefore, restarting
-	 * E4 gives this user a chance to get in before the doors close.)
-	 */
-	else if ((p->IN == FLOOR) && (D3 != 0)) {
-		D3 = 0;
-		D1 = 1;
-		in_WAIT(TIME, E4, NO_ARG);
-	}
-	/* In all other
-	 * cases, the user sets CALLUP[IN] <-- 1 or CALLDOWN[IN] <-- 1, according as
-	 * OUT > IN or OUT < IN; and if D2 == 0 or the elevator is in its ``dormant''
-	 * position E1, the DECISION subroutine specified below is performed. (The
-	 * DECISION subroutine is used to take the elevator out of NEUTRAL state at
-	 * certain critical times.)
-	 */
-	else {
-		if (p->OUT > p->IN) {
-			CALLUP[p->IN] = 1;
-			xlog(LOG_U, "U2(). %s pressed button UP.\n", p->name);
-		}
-		else if (p->OUT < p->IN) {
-			CALLDOWN[p->IN] = 1;
-			xlog(LOG_U, "U2(). %s pressed button Down.\n", p->name);
-		}
-		else {
-			xlog(LOG_U, "U2(). No elevator is needed since %d==%d. "
-			     "%s is stupid.\n",
-			     p->IN, p->OUT, p->name);
-			return;
-		}
+void sim_free(void)
+{
+	int i;
 
-		if ((D2 == 0) || (current_elevator_step == 0xE1)) {
-			D();
+	for (i = 0; i < sim->B.car_nr; i++) {
+		if (!sim->DP->shared) {
+			free(sim->B.cars[i].CALLUP);
+			free(sim->B.cars[i].CALLDOWN);
 		}
+		free(sim->B.cars[i].CALLCAR);
+		free(sim->B.cars[i].ELEVATOR);
 	}
-	U3(p);
+	free(sim->B.cars);
+	free(sim->B.QUEUE);
+	free(sim->B.CALLUP);
+	free(sim->B.CALLDOWN);
+	free(sim->B.zero);
+	free(sim->W.origin_cdf);
+	free(sim->W.dest_cdf);
+	free(sim->heap);
+	free(sim->cal.bucket);
+	metrics_free();
+	slab_destroy(&sim->WAIT_slab);
+	slab_destroy(&sim->USER_slab);
+	slab_destroy(&sim->user_info_slab);
 }
 
-/*
- * U3. [Enter queue.] Insert this user at the rear of QUEUE[IN], which is a linear
- *     list representing the people waiting on this floor. Now the user waits
- *     patiently for GIVEUPTIME units of time, unless the elevator arrives first --
- *     more precisely, unless step E4 of the elevator routine below sends this user
- *     to U5 and cancels the scheduled activity U4.
- */
-void U3(struct user_info * p)
+/****************************************************************************************************
+ * Replications. ``-R n'' runs n independent simulations of the random
+ * workload, with the seeds s, s+1, ..., s+n-1, on ``-j'' threads. Every
+ * thread runs one replication at a time in its own struct sim, and
+ * report_replications() merges the statistics of the replications: the
+ * mean over the replications, with its 95% confidence interval.
+ ****************************************************************************************************/
+struct replication {
+	long	users;
+	long	events;
+	double	sec;		/* wall-clock time of sim_run() */
+	double	wait_mean;	/* of the users who got in */
+	double	wait_p50;
+	double	wait_p95;
+	double	wait_p99;
+	double	abandon;	/* the rate of the users who gave up */
+	double	journey_mean;	/* of the users who got out, U1 to U6 */
+};
+
+struct replicator {
+	const struct workload *		workload;	/* of every replication */
+	const struct wait_backend *	backend;
+	const struct dispatch_policy *	policy;
+	int			floor_nr;
+	int			home;
+	int			car_nr;
+	const char *		od_file;
+	int			rep_nr;
+	int			next;		/* the next replication to run */
+	struct replication *	reps;		/* reps[rep_nr] */
+	double			sec;		/* wall-clock time of all */
+};
+
+/* the statistics of ``sim'', which has run */
+void replication_stats(struct replication * r)
 {
-	in_WAIT(p->ENTERTIME + p->GIVEUPTIME, U4, p);
-	in_QUEUE(p);
+	r->users     = sim->W.delivered + sim->W.gave_up;
+	r->events    = event_nr;
+	r->wait_mean = hdr_mean(&sim->M.wait);
+	r->wait_p50  = hdr_percentile(&sim->M.wait, 0.50);
+	r->wait_p95  = hdr_percentile(&sim->M.wait, 0.95);
+	r->wait_p99  = hdr_percentile(&sim->M.wait, 0.99);
+	r->abandon   = r->users ? (double)sim->W.gave_up / r->users : 0;
+	r->journey_mean = sim->W.delivered ? sim->W.journey_sum / sim->W.delivered : 0;
 }
 
-/*
- * U4. [Give up.] 
- */
-void U4(struct user_info * p)
+void * replication_worker(void * arg)
 {
-	xlog(LOG_U, "U4(). %s (%d->%d) gives up.\n", p->name, p->IN, p->OUT);
+	struct replicator * R = (struct replicator *)arg;
+	int i;
 
-	/* If FLOOR != IN or D1 == 0, delete this user from QUEUE[IN]
-	 * and from the simulated system. (The user has decided that the elevator is
-	 * too slow, or that a bit of exercise will be better than an elevator ride.)
-	 */
-	if ((FLOOR != p->IN) || (D1 == 0)) {
-		out_QUEUE(p->IN, p);
-	}
-	/* If FLOOR == IN and D1 != 0, the user stays and waits (knowing that the wait
-	 * won't be long).
-	 */
-	else {
-		assert((FLOOR == p->IN) && (D1 != 0));
-		xlog(LOG_U, "U4(). %s (%d->%d) changes his/her mind to stay and wait.\n",
-		     p->name, p->IN, p->OUT);
+	while ((i = __atomic_fetch_add(&R->next, 1, __ATOMIC_RELAXED)) < R->rep_nr) {
+		sim = (struct sim *)calloc(1, sizeof(struct sim));
+		assert(sim);
+		struct timespec t0;
+		struct timespec t1;
+
+		sim->W  = *R->workload;
+		sim->WQ = R->backend;
+		sim->DP = R->policy;
+		sim->W.rng += i;
+
+		sim_init(R->floor_nr, R->home, R->car_nr, R->od_file);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		sim_run();
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		replication_stats(&R->reps[i]);
+		R->reps[i].sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		sim_free();
+
+		free(sim);
+		sim = 0;
 	}
+	return 0;
 }
 
-/*
- * U5. [Get in.] 
- */
-void U5(struct user_info * p)
+/* t(0.975) of Student's t distribution with df degrees of freedom */
+double t975(int df)
 {
-	xlog(LOG_U, "U5(). %s (%d->%d) gets in the elevator. (FLOOR:%d)\n",
-	     p->name, p->IN, p->OUT, FLOOR);
+	static const double t[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (df <= sizeof(t) / sizeof(t[0]))
+		return t[df - 1];
+	return 1.96;	/* the normal approximation */
+}
 
-	/* This user now leaves QUEUE[IN] and enters ELEVATOR, which is
-	 * a stack-like list representing the people now on board the elevator. Set
-	 * CALLCAR[OUT] <-- 1.
-	 */
-	out_QUEUE(p->IN, p);
-	in_ELEVATOR(p);
+/** the mean over the replications of a statistic, x is the offset of a
+ *  double in struct replication; returns the half width of its 95%
+ *  confidence interval
+ */
+double stat_mean(const struct replicator * R, size_t x,
+		 double * mean, double * min, double * max)
+{
+	int n = R->rep_nr;
+	int i;
+	double sum = 0;
+	double sq = 0;
+
+	for (i = 0; i < n; i++) {
+		double v = *(const double *)((const char *)&R->reps[i] + x);
+		sum += v;
+		if (i == 0 || v < *min)
+			*min = v;
+		if (i == 0 || v > *max)
+			*max = v;
+	}
+	*mean = sum / n;
+	for (i = 0; i < n; i++) {
+		double v = *(const double *)((const char *)&R->reps[i] + x);
+		sq += (v - *mean) * (v - *mean);
+	}
+	return n > 1 ? t975(n - 1) * sqrt(sq / (n - 1) / n) : 0;
+}
 
-	CALLCAR[p->OUT] = 1;
+/* one line of report_replications() */
+void report_stat(const char * name, const struct replicator * R, size_t x)
+{
+	double mean;
+	double min;
+	double max;
+	double ci = stat_mean(R, x, &mean, &min, &max);
 
-	/*     Now if STATE == NEUTRAL, set STATE <-- GOINGUP or GOINGDOWN as
-	 * appropriate, and set the elevator's activity E5 to be executed after 25 units
-	 * of time. (This is a special feature of the elevator, allowing the doors to close
-	 * faster than usual if the elevator is in NEUTRAL state when the user selects a
-	 * destination floor. The 25-unit time interval gives step E4 the opportunity
-	 * to make sure that D1 is properly set up by the time step E5, the door-closing
-	 * action, occurs.)
-	 */
-	if (STATE == NEUTRAL) {
-		if (p->OUT > p->IN)
-			STATE = GOINGUP;
-		else if (p->OUT < p->IN)
-			STATE = GOINGDOWN;
-		else
-			assert(0);
+	printf("%-18s %12.4f %12.4f %12.4f %12.4f\n", name, mean, ci, min, max);
+}
 
-		xlog(LOG_U, "U5(). STATE: NEUTRAL --> %s\n", get_STATE_str());
+/* events per second of one thread, summed over the replications */
+double events_per_sec(const struct replicator * R)
+{
+	long events = 0;
+	double sec = 0;
+	int i;
 
-		out_WAIT(E5, 0);
-		in_WAIT(TIME + 25, E5, NO_ARG); /** when this E5 is excuted, U5's caller E4
-						 *  must have set D1 = 0, so that the door
-						 *  will be closed.
-						 */
+	for (i = 0; i < R->rep_nr; i++) {
+		events += R->reps[i].events;
+		sec    += R->reps[i].sec;
 	}
+	return sec > 0 ? events / sec : 0;
+}
 
-	/*     Now the user waits until being sent to step U6 by step E4 below, when
-	 * the elevator has reached the desired floor.
-	 */
-	/** ``waits'' means no source code */
+/* the statistics of the replications, a line each */
+void report_stats(const struct replicator * R)
+{
+	printf("%-18s %12s %12s %12s %12s\n",
+	       "", "mean", "+- 95% CI", "min", "max");
+	report_stat("wait (mean)",	R, offsetof(struct replication, wait_mean));
+	report_stat("wait (p50)",	R, offsetof(struct replication, wait_p50));
+	report_stat("wait (p95)",	R, offsetof(struct replication, wait_p95));
+	report_stat("wait (p99)",	R, offsetof(struct replication, wait_p99));
+	report_stat("abandonment rate",	R, offsetof(struct replication, abandon));
+	report_stat("journey (mean)",	R, offsetof(struct replication, journey_mean));
 }
 
-/*
- * U6. [Get out.] Delete this user from the ELEVATOR list and from the simulated
- *     system.  ▍
- */
-void U6(struct user_info * p)
+void report_replications(const struct replicator * R, int thread_nr)
 {
-	xlog(LOG_U, "U6(). %s (%d->%d) gets out of the elevator. (FLOOR:%d)\n",
-	     p->name, p->IN, p->OUT, FLOOR);
+	long events = 0;
+	int i;
 
-	out_ELEVATOR(p);
+	for (i = 0; i < R->rep_nr; i++)
+		events += R->reps[i].events;
 
-	/** if ``*p'' is allocated dynamically, it's the right time and place
-	 *  to free the memory.
-	 */
+	printf("%d replications of %ld users, %d floors, %d cars, policy %s, "
+	       "on %d threads.\n"
+	       "%ld events in %.3f s (%.0f events/s, %.0f events/s per thread).\n\n",
+	       R->rep_nr, R->workload->user_nr, R->floor_nr, R->car_nr,
+	       R->policy->name, thread_nr,
+	       events, R->sec, R->sec > 0 ? events / R->sec : 0, events_per_sec(R));
+	report_stats(R);
 }
 
-/****************************************************************************************************
- * Coroutine E (Elevator). This coroutine represents the actions of the elevator;
- * step E4 also handles the control of when people get in and out.
- ****************************************************************************************************/
-/*
- * E1. [Wait for call.] (At this point the elevator is sitting at floor 2 with the doors
- *     closed, waiting for something to happen.) If someone presses a button, the
- *     DECISION subroutine will take us to step E3 or E6. Meanwhile, wait.
+/** a line of the benchmark (``-B''): the quality of the policy in simulated
+ *  time, and its cost in wall-clock time
  */
-void E1(void)
+void report_benchmark(const struct replicator * R)
+{
+	double wait;
+	double wait_ci;
+	double p95;
+	double journey;
+	double abandon;
+	double abandon_ci;
+	double min;
+	double max;
+
+	wait_ci    = stat_mean(R, offsetof(struct replication, wait_mean),
+			       &wait, &min, &max);
+	stat_mean(R, offsetof(struct replication, wait_p95), &p95, &min, &max);
+	stat_mean(R, offsetof(struct replication, journey_mean),
+		  &journey, &min, &max);
+	abandon_ci = stat_mean(R, offsetof(struct replication, abandon),
+			       &abandon, &min, &max);
+
+	printf("%-12s %9.1f +- %-7.1f %9.0f %9.1f %7.4f +- %-7.4f %10.0f\n",
+	       R->policy->name, wait, wait_ci, p95, journey,
+	       abandon, abandon_ci, events_per_sec(R));
+}
+
+/* the replications of the workload, the backend and the policy of ``sim'' */
+void replicator_init(struct replicator * R, int rep_nr,
+		     int floor_nr, int home, int car_nr, const char * od_file)
+{
+	R->workload = &sim->W;
+	R->backend  = sim->WQ;
+	R->policy   = sim->DP;
+	R->floor_nr = floor_nr;
+	R->home     = home;
+	R->car_nr   = car_nr;
+	R->od_file  = od_file;
+	R->rep_nr   = rep_nr;
+	R->next     = 0;
+	R->reps     = (struct replication *)calloc(rep_nr, sizeof(struct replication));
+	assert(R->reps);
+}
+
+void run_replications(struct replicator * R, int thread_nr)
 {
+	pthread_t * threads;
+	struct timespec t0;
+	struct timespec t1;
 	int i;
-	int flag = 0;
 
-	xlog(LOG_E, "E1(). Elevator is waiting for call. (FLOOR:%d)\n", FLOOR);
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_nr);
+	assert(threads);
 
-	/* If someone presses a button, the
-	 * DECISION subroutine will take us to step E3 or E6. Meanwhile, wait. */
-	for (i = 0; i < FLOOR_NR; i++) {
-		flag |= CALLUP[i];
-		flag |= CALLDOWN[i];
+	R->next = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < thread_nr; i++) {
+		if (pthread_create(&threads[i], 0, replication_worker, R) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
 	}
+	for (i = 0; i < thread_nr; i++)
+		pthread_join(threads[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	R->sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
 
-	if (flag) {
-		D();
+	free(threads);
+}
+
+/** the benchmark (``-B''): every policy runs the same replications, i.e.
+ *  exactly the same users, since the workload does not depend on the policy
+ */
+void run_benchmark(int rep_nr, int thread_nr,
+		   int floor_nr, int home, int car_nr, const char * od_file)
+{
+	struct replicator R;
+	int k;
+
+	printf("%d replications of %ld users, %d floors, %d cars, on %d threads.\n\n",
+	       rep_nr, sim->W.user_nr, floor_nr, car_nr, thread_nr);
+	printf("%-12s %20s %9s %9s %19s %10s\n",
+	       "policy", "wait (95% CI)", "wait p95", "journey",
+	       "abandon (95% CI)", "events/s");
+	for (k = 0; k < sizeof(dispatch_policies)/sizeof(dispatch_policies[0]); k++) {
+		sim->DP = &dispatch_policies[k];
+		replicator_init(&R, rep_nr, floor_nr, home, car_nr, od_file);
+		run_replications(&R, thread_nr);
+		report_benchmark(&R);
+		free(R.reps);
 	}
-	else {
-		dormant = 1;
-		xlog(LOG_E, "E1(). Elevator dormant.\n");
+}
+
+/****************************************************************************************************
+ * Banks. ``-K k'' simulates a campus of k banks of elevators, which never
+ * interact: every bank has its own building, cars and users (``-n'' users
+ * each, with the seeds s, s+1, ..., s+k-1), so every bank is a struct sim
+ * of its own, and the WAIT lists of two banks have nothing to tell each
+ * other. Thread j of ``-j'' runs the banks j, j+threads, ..., see
+ * bank_worker().
+ *
+ * ``-K k:period'' observes the campus every period units of TIME: every
+ * thread runs its banks up to the observation and waits for the others at
+ * a barrier, where one of them writes a line of the merged statistics.
+ * Nothing else is synchronized, i.e. the lookahead is the whole period, and
+ * a bank never waits for another one in between.
+ ****************************************************************************************************/
+struct campus {
+	const struct workload *		workload;	/* of every bank */
+	const struct wait_backend *	backend;
+	const struct dispatch_policy *	policy;
+	int			floor_nr;
+	int			home;
+	int			car_nr;
+	const char *		od_file;
+	int			bank_nr;
+	int			thread_nr;
+	int			next;		/* the next thread to start */
+	long			period;		/* of the observations, 0 if none */
+	long			until;		/* the next observation */
+	int			running;	/* banks whose WAIT list is not empty */
+	struct sim **		banks;		/* banks[bank_nr] */
+	char *			done;		/* done[b]: the WAIT list of bank b is empty */
+	pthread_barrier_t	barrier;
+	struct hdr		wait;		/* of all the banks, see campus_stats() */
+	double			sec;
+};
+
+/* merges the statistics of the banks into r and C->wait */
+void campus_stats(struct campus * C, struct replication * r, long * in_system)
+{
+	long delivered = 0;
+	long gave_up = 0;
+	double journey_sum = 0;
+	struct sim * self = sim;
+	int b;
+
+	memset(r, 0, sizeof(*r));
+	memset(&C->wait, 0, sizeof(C->wait));
+	*in_system = 0;
+	for (b = 0; b < C->bank_nr; b++) {
+		sim = C->banks[b];
+		delivered   += sim->W.delivered;
+		gave_up     += sim->W.gave_up;
+		journey_sum += sim->W.journey_sum;
+		*in_system  += sim->W.in_system;
+		r->events   += event_nr;
+		hdr_merge(&C->wait, &sim->M.wait);
 	}
+	sim = self;
+	r->users     = delivered + gave_up;
+	r->wait_mean = hdr_mean(&C->wait);
+	r->wait_p50  = hdr_percentile(&C->wait, 0.50);
+	r->wait_p95  = hdr_percentile(&C->wait, 0.95);
+	r->wait_p99  = hdr_percentile(&C->wait, 0.99);
+	r->abandon   = r->users ? (double)gave_up / r->users : 0;
+	r->journey_mean = delivered ? journey_sum / delivered : 0;
 }
 
-/*
- * E2. [Change of state?] 
- */
-void E2(void)
+/* a line of the observations, at C->until */
+void campus_observe(struct campus * C)
 {
-	xlog(LOG_E, "E2(). Elevator stops.\n");
-	xlog(LOG_E, "E2(). STATE: %s --> ", get_STATE_str());
+	struct replication r;
+	long in_system;
 
-	int j;
-	/* If STATE == GOINGUP and
-	 * CALLUP[j] == CALLDOWN[j] == CALLCAR[j] == 0 for all j > FLOOR
-	 */
-	if (STATE == GOINGUP) {
-		int flag1 = 0;
-		for (j = MAX_FLOOR; j > FLOOR; j--)
-			if (CALLUP[j] || CALLDOWN[j] || CALLCAR[j])
-				flag1 = 1;
-		if (!flag1) {
-			/** !flag1 (i.e. flag1 == 0) means
-			 *         CALLUP[FLOOR..4]   ==
-			 *         CALLDOWN[FLOOR..4] ==
-			 *         CALLCAR[FLOOR..4]  == 0
-			 */
-			/** there's nobody upstairs */
-			int flag2 = 0; /* to avoid confusion, don't reuse flag1 */
-			for (j = MIN_FLOOR; j < FLOOR; j++)
-				if (CALLCAR[j])
-					flag2 = 1;
-			/** !flag2 (i.e. flag2 == 0) means
-			 *         CALLCAR[0..FLOOR] == 0
-			 */
-			/* then set STATE <-- NEUTRAL or STATE <-- GOINGDOWN,
-			 * according as CALLCAR[j] == 0 for all j < FLOOR or not,
-			 */
-			if (!flag2)
-				/** there's no person going down in the car */
-				STATE = NEUTRAL;
-			else
-				STATE = GOINGDOWN;
+	campus_stats(C, &r, &in_system);
+	printf("%10ld %10ld %10ld %10.1f %10.0f %10.0f %10.4f %12ld\n",
+	       C->until, in_system, r.users, r.wait_mean, r.wait_p50,
+	       r.wait_p95, r.abandon, r.events);
+}
 
-			/* and set all CALL variables for the current floor to zero. */
-			CALLUP[FLOOR]  = 0;
-			CALLDOWN[FLOOR]= 0;
-			CALLCAR[FLOOR] = 0;
+void * bank_worker(void * arg)
+{
+	struct campus * C = (struct campus *)arg;
+	int j = __atomic_fetch_add(&C->next, 1, __ATOMIC_RELAXED);
+	int b;
+
+	for (b = j; b < C->bank_nr; b += C->thread_nr) {
+		sim = (struct sim *)calloc(1, sizeof(struct sim));
+		assert(sim);
+		sim->W  = *C->workload;
+		sim->WQ = C->backend;
+		sim->DP = C->policy;
+		sim->W.rng += b;
+		sim_init(C->floor_nr, C->home, C->car_nr, C->od_file);
+		sim_start();
+		C->banks[b] = sim;
+	}
+	for (;;) {
+		/* up to the observation, the banks need nobody */
+		for (b = j; b < C->bank_nr; b += C->thread_nr) {
+			if (C->done[b])
+				continue;
+			sim = C->banks[b];
+			WAIT_NODE * w = sim_loop(C->until);
+			if (w)
+				again_WAIT(w);
+			else {
+				C->done[b] = 1;
+				__atomic_fetch_sub(&C->running, 1, __ATOMIC_RELAXED);
+			}
+		}
+		if (pthread_barrier_wait(&C->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			if (C->period && C->running)
+				campus_observe(C);
+			C->until = C->period ? C->until + C->period : LONG_MAX;
 		}
+		pthread_barrier_wait(&C->barrier);
+		if (C->running == 0)
+			break;
 	}
+	sim = 0;
+	return 0;
+}
 
-	/* If STATE == GOINGDOWN, do similar actions with directions reversed. */
-	if (STATE == GOINGDOWN) {
-		int flag1 = 0;
-		for (j = MIN_FLOOR; j < FLOOR; j++)
-			if (CALLUP[j] || CALLDOWN[j] || CALLCAR[j])
-				flag1 = 1;
-		/* xlog(LOG_E, "(%s)", flag1 ? "flag1" : ""); */
-		if (!flag1) {
-			/** !flag1 (i.e. flag1 == 0) means
-			 *         CALLUP[0..FLOOR]   ==
-			 *         CALLDOWN[0..FLOOR] ==
-			 *         CALLCAR[0..FLOOR]  == 0
-			 */
-			/** there's nobody downstairs */
-			int flag2 = 0; /* to avoid confusion, don't reuse flag1 */
-			for (j = MAX_FLOOR; j > FLOOR; j--)
-				if (CALLCAR[j])
-					flag2 = 1;
-			/* xlog(LOG_E, "(%s)", flag2 ? "flag2" : ""); */
-			/** !flag2 (i.e. flag2 == 0) means
-			 *         CALLCAR[FLOOR..4] == 0
-			 */
-			/* then set STATE <-- NEUTRAL or STATE <-- GOINGUP,
-			 * according as CALLCAR[j] == 0 for all j > FLOOR or not,
-			 */
-			if (!flag2)
-				/** there's no person going down in the car */
-				STATE = NEUTRAL;
-			else
-				STATE = GOINGUP;
+/* runs the banks on thread_nr threads, and writes their statistics */
+void run_campus(int bank_nr, long period, int thread_nr,
+		int floor_nr, int home, int car_nr, const char * od_file)
+{
+	struct campus C;
+	struct replication r;
+	struct timespec t0;
+	struct timespec t1;
+	pthread_t * threads;
+	long in_system;
+	int i;
 
-			/* and set all CALL variables for the current floor to zero. */
-			CALLUP[FLOOR]  = 0;
-			CALLDOWN[FLOOR]= 0;
-			CALLCAR[FLOOR] = 0;
+	if (thread_nr > bank_nr)
+		thread_nr = bank_nr;
+	memset(&C, 0, sizeof(C));
+	C.workload  = &sim->W;
+	C.backend   = sim->WQ;
+	C.policy    = sim->DP;
+	C.floor_nr  = floor_nr;
+	C.home      = home;
+	C.car_nr    = car_nr;
+	C.od_file   = od_file;
+	C.bank_nr   = bank_nr;
+	C.thread_nr = thread_nr;
+	C.period    = period;
+	C.until     = period ? period : LONG_MAX;
+	C.running   = bank_nr;
+	C.banks     = (struct sim **)calloc(bank_nr, sizeof(struct sim *));
+	C.done      = (char *)calloc(bank_nr, 1);
+	threads     = (pthread_t *)malloc(sizeof(pthread_t) * thread_nr);
+	assert(C.banks && C.done && threads);
+	pthread_barrier_init(&C.barrier, 0, thread_nr);
+
+	printf("%d banks of %ld users, %d floors, %d cars, policy %s, "
+	       "on %d threads.\n\n",
+	       bank_nr, sim->W.user_nr, floor_nr, car_nr, sim->DP->name, thread_nr);
+	if (period)
+		printf("%10s %10s %10s %10s %10s %10s %10s %12s\n",
+		       "TIME", "in system", "users", "wait", "wait p50",
+		       "wait p95", "abandon", "events");
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < thread_nr; i++) {
+		if (pthread_create(&threads[i], 0, bank_worker, &C) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
 		}
 	}
+	for (i = 0; i < thread_nr; i++)
+		pthread_join(threads[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	C.sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	campus_stats(&C, &r, &in_system);
+	printf("%s%ld users, %ld events in %.3f s (%.0f events/s).\n"
+	       "wait: mean %.1f, p50 %.0f, p95 %.0f, p99 %.0f.\n"
+	       "abandonment rate %.4f, journey (mean) %.1f.\n",
+	       period ? "\n" : "", r.users, r.events, C.sec,
+	       C.sec > 0 ? r.events / C.sec : 0,
+	       r.wait_mean, r.wait_p50, r.wait_p95, r.wait_p99,
+	       r.abandon, r.journey_mean);
+
+	for (i = 0; i < bank_nr; i++) {
+		sim = C.banks[i];
+		sim_free();
+		free(sim);
+	}
+	sim = &main_sim;
+	pthread_barrier_destroy(&C.barrier);
+	free(C.banks);
+	free(C.done);
+	free(threads);
+}
 
-	xlog(LOG_E, "%s.\n", get_STATE_str());
+/****************************************************************************************************
+ * Snapshots. ``-S T:file'' runs the simulation up to TIME T and writes its
+ * state to a file instead of going on: the building (the CALL bitsets, the
+ * cars with their D1/D2/D3), the users in the system (QUEUE[], ELEVATOR), the
+ * WAIT list, and the workload (the random number generator, or the position
+ * in the replay file). There is no pointer in a snapshot: a user is referred
+ * to by his/her id, a car by its id, and a coroutine by its enum coroutine_id.
+ *
+ * ``-L file'' maps a snapshot and goes on from where it stopped, so that a
+ * long warm-up period is simulated only once. Going on with the same seed
+ * gives exactly what the uninterrupted simulation would have given after
+ * TIME T, but the statistics start over at the snapshot. ``-F n'' forks n
+ * branches from the restored state (their pages are shared copy-on-write),
+ * with the seeds s, s+1, ..., s+n-1, where s is the seed in the snapshot
+ * unless ``-s'' is given; ``-r'' and ``-g'' change the workload of the
+ * branches, too.
+ ****************************************************************************************************/
+struct snap_head {
+	uint32_t	magic;		/* SNAP_MAGIC */
+	uint32_t	version;	/* SNAP_VERSION */
+	int32_t		floor_nr;
+	int32_t		home;
+	int32_t		car_nr;
+	int32_t		word_nr;
+	char		policy[16];	/* dispatch_policy.name */
+	int64_t		time;		/* TIME, -1 if nothing has been executed */
+	uint32_t	seq;		/* wait_seq */
+	int32_t		replay;		/* 1 if the users are from ``-i'' */
+	int64_t		user_nr;
+	int64_t		generated;
+	int64_t		next_time;
+	uint64_t	rng;
+	double		intertime;
+	double		giveup_a;
+	double		giveup_b;
+	int32_t		giveup;		/* enum giveup_dist */
+	int32_t		table_pos;
+	int64_t		replay_pos;
+	int64_t		replay_line;
+	int64_t		snap_user_nr;	/* struct snap_user records */
+	int64_t		snap_node_nr;	/* struct snap_node records */
+};
 
-	in_WAIT(TIME, E3, NO_ARG);			/** open doors */
-}
+struct snap_car {
+	int32_t		STATE;
+	int32_t		FLOOR;
+	int32_t		D1;
+	int32_t		D2;
+	int32_t		D3;
+	int32_t		step;		/* current_elevator_step */
+	int32_t		dormant;
+	int32_t		pad;
+};
 
-/*
- * E3. [Open doors.] Set D1 and D2 to any nonzero values. Set elevator activity
- *     E9 to start up independently after 300 units of time. (This activity may be
- *     canceled in step E6 below before it occurs. If it has already been scheduled
- *     and not canceled, we cancel it and reschedule it.) Also set elevator activity
- *     E5 to start up independently after 76 units of time. Then wait 20 units of
- *     time (to simulate opening of the doors) and go to E4.
- */
-void E3(void)
-{
-	xlog(LOG_E, "E3(). Open doors.\n");
+struct snap_user {
+	int64_t		id;
+	int64_t		ENTERTIME;
+	int64_t		BOARDTIME;
+	int32_t		IN;
+	int32_t		OUT;
+	int32_t		GIVEUPTIME;
+	int32_t		car;		/* reserved car, -1 if none */
+	int32_t		queue;		/* in QUEUE[queue], or -1 */
+	int32_t		in_car;		/* in the ELEVATOR of this car, or -1 */
+};
 
-	D1 = 1;
-	D2 = 1;
-	if (dormant) {
-		dormant = 0;
-		xlog(LOG_E, "E3(). Elevator no more dormant.\n");
-	}
+struct snap_node {
+	int64_t		ent_time;
+	uint32_t	seq;
+	int16_t		inst;		/* enum coroutine_id */
+	int16_t		car;		/* -1 for user actions */
+	int64_t		user;		/* id, 0 for elevator actions */
+};
+
+/* a user of a snapshot being restored */
+struct snap_ref {
+	long			id;
+	struct user_info *	p;
+	int			queued;		/* in QUEUE[], waiting for its U4 only */
+	int			riding;		/* in an ELEVATOR, with no node */
+	int			nodes;		/* its nodes in the WAIT list, at most 1 */
+};
 
-	in_WAIT(TIME + 20, E4, NO_ARG); /** let people out, in */
-	in_WAIT(TIME + 76, E5, NO_ARG); /** close doors */
-	out_WAIT(E9, 0);		/** cancel E9 if it has been scheduled */
-	in_WAIT(TIME + 300, E9, NO_ARG); /** set inaction indicator */
+void snap_user_rec(struct snap_user * u, const struct user_info * p,
+		   int queue, int in_car)
+{
+	u->id         = p->id;
+	u->ENTERTIME  = p->ENTERTIME;
+	u->BOARDTIME  = p->BOARDTIME;
+	u->IN         = p->IN;
+	u->OUT        = p->OUT;
+	u->GIVEUPTIME = p->GIVEUPTIME;
+	u->car        = p->car ? p->car->id : -1;
+	u->queue      = queue;
+	u->in_car     = in_car;
 }
 
-/*
- * E4. [Let people out, in.] If anyone in the ELEVATOR list has OUT == FLOOR, send
- *     the user of this type who has most recently entered immediately to step U6,
- *     wait 25 units, and repeat step E4. If no such users exist, but QUEUE[FLOOR]
- *     is not empty, send the front person of that queue immediately to step U5
- *     instead of U4, wait 25 units, and repeat step E4. But if QUEUE[FLOOR]
- *     is empty, set D1 <-- 0, make D3 nonzero, and wait for some other activity
- *     to initiate further action. (Step E5 will send us to E6, or step U2 will
- *     restart E4.)
+/** writes the state of ``sim'' to filename. next is what sim_loop() has
+ *  returned; the WAIT list is emptied.
  */
-void E4(void)
-{
-	USER_NODE * p = ELEVATOR.ER;
-	for (; p != &ELEVATOR; p = p->ER) {
-		int out = p->uinfo->OUT;
-		if (out == FLOOR) {
-			xlog(LOG_E, "E4(). %s is sent to U6().\n",
-			     p->uinfo->name);
-			U6(p->uinfo);
-			in_WAIT(TIME + 25, E4, NO_ARG); /** empty the elevator */
-			return;
+void snapshot_write(const char * filename, WAIT_NODE * next)
+{
+	struct snap_head h;
+	struct snap_user * su;
+	struct snap_node * sn;
+	WAIT_NODE * w;
+	USER_NODE * q;
+	long user_nr = 0;
+	long node_nr = 0;
+	long user_max = sim->W.in_system;
+	long node_max = 64;
+	int i, j;
+	FILE * fp;
+
+	su = (struct snap_user *)malloc(sizeof(*su) * (user_max + 1));
+	sn = (struct snap_node *)malloc(sizeof(*sn) * node_max);
+	assert(su && sn);
+
+	/* the users in QUEUE[] and ELEVATOR, in their order */
+	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++)
+		for (q = sim->B.QUEUE[i].QR; q != &sim->B.QUEUE[i]; q = q->QR)
+			snap_user_rec(&su[user_nr++], q->uinfo, i, -1);
+	for (i = 0; i < sim->B.car_nr; i++)
+		for (j = MIN_FLOOR; j <= MAX_FLOOR; j++)
+			for (q = sim->B.cars[i].ELEVATOR[j].ER;
+			     q != &sim->B.cars[i].ELEVATOR[j]; q = q->ER)
+				snap_user_rec(&su[user_nr++], q->uinfo, -1, i);
+
+	/* the WAIT list, and the users who are only there (i.e. in U1) */
+	for (w = next; w; w = next_WAIT()) {
+		if (node_nr == node_max) {
+			node_max *= 2;
+			sn = (struct snap_node *)realloc(sn, sizeof(*sn) * node_max);
+			assert(sn);
+		}
+		sn[node_nr].ent_time = w->ent_time;
+		sn[node_nr].seq  = w->seq;
+		sn[node_nr].inst = w->inst;
+		sn[node_nr].car  = w->car ? w->car->id : -1;
+		sn[node_nr].user = w->arg ? w->arg->id : 0;
+		node_nr++;
+		if (w->arg && w->arg->node == 0) {
+			assert(user_nr < user_max);
+			snap_user_rec(&su[user_nr++], w->arg, -1, -1);
 		}
+		free_WAIT_node(w);
 	}
-
-	p = QUEUE[FLOOR].ER;
-	if (p != &QUEUE[FLOOR]) { /** QUEUE[FLOOR] is not empty */
-		xlog(LOG_E, "E4(). %s is sent to U5().\n",
-		     p->uinfo->name);
-		out_WAIT(U4, p->uinfo);	     /** fortunately the elevator comes */
-
-		/** the sequence of these two lines cannot be exchanged, because
-		 *  it should be guarranteed that ``E5'' in this line (called in U5):
-		 *      in_WAIT(TIME + 25, E5, NO_ARG);
-		 *  should be scheduled after ``E4'' of in the following in_WAIT():
-		 */
-		in_WAIT(TIME + 25, E4, NO_ARG); /** fill the elevator */
-		U5(p->uinfo);
+	assert(user_nr == sim->W.in_system);
+
+	memset(&h, 0, sizeof(h));
+	h.magic    = SNAP_MAGIC;
+	h.version  = SNAP_VERSION;
+	h.floor_nr = sim->B.floor_nr;
+	h.home     = sim->B.home;
+	h.car_nr   = sim->B.car_nr;
+	h.word_nr  = sim->B.word_nr;
+	strncpy(h.policy, sim->DP->name, sizeof(h.policy) - 1);
+	h.time     = current_step ? TIME : -1;
+	h.seq      = wait_seq;
+	h.replay   = sim->W.replay_file != 0;
+	h.user_nr  = sim->W.user_nr;
+	h.generated = sim->W.generated;
+	h.next_time = sim->W.next_time;
+	h.rng      = sim->W.rng;
+	h.intertime = sim->W.intertime;
+	h.giveup_a = sim->W.giveup_a;
+	h.giveup_b = sim->W.giveup_b;
+	h.giveup   = sim->W.giveup;
+	h.table_pos = sim->W.table_pos;
+	h.replay_pos  = sim->W.replay_pos;
+	h.replay_line = sim->W.replay_line;
+	h.snap_user_nr = user_nr;
+	h.snap_node_nr = node_nr;
+
+	fp = fopen(filename, "wb");
+	if (!fp) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	else {
-		D1 = 0;
-		D3 = 1;
-		xlog(LOG_E, "E4(). Nobody is here. "
-		     "wait for some other activity to initiate further action\n");
-		return;
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(sim->B.CALLUP, sizeof(uint64_t), sim->B.word_nr, fp);
+	fwrite(sim->B.CALLDOWN, sizeof(uint64_t), sim->B.word_nr, fp);
+	for (i = 0; i < sim->B.car_nr; i++) {
+		struct car * c = &sim->B.cars[i];
+		struct snap_car sc = {c->STATE, c->FLOOR, c->D1, c->D2, c->D3,
+				      c->current_elevator_step, c->dormant, 0};
+		fwrite(&sc, sizeof(sc), 1, fp);
+		if (!sim->DP->shared) {
+			fwrite(c->CALLUP, sizeof(uint64_t), sim->B.word_nr, fp);
+			fwrite(c->CALLDOWN, sizeof(uint64_t), sim->B.word_nr, fp);
+		}
+		fwrite(c->CALLCAR, sizeof(uint64_t), sim->B.word_nr, fp);
+	}
+	if (sim->W.user_nr) {
+		fwrite(sim->W.origin_cdf, sizeof(double), sim->B.floor_nr, fp);
+		fwrite(sim->W.dest_cdf, sizeof(double), sim->B.floor_nr * sim->B.floor_nr, fp);
 	}
+	fwrite(su, sizeof(*su), user_nr, fp);
+	fwrite(sn, sizeof(*sn), node_nr, fp);
+	long size = ftell(fp);
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "snapshot at TIME %ld: %ld users, %ld nodes, %ld bytes.\n",
+		(long)h.time, user_nr, node_nr, size);
+	free(su);
+	free(sn);
 }
 
-/*
- * E5. [Close doors.] If D1 != 0, wait 40 units and repeat this step (the doors flutter
- *     a little, but they spring open again, since someone is still getting out or in).
- *     Otherwise set D3 <-- 0 and set the elevator to start at step E6 after 20 units
- *     of time. (This simulates closing the doors after people have finished getting
- *     in or out; but if a new user enters on this floor while the doors are closing,
- *     they will open again as stated in step U2.)
- */
-void E5(void)
+/* copies n bytes of the snapshot at *pos to dst */
+void snap_get(void * dst, size_t n, const char * m, size_t size, size_t * pos,
+	      const char * filename)
 {
-	if (D1) {
-		xlog(LOG_E, "E5(). Doors flutter.\n");
-		in_WAIT(TIME + 40, E5, NO_ARG); /** close the door later */
-		return;
+	if (*pos + n > size) {
+		fprintf(stderr, "%s: truncated\n", filename);
+		exit(EXIT_FAILURE);
 	}
-	D3 = 0;
-	in_WAIT(TIME + 20, E6, NO_ARG); /** prepare to move */
+	memcpy(dst, m + *pos, n);
+	*pos += n;
+}
 
-	xlog(LOG_E, "E5(). Doors closed.\n");
+void snap_corrupt(const char * filename)
+{
+	fprintf(stderr, "%s: corrupt snapshot\n", filename);
+	exit(EXIT_FAILURE);
 }
 
-/*
- * E6. [Prepare to move.] Set CALLCAR[FLOOR] to zero; also set CALLUP[FLOOR]
- *     to zero if STATE != GOINGDOWN, and also set CALLDOWN[FLOOR] to zero if
- *     STATE != GOINGUP. (Note: If STATE == GOINGUP, the elevator does not clear
- *     out CALLDOWN, since it assumes that people who are going down will not
- *     have entered; but see exercise 6.) Now perform the DECISION subroutine.
- *         If STATE == NEUTRAL even after the DECISION subroutine has acted, go
- *     to E1. Otherwise, if D2 != 0, cancel the elevator activity E9. Finally, if
- *     STATE == GOINGUP, wait 15 units of time (for the elevator to build up speed)
- *     and go to E7; if STATE == GOINGDOWN, wait 15 units and go to E8.
- */
-void E6(void)
+/* exits unless lo <= x < hi, for every index read from a snapshot */
+void snap_check(int64_t x, int64_t lo, int64_t hi, const char * filename)
 {
-	xlog(LOG_E, "E6(). Prepare to move.\n");
+	if (x < lo || x >= hi)
+		snap_corrupt(filename);
+}
 
-	if (dormant) {
-		dormant = 0;
-		xlog(LOG_E, "E6(). Elevator no more dormant.\n");
-	}
+/* exits if a bitset read from a snapshot has a floor above MAX_FLOOR */
+void snap_check_bits(const uint64_t * s, const char * filename)
+{
+	if (sim->B.floor_nr % BS_BITS &&
+	    s[sim->B.word_nr - 1] >> (sim->B.floor_nr % BS_BITS))
+		snap_corrupt(filename);
+}
 
-	CALLCAR[FLOOR] = 0;
-	if (STATE != GOINGDOWN)
-		CALLUP[FLOOR] = 0;
-	if (STATE != GOINGUP)
-		CALLDOWN[FLOOR] = 0;
+int cmp_snap_ref(const void * a, const void * b)
+{
+	long x = ((const struct snap_ref *)a)->id;
+	long y = ((const struct snap_ref *)b)->id;
+	return (x > y) - (x < y);
+}
 
-	D();
+/** restores ``sim'' from a snapshot, instead of sim_init() and sim_start().
+ *  WQ must be set, and the replay file opened if the snapshot has one; the
+ *  policy and the building are those of the snapshot.
+ */
+void snapshot_load(const char * filename)
+{
+	struct snap_head h;
+	struct snap_ref * refs;
+	struct stat st;
+	const char * m;
+	size_t pos = 0;
+	size_t size;
+	long i;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	m = (const char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
 
-	if (STATE == NEUTRAL) {
-		in_WAIT(TIME, E1, NO_ARG); /** wait for call */
-		return;
+	snap_get(&h, sizeof(h), m, st.st_size, &pos, filename);
+	if (h.magic != SNAP_MAGIC || h.version != SNAP_VERSION) {
+		fprintf(stderr, "%s: not a snapshot of this program\n", filename);
+		exit(EXIT_FAILURE);
 	}
-	else {
-		if (D2) {
-			out_WAIT(E9, 0); /** cancel E9 */
-			xlog(LOG_E, "E6(). cancelled E9()\n");
+	if (h.replay != (sim->W.replay_file != 0)) {
+		fprintf(stderr, "%s: %s\n", filename, h.replay ?
+			"the users are from a replay file, give it with -i" :
+			"the users are not from a replay file");
+		exit(EXIT_FAILURE);
+	}
+	sim->DP = 0;
+	for (i = 0; i < sizeof(dispatch_policies)/sizeof(dispatch_policies[0]); i++)
+		if (strcmp(h.policy, dispatch_policies[i].name) == 0)
+			sim->DP = &dispatch_policies[i];
+	if (!sim->DP)
+		snap_corrupt(filename);
+	snap_check(h.floor_nr, 2, 4 * st.st_size, filename);
+	snap_check(h.home, 0, h.floor_nr, filename);
+	snap_check(h.car_nr, 1, st.st_size / sizeof(struct snap_car), filename);
+	snap_check(h.giveup, GIVEUP_FIXED, GIVEUP_EXP + 1, filename);
+	snap_check(h.table_pos, 0, sizeof(users) / sizeof(users[0]), filename);
+	snap_check(h.snap_user_nr, 0, st.st_size / sizeof(struct snap_user) + 1, filename);
+	snap_check(h.snap_node_nr, 0, st.st_size / sizeof(struct snap_node) + 1, filename);
+	if (h.word_nr != ((int64_t)h.floor_nr + BS_BITS - 1) / BS_BITS ||
+	    (h.user_nr && (uint64_t)h.floor_nr * ((uint64_t)h.floor_nr + 1) >
+			  st.st_size / sizeof(double)))
+		snap_corrupt(filename);
+
+	/* the header says how long the rest is */
+	size = sizeof(h) + sizeof(uint64_t) * 2 * h.word_nr +
+	       h.car_nr * (sizeof(struct snap_car) +
+			   sizeof(uint64_t) * h.word_nr * (sim->DP->shared ? 1 : 3)) +
+	       sizeof(struct snap_user) * h.snap_user_nr +
+	       sizeof(struct snap_node) * h.snap_node_nr;
+	if (h.user_nr)
+		size += sizeof(double) * h.floor_nr * ((size_t)h.floor_nr + 1);
+	if (size != st.st_size)
+		snap_corrupt(filename);
+
+	sim->W.user_nr   = h.user_nr;
+	sim->W.generated = h.generated;
+	sim->W.next_time = h.next_time;
+	sim->W.rng       = h.rng;
+	sim->W.intertime = h.intertime;
+	sim->W.giveup_a  = h.giveup_a;
+	sim->W.giveup_b  = h.giveup_b;
+	sim->W.giveup    = (enum giveup_dist)h.giveup;
+	sim->W.table_pos = h.table_pos;
+	if (h.replay) {
+		sim->W.replay_pos  = h.replay_pos;
+		sim->W.replay_line = h.replay_line;
+	}
+
+	slab_init(&sim->WAIT_slab, "WAIT_NODE", sizeof(WAIT_NODE));
+	slab_init(&sim->USER_slab, "USER_NODE", sizeof(USER_NODE));
+	slab_init(&sim->user_info_slab, "user_info", sizeof(struct user_info));
+	building_init(h.floor_nr, h.home, h.car_nr);
+	metrics_init(h.time >= 0 ? h.time : 0);
+	sim->WQ->init();
+
+	snap_get(sim->B.CALLUP, sizeof(uint64_t) * sim->B.word_nr, m, st.st_size, &pos, filename);
+	snap_get(sim->B.CALLDOWN, sizeof(uint64_t) * sim->B.word_nr, m, st.st_size, &pos, filename);
+	snap_check_bits(sim->B.CALLUP, filename);
+	snap_check_bits(sim->B.CALLDOWN, filename);
+	for (i = 0; i < sim->B.car_nr; i++) {
+		struct car * c = &sim->B.cars[i];
+		struct snap_car sc;
+		snap_get(&sc, sizeof(sc), m, st.st_size, &pos, filename);
+		snap_check(sc.STATE, NEUTRAL, GOINGDOWN + 1, filename);
+		snap_check(sc.FLOOR, MIN_FLOOR, MAX_FLOOR + 1, filename);
+		c->STATE   = (enum elevator_state)sc.STATE;
+		c->FLOOR   = sc.FLOOR;
+		c->D1      = sc.D1;
+		c->D2      = sc.D2;
+		c->D3      = sc.D3;
+		c->current_elevator_step = sc.step;
+		c->dormant = sc.dormant;
+		if (!sim->DP->shared) {
+			snap_get(c->CALLUP, sizeof(uint64_t) * sim->B.word_nr,
+				 m, st.st_size, &pos, filename);
+			snap_get(c->CALLDOWN, sizeof(uint64_t) * sim->B.word_nr,
+				 m, st.st_size, &pos, filename);
 		}
+		snap_get(c->CALLCAR, sizeof(uint64_t) * sim->B.word_nr,
+			 m, st.st_size, &pos, filename);
+		snap_check_bits(c->CALLUP, filename);
+		snap_check_bits(c->CALLDOWN, filename);
+		snap_check_bits(c->CALLCAR, filename);
+	}
+	if (sim->W.user_nr) {
+		int n = sim->B.floor_nr;
+		sim->W.origin_cdf = (double *)malloc(sizeof(double) * n);
+		sim->W.dest_cdf   = (double *)malloc(sizeof(double) * n * n);
+		assert(sim->W.origin_cdf && sim->W.dest_cdf);
+		snap_get(sim->W.origin_cdf, sizeof(double) * n, m, st.st_size, &pos, filename);
+		snap_get(sim->W.dest_cdf, sizeof(double) * n * n, m, st.st_size, &pos, filename);
 	}
 
-	if (STATE == GOINGUP) {
-		in_WAIT(TIME + 15, E7, NO_ARG); /** go up a floor */
-	} else if (STATE == GOINGDOWN) {
-		in_WAIT(TIME + 15, E8, NO_ARG); /** go down a floor */
-	} else {
-		assert(0);
+	/* the users, appended to QUEUE[] and ELEVATOR in their order */
+	refs = (struct snap_ref *)malloc(sizeof(*refs) * (h.snap_user_nr + 1));
+	assert(refs);
+	for (i = 0; i < h.snap_user_nr; i++) {
+		struct snap_user u;
+		struct user_info * p;
+		snap_get(&u, sizeof(u), m, st.st_size, &pos, filename);
+		snap_check(u.IN, MIN_FLOOR, MAX_FLOOR + 1, filename);
+		snap_check(u.OUT, MIN_FLOOR, MAX_FLOOR + 1, filename);
+		snap_check(u.car, -1, sim->B.car_nr, filename);
+		snap_check(u.queue, -1, MAX_FLOOR + 1, filename);
+		snap_check(u.in_car, -1, sim->B.car_nr, filename);
+		snap_check(u.ENTERTIME, 0, INT64_MAX, filename);
+		snap_check(u.BOARDTIME, 0, INT64_MAX, filename);
+		snap_check(u.GIVEUPTIME, 0, INT_MAX, filename);
+		if (sim->W.user_nr == 0 && !h.replay) {
+			/* the users of users[] that are in the system were taken before table_pos */
+			snap_check(u.id, 1, h.table_pos + 1, filename);
+			p = &users[u.id - 1];
+			p->generated = 0;
+		}
+		else {
+			p = (struct user_info *)slab_alloc(&sim->user_info_slab);
+			snprintf(p->name, sizeof(p->name), "User %ld", (long)u.id);
+			p->generated = 1;
+		}
+		p->id         = u.id;
+		p->ENTERTIME  = u.ENTERTIME;
+		p->BOARDTIME  = u.BOARDTIME;
+		p->IN         = u.IN;
+		p->OUT        = u.OUT;
+		p->GIVEUPTIME = u.GIVEUPTIME;
+		p->car        = u.car >= 0 ? &sim->B.cars[u.car] : NO_CAR;
+		p->giveup     = 0;
+		p->node       = 0;
+		if (u.queue >= 0) {
+			USER_NODE * q = alloc_USER_node();
+			q->uinfo = p;
+			p->node  = q;
+			q->QL = sim->B.QUEUE[u.queue].QL;
+			q->QR = &sim->B.QUEUE[u.queue];
+			sim->B.QUEUE[u.queue].QL->QR = q;
+			sim->B.QUEUE[u.queue].QL = q;
+			sim->B.queued++;
+			if (++sim->M.queue_len[u.queue] > sim->M.queue_max[u.queue])
+				sim->M.queue_max[u.queue] = sim->M.queue_len[u.queue];
+		}
+		else if (u.in_car >= 0) {
+			in_ELEVATOR(&sim->B.cars[u.in_car], p);
+		}
+		refs[i].id = u.id;
+		refs[i].p  = p;
+		refs[i].queued = u.queue >= 0;
+		refs[i].riding = u.queue < 0 && u.in_car >= 0;
+		refs[i].nodes  = 0;
+	}
+	qsort(refs, h.snap_user_nr, sizeof(*refs), cmp_snap_ref);
+
+	/* the WAIT list, with the handles of in_WAIT() */
+	for (i = 0; i < h.snap_node_nr; i++) {
+		struct snap_node sn;
+		WAIT_NODE * w = alloc_WAIT_node();
+		snap_get(&sn, sizeof(sn), m, st.st_size, &pos, filename);
+		snap_check(sn.inst, CO_NONE + 1, COROUTINE_NR, filename);
+		snap_check(sn.car, sn.user ? -1 : 0, sn.user ? 0 : sim->B.car_nr, filename);
+		snap_check(sn.ent_time, h.time, INT64_MAX, filename);
+		if (sn.user ? !coroutines[sn.inst].fu : !coroutines[sn.inst].fe)
+			snap_corrupt(filename);
+		w->ent_time = sn.ent_time;
+		w->seq  = sn.seq;
+		w->inst = (enum coroutine_id)sn.inst;
+		w->car  = sn.car >= 0 ? &sim->B.cars[sn.car] : NO_CAR;
+		w->arg  = NO_ARG;
+		if (sn.user) {
+			struct snap_ref key = {sn.user, 0};
+			struct snap_ref * r = (struct snap_ref *)
+				bsearch(&key, refs, h.snap_user_nr, sizeof(*refs),
+					cmp_snap_ref);
+			if (!r || ++r->nodes > 1 || r->riding ||
+			    r->queued != (w->inst == CO_U4))
+				snap_corrupt(filename);
+			w->arg = r->p;
+		}
+		/* the handles that again_WAIT() sets are one per node */
+		if (w->car != NO_CAR ?
+		    w->car->agenda_nr == AGENDA_SIZE || pending(w->car, w->inst) :
+		    w->inst == CO_U1 && sim->arrival != 0)
+			snap_corrupt(filename);
+		again_WAIT(w);
+	}
+	free(refs);
+	munmap((void *)m, st.st_size);
+
+	wait_seq = h.seq;
+	if (h.time >= 0) {
+		current_step = alloc_WAIT_node();
+		current_step->ent_time = h.time;
+		current_step->inst = CO_NONE;
+		current_step->car  = NO_CAR;
+		current_step->arg  = NO_ARG;
 	}
+	sim->W.in_system = sim->W.max_in_system = h.snap_user_nr;
 }
 
-/*
- * E7. [Go up a floor.] Set FLOOR <-- FLOOR + 1 and wait 51 units of time. If
- *     now CALLCAR[FLOOR] == 1 or CALLUP[FLOOR] == 1, or
- *     if ((FLOOR == 2 or CALLDOWN[FLOOR] == 1) and
- *         CALLUP[j] == CALLDOWN[j] == CALLCAR[j] == 0 for all j > FLOOR),
- *     wait 14 units (for deceleration) and go to E2. Otherwise,
- *     repeat this step.
+/** ``-F n'': n branches of the restored ``sim'', each in a child process,
+ *  at most thread_nr at a time. the children write their statistics to
+ *  R->reps, which is shared with them.
  */
-void E7A(void)
+void run_branches(struct replicator * R, int thread_nr)
 {
-	int j;
-	int all_zero = 1;
-	for (j = MAX_FLOOR; j > FLOOR; j--) {
-		if (CALLUP[j] || CALLDOWN[j] || CALLCAR[j]) {
-			all_zero = 0;
-			break;
+	struct timespec t0;
+	struct timespec t1;
+	uint64_t rng = sim->W.rng;
+	int running = 0;
+	int i;
+
+	R->reps = (struct replication *)mmap(0, sizeof(struct replication) * R->rep_nr,
+					     PROT_READ | PROT_WRITE,
+					     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(R->reps != MAP_FAILED);
+
+	fflush(stdout);
+	fflush(stderr);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < R->rep_nr; i++) {
+		if (running == thread_nr) {
+			int status;
+			wait(&status);
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+				fprintf(stderr, "a branch has failed\n");
+				exit(EXIT_FAILURE);
+			}
+			running--;
 		}
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "cannot fork branch %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			struct timespec b0;
+			struct timespec b1;
+			sim->W.rng = rng + i;
+			clock_gettime(CLOCK_MONOTONIC, &b0);
+			sim_loop(LONG_MAX);
+			clock_gettime(CLOCK_MONOTONIC, &b1);
+			replication_stats(&R->reps[i]);
+			R->reps[i].sec = (b1.tv_sec - b0.tv_sec) +
+				(b1.tv_nsec - b0.tv_nsec) / 1e9;
+			_exit(EXIT_SUCCESS);
+		}
+		running++;
 	}
-	if (CALLCAR[FLOOR] || CALLUP[FLOOR] ||
-	    ((FLOOR == 2 || CALLDOWN[FLOOR]) && all_zero)) {
-		xlog(LOG_E,
-		     "E7A(). "
-		     "FLOOR:%d. CALLCAR[%d]:%d. "
-		     "CALLUP[%d]:%d. CALLDOWN[%d]:%d. "
-		     "CALLUP[0..4]:%d,%d,%d,%d,%d. "
-		     "CALLDOWN[0..4]:%d,%d,%d,%d,%d."
-		     "CALLCAR[0..4]:%d,%d,%d,%d,%d.\n",
-		     FLOOR, FLOOR, CALLCAR[FLOOR],
-		     FLOOR, CALLUP[FLOOR], FLOOR, CALLDOWN[FLOOR],
-		     CALLUP[0], CALLUP[1], CALLUP[2], CALLUP[3], CALLUP[4],
-		     CALLDOWN[0], CALLDOWN[1], CALLDOWN[2], CALLDOWN[3], CALLDOWN[4],
-		     CALLCAR[0], CALLCAR[1], CALLCAR[2], CALLCAR[3], CALLCAR[4]);
-
-		in_WAIT(TIME + 14, E2, NO_ARG); /** change state */
-		return;
-	}
-	else {
-		E7();		/** repeat E7 */
+	while (running--) {
+		int status;
+		wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "a branch has failed\n");
+			exit(EXIT_FAILURE);
+		}
 	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	R->sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
 }
-void E7(void)
-{
-	FLOOR++;
-	assert(FLOOR <= MAX_FLOOR);
 
-	xlog(LOG_E, "E7(). Elevator goes up a floor. (%d->%d)\n", FLOOR-1, FLOOR);
+/****************************************************************************************************
+ * Comparing backends (``-C backend''). All the backends must execute the
+ * WAIT list in the order of the doubly linked list of the book (see
+ * wait_before()). compare_backends() forks the simulation twice, once with
+ * ``list'' and once with ``backend''. Each child writes every node it
+ * executes to a pipe, and the parent reads the two pipes side by side. It
+ * stops at the first node where they differ.
+ *
+ * The nodes are compared instead of the log files, so a run of millions of
+ * users needs no log: what a step logs follows from the nodes executed up
+ * to it.
+ ****************************************************************************************************/
+struct compare_rec {
+	long		ent_time;
+	unsigned int	seq;
+	int		inst;
+	int		car;	/* -1 for a user action */
+	long		user;	/* ``User <id>'', 0 for an elevator action */
+};
 
-	in_WAIT(TIME + 51, E7A, NO_ARG); /** wait 51 units of time */
+void compare_write(const WAIT_NODE * w)
+{
+	struct compare_rec r;
+
+	memset(&r, 0, sizeof(r));	/* the padding is compared too */
+	r.ent_time = w->ent_time;
+	r.seq  = w->seq;
+	r.inst = w->inst;
+	r.car  = w->car != NO_CAR ? w->car->id : -1;
+	r.user = w->arg != NO_ARG ? w->arg->id : 0;
+	fwrite(&r, sizeof(r), 1, compare_out);
 }
 
-/*
- * E8. [Go down a floor.] This step is like E7 with directions reversed, and also
- *     the times 51 and 14 are changed to 61 and 23, respectively. (It takes the
- *     elevator longer to go down than up.)
- */
-void E8A(void)
+void compare_print(const char * name, const struct compare_rec * r)
 {
-	int j;
-	int all_zero = 1;
-	for (j = MIN_FLOOR; j < FLOOR; j++) {
-		if (CALLUP[j] || CALLDOWN[j] || CALLCAR[j]) {
-			/** the car need not go downstairs anymore
-			 *  because nobody's there and nobody's getting there
-			 */
-			all_zero = 0;
-			break;
-		}
-	}
-	xlog(LOG_E,
-	     "E8A(). "
-	     "FLOOR:%d. CALLCAR[%d]:%d. "
-	     "CALLUP[%d]:%d. CALLDOWN[%d]:%d. "
-	     "CALLUP[0..4]:%d,%d,%d,%d,%d. "
-	     "CALLDOWN[0..4]:%d,%d,%d,%d,%d."
-	     "CALLCAR[0..4]:%d,%d,%d,%d,%d.\n",
-	     FLOOR, FLOOR, CALLCAR[FLOOR],
-	     FLOOR, CALLUP[FLOOR], FLOOR, CALLDOWN[FLOOR],
-	     CALLUP[0], CALLUP[1], CALLUP[2], CALLUP[3], CALLUP[4],
-	     CALLDOWN[0], CALLDOWN[1], CALLDOWN[2], CALLDOWN[3], CALLDOWN[4],
-	     CALLCAR[0], CALLCAR[1], CALLCAR[2], CALLCAR[3], CALLCAR[4]);
-	if (CALLCAR[FLOOR] || CALLDOWN[FLOOR] ||
-	    ((FLOOR == 2 || CALLUP[FLOOR]) && all_zero)) {
-		in_WAIT(TIME + 23, E2, NO_ARG); /** change state */
+	printf("    %-10s", name);
+	if (!r) {
+		printf("no more nodes\n");
 		return;
 	}
-	else {
-		E8();		/** repeat E8 */
-	}
+	printf("TIME %ld, seq %u, %s", r->ent_time, r->seq, coroutines[r->inst].name);
+	if (r->car >= 0)
+		printf(", CAR %d", r->car);
+	if (r->user)
+		printf(", User %ld", r->user);
+	printf("\n");
 }
-void E8(void)
-{
-	FLOOR--;
-	assert(FLOOR >= MIN_FLOOR);
 
-	xlog(LOG_E, "E8(). Elevator goes down a floor. (%d->%d)\n", FLOOR+1, FLOOR);
+/* runs the simulation with backend WQ in a child, which writes to *in */
+pid_t compare_fork(const struct wait_backend * WQ, FILE ** in,
+		   int floor_nr, int home, int car_nr, const char * od_file)
+{
+	int fd[2];
+	pid_t pid;
 
-	in_WAIT(TIME + 61, E8A, NO_ARG); /** wait 61 units of time */
+	if (pipe(fd) < 0 || (pid = fork()) < 0) {
+		fprintf(stderr, "cannot fork %s: %s\n", WQ->name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		close(fd[0]);
+		compare_out = fdopen(fd[1], "w");
+		assert(compare_out);
+		sim->WQ = WQ;
+		sim_init(floor_nr, home, car_nr, od_file);
+		sim_run();
+		fclose(compare_out);
+		_exit(EXIT_SUCCESS);
+	}
+	close(fd[1]);
+	*in = fdopen(fd[0], "r");
+	assert(*in);
+	return pid;
 }
 
-/*
- * E9. [Set inaction indicator.] Set D2 <-- 0 and perform the DECISION subroutine.
- *     ( This independent action is initiated in step E3 but it is almost always
- *     canceled in step E6. See exercise 4.)  ▍
- */
-void E9(void)
+/* exits with EXIT_SUCCESS if ``backend'' executes the nodes of ``list'' */
+void compare_backends(const struct wait_backend * backend,
+		      int floor_nr, int home, int car_nr, const char * od_file)
 {
-	xlog(LOG_E, "E9(). Set inaction indicator.\n");
-
-	/** if E9 is being excuted, the elevator must be
-	 *  in ``dormant'' position E1
-	 */
-	assert(dormant);
-
-	/** E9 is not considered as an elevator step, so
-	 *  if the elevator is in this "step", its real
-	 *  step should be set.
-	 *  Because E9 is executed only when the elevator
-	 *  is in ``dormant'' position E1, current_elevator_step
-	 *  is set to E1:
-	 */
-	current_elevator_step = 0xE1;
+	const struct wait_backend * ref = &wait_backends[0];
+	struct compare_rec a;
+	struct compare_rec b;
+	FILE * in[2];
+	pid_t pid[2];
+	size_t got_a, got_b;
+	long n = 0;
+	int failed = 0;
+	int i;
 
-	D2 = 0;
-	D();
+	assert(strcmp(ref->name, "list") == 0);
+	quiet = 1;	/* the children would write the same log file */
+	fflush(stdout);
+	fflush(stderr);
+	pid[0] = compare_fork(ref, &in[0], floor_nr, home, car_nr, od_file);
+	pid[1] = compare_fork(backend, &in[1], floor_nr, home, car_nr, od_file);
+	for (;;) {
+		got_a = fread(&a, sizeof(a), 1, in[0]);
+		got_b = fread(&b, sizeof(b), 1, in[1]);
+		if (!got_a || !got_b || memcmp(&a, &b, sizeof(a)) != 0)
+			break;
+		n++;
+	}
+	if (got_a || got_b) {
+		printf("%s and %s differ at node %ld:\n", ref->name, backend->name, n + 1);
+		compare_print(ref->name, got_a ? &a : 0);
+		compare_print(backend->name, got_b ? &b : 0);
+		kill(pid[0], SIGKILL);
+		kill(pid[1], SIGKILL);
+		failed = 1;
+	}
+	for (i = 0; i < 2; i++) {
+		int status;
+		fclose(in[i]);
+		waitpid(pid[i], &status, 0);
+		if (!failed && (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			fprintf(stderr, "the run with %s has failed\n",
+				i ? backend->name : ref->name);
+			failed = 1;
+		}
+	}
+	if (!failed)
+		printf("%s and %s: the same %ld nodes, in the same order.\n",
+		       ref->name, backend->name, n);
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 void dummy_func(void)
@@ -1490,71 +4777,355 @@ void dummy_func(void)
  * |  \/  |   /     \    |    |  \ |
  * |      |  /       \  -+-   |   \|
  */
-int main()
+void print_usage(const char * bin_name)
 {
 	int i;
-	for (i = MIN_FLOOR; i <= MAX_FLOOR; i++) {
-		QUEUE[i].QL = &QUEUE[i];
-		QUEUE[i].QR = &QUEUE[i];
-	}
-	WAIT.WL = &WAIT;
-	WAIT.WR = &WAIT;
-	WAIT.ent_time = 0;
-	WAIT.inst = dummy_func;
-	ELEVATOR.EL = &ELEVATOR;
-	ELEVATOR.ER = &ELEVATOR;
-
-	/* xlog_state("***** data structures *****"); */
-
-	in_WAIT(0, E1, NO_ARG);
+	printf("USAGE:\n"
+	       "        $ %s [-w backend] [-f floors] [-c cars] [-h home]\n"
+	       "            [-n users [-r intertime] [-g giveup] [-m od_file] [-s seed]]\n"
+	       "            [-i replay_file] [-P policy] [-q] [-t trace_file]\n"
+	       "            [-M [period:]metrics_file] [-Z]\n"
+	       "        $ %s ... -C backend\n"
+	       "        $ %s -e csv_file replay_file\n"
+	       "        $ %s ... -S time:snapshot_file\n"
+	       "        $ %s -L snapshot_file [-F branches [-j threads]] [-s seed] [-r ...] [-g ...]\n"
+	       "        $ %s -n users ... -R replications [-j threads] [-B]\n"
+	       "        $ %s -n users ... -K banks[:period] [-j threads]\n"
+	       "        $ %s -d trace_file\n"
+	       "    -n  simulate this many random users instead of users[]\n"
+	       "    -r  mean INTERTIME of the Poisson arrivals (default %d)\n"
+	       "    -g  GIVEUPTIME: fixed:T, uniform:T1:T2 or exp:T (default fixed:%d)\n"
+	       "    -m  origin/destination matrix, floors x floors weights\n"
+	       "    -i  replay the users of a file of ENTERTIME,IN,OUT,GIVEUPTIME rows\n"
+	       "    -e  convert such a CSV file to the binary form, which -i reads faster\n"
+	       "    -q  quiet, no log\n"
+	       "    -C  check that a backend executes the same nodes as list, no log\n"
+	       "    -t  write a binary trace instead of the log (see trace_rec())\n"
+	       "    -d  decode a binary trace to stdout\n"
+	       "    -R  run this many replications (seeds seed, seed+1, ...), no log\n"
+	       "    -j  threads of the replications (default: the number of CPUs)\n"
+	       "    -P  dispatch policy (default knuth)\n"
+	       "    -B  benchmark all the dispatch policies on the same replications\n"
+	       "    -S  stop at TIME time, and write the state to snapshot_file\n"
+	       "    -L  go on from a snapshot, with its building, policy and workload\n"
+	       "    -F  fork this many branches from the snapshot (seeds seed, seed+1, ...)\n"
+	       "    -M  write the metrics at the end, and every period of TIME if given\n"
+	       "    -Z  skip the steps of the idle cars going home, see idle_home()\n"
+	       "    -K  simulate this many independent banks (seeds seed, seed+1, ...),\n"
+	       "        observed every period of TIME if given\n"
+	       "backends of the WAIT list:\n",
+	       bin_name, bin_name, bin_name, bin_name, bin_name, bin_name, bin_name,
+	       bin_name, DEFAULT_INTERTIME, DEFAULT_GIVEUPTIME);
+	for (i = 0; i < sizeof(wait_backends)/sizeof(wait_backends[0]); i++)
+		printf("        %s\n", wait_backends[i].name);
+	printf("dispatch policies:\n");
+	for (i = 0; i < sizeof(dispatch_policies)/sizeof(dispatch_policies[0]); i++)
+		printf("        %s\n", dispatch_policies[i].name);
+}
 
-	for(i = 0; i < sizeof(users) / sizeof(users[0]) - 1; i++) {
-		xlog(LOG_PLAIN, "IN:%d; OUT:%d; GIVEUPTIME:%d; INTERTIME: %d; %s\n",
-		     users[i].IN,
-		     users[i].OUT,
-		     users[i].GIVEUPTIME,
-		     users[i+1].ENTERTIME - users[i].ENTERTIME,
-		     users[i].name);
-		in_WAIT(users[i].ENTERTIME, U1, &users[i]);
+int main(int argc, char * argv[])
+{
+	int i;
+	int floor_nr = DEFAULT_FLOOR_NR;
+	int home     = DEFAULT_HOME;
+	int car_nr   = DEFAULT_CAR_NR;
+	const char * od_file = 0;
+	const char * replay_file = 0;
+	const struct wait_backend * compare = 0;
+#ifndef NO_TRACE
+	const char * trace_file = 0;
+#endif
+	int rep_nr   = 0;
+	int bench    = 0;
+	long snap_time = -1;
+	const char * snap_file = 0;
+	const char * load_file = 0;
+	int branch_nr = 0;
+	const char * metrics_file = 0;
+	int bank_nr = 0;
+	long bank_period = 0;
+	struct workload given;	/* -s, -r and -g, which override a snapshot */
+	int given_s = 0;
+	int given_r = 0;
+	int given_g = 0;
+	int given_P = 0;
+	int thread_nr = sysconf(_SC_NPROCESSORS_ONLN);
+	struct timespec t0;
+	struct timespec t1;
+
+	sim = &main_sim;
+	sim->W.intertime = DEFAULT_INTERTIME;
+	sim->W.giveup    = GIVEUP_FIXED;
+	sim->W.giveup_a  = DEFAULT_GIVEUPTIME;
+	sim->W.rng       = 1;
+
+	sim->WQ = &wait_backends[1];	/* binheap */
+	sim->DP = &dispatch_policies[0];	/* knuth */
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			int k;
+			sim->WQ = 0;
+			for (k = 0; k < sizeof(wait_backends)/sizeof(wait_backends[0]); k++)
+				if (strcmp(argv[i+1], wait_backends[k].name) == 0)
+					sim->WQ = &wait_backends[k];
+			if (!sim->WQ) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+			int k;
+			for (k = 0; k < sizeof(wait_backends)/sizeof(wait_backends[0]); k++)
+				if (strcmp(argv[i+1], wait_backends[k].name) == 0)
+					compare = &wait_backends[k];
+			if (!compare) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+			int k;
+			sim->DP = 0;
+			for (k = 0; k < sizeof(dispatch_policies)/sizeof(dispatch_policies[0]); k++)
+				if (strcmp(argv[i+1], dispatch_policies[k].name) == 0)
+					sim->DP = &dispatch_policies[k];
+			if (!sim->DP) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			given_P = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-B") == 0) {
+			bench = 1;
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			floor_nr = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			car_nr = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+			home = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			sim->W.user_nr = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			sim->W.intertime = atof(argv[++i]);
+			given_r = 1;
+		}
+		else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+			if (!parse_giveup(argv[++i])) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			given_g = 1;
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			od_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			replay_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "-e") == 0 && i + 2 < argc) {
+			replay_encode(argv[i+1], argv[i+2]);
+			exit(EXIT_SUCCESS);
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			sim->W.rng = strtoull(argv[++i], 0, 0);
+			given_s = 1;
+		}
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+			char * p;
+			snap_time = strtol(argv[++i], &p, 10);
+			if (*p != ':' || snap_time < 0 || !p[1]) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			snap_file = p + 1;
+		}
+		else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+			load_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+			char * p;
+			sim->M.period = strtol(argv[++i], &p, 10);
+			if (*p == ':' && p != argv[i] && sim->M.period > 0 && p[1])
+				metrics_file = p + 1;
+			else {
+				sim->M.period = 0;
+				metrics_file = argv[i];
+			}
+		}
+		else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+			branch_nr = atoi(argv[++i]);
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-K") == 0 && i + 1 < argc) {
+			char * p;
+			bank_nr = strtol(argv[++i], &p, 10);
+			if (*p == ':')
+				bank_period = strtol(p + 1, &p, 10);
+			if (*p || bank_nr < 1 || bank_period < 0) {
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-Z") == 0) {
+			idle_skip = 1;
+		}
+		else if (strcmp(argv[i], "-q") == 0) {
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+			rep_nr = atoi(argv[++i]);
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			thread_nr = atoi(argv[++i]);
+		}
+#ifndef NO_TRACE
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			trace_file = argv[++i];
+			quiet = 1;
+		}
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			trace_decode(argv[++i]);
+			exit(EXIT_SUCCESS);
+		}
+#endif
+		else {
+			print_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	/* xlog_state("***** data structures *****"); */
-
-	xlog(LOG_PLAIN, "\n"
-	     "=================================================="
-	     "execute the WAIT list"
-	     "=================================================="
-	     "\n");
-	current_step = WAIT.WR;
-	for (; current_step != &WAIT; current_step = current_step->WR) {
-		const char * p = get_func_info(current_step->inst, GET_FUNC_NAME);
-		if (p[0] == 'E') {
-			current_elevator_step = p[1] - '0' + 0xE0;
+	/* users[] needs the 5 floors of the book, the other workloads 2 */
+	if (floor_nr < 2 || car_nr < 1 ||
+	    (floor_nr < DEFAULT_FLOOR_NR &&
+	     sim->W.user_nr == 0 && !replay_file && !load_file) ||
+	    home < MIN_FLOOR || home >= floor_nr ||
+	    rep_nr < 0 || ((rep_nr || bench) && (sim->W.user_nr == 0 || thread_nr < 1)) ||
+	    (replay_file && (sim->W.user_nr || rep_nr || bench)) ||
+	    ((snap_file || load_file) && (rep_nr || bench)) ||
+	    (load_file && (snap_file || sim->W.user_nr || od_file)) ||
+	    branch_nr < 0 || (branch_nr && (!load_file || thread_nr < 1)) ||
+	    (metrics_file && (rep_nr || bench || branch_nr)) ||
+	    (compare && (rep_nr || bench || snap_file || load_file || metrics_file || bank_nr)) ||
+	    (bank_nr && (sim->W.user_nr == 0 || thread_nr < 1 || rep_nr || bench ||
+			 snap_file || load_file || metrics_file))) {
+		print_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (bench) {
+		run_benchmark(rep_nr ? rep_nr : 1, thread_nr,
+			      floor_nr, home, car_nr, od_file);
+		exit(EXIT_SUCCESS);
+	}
+	if (bank_nr) {
+		run_campus(bank_nr, bank_period, thread_nr,
+			   floor_nr, home, car_nr, od_file);
+		exit(EXIT_SUCCESS);
+	}
+	if (rep_nr) {
+		struct replicator R;
+		replicator_init(&R, rep_nr, floor_nr, home, car_nr, od_file);
+		run_replications(&R, thread_nr);
+		report_replications(&R, thread_nr);
+		free(R.reps);
+		exit(EXIT_SUCCESS);
+	}
 
-			assert(current_elevator_step >= 0xE1);
-			assert(current_elevator_step <= 0xE9);
+	if (replay_file)
+		replay_open(replay_file);
+	if (compare)
+		compare_backends(compare, floor_nr, home, car_nr, od_file);
+	if (metrics_file) {
+		sim->M.out = fopen(metrics_file, "w");
+		if (!sim->M.out) {
+			fprintf(stderr, "%s: %s\n", metrics_file, strerror(errno));
+			exit(EXIT_FAILURE);
 		}
-		xlog_state("", 1);
-		xlog(LOG_FUNC_NAME, " %s - %s\n",
-		     get_func_info(current_step->inst, GET_FUNC_NAME),
-		     get_func_info(current_step->inst, GET_FUNC_DESC));
-
-		/* execute this node */
-		if (p[0] == 'E') {
-			funcE fe = (funcE)current_step->inst;
-			assert(current_step->arg == 0);
-			fe();
+	}
+	if (load_file) {
+		const struct dispatch_policy * policy = sim->DP;
+		given = sim->W;
+		snapshot_load(load_file);
+		if (given_P && policy != sim->DP) {
+			fprintf(stderr, "%s: the policy is %s\n", load_file, sim->DP->name);
+			exit(EXIT_FAILURE);
 		}
-		else if (p[0] == 'U') {
-			funcU fu = (funcU)current_step->inst;
-			fu(current_step->arg);
+		if (given_s)
+			sim->W.rng = given.rng;
+		if (given_r)
+			sim->W.intertime = given.intertime;
+		if (given_g) {
+			sim->W.giveup   = given.giveup;
+			sim->W.giveup_a = given.giveup_a;
+			sim->W.giveup_b = given.giveup_b;
 		}
-
-		assert(current_elevator_step != 0xE9); /* see E9() */
 	}
-	xlog_state("", 1);
+	else
+		sim_init(floor_nr, home, car_nr, od_file);
+	if (branch_nr) {
+		struct replicator R;
+		replicator_init(&R, 0, sim->B.floor_nr, sim->B.home, sim->B.car_nr, 0);
+		free(R.reps);
+		R.rep_nr = branch_nr;
+		run_branches(&R, thread_nr);
+		printf("%d branches from %s (TIME %ld), %d floors, %d cars, "
+		       "policy %s, on %d processes.\n\n",
+		       branch_nr, load_file, current_step ? TIME : 0,
+		       sim->B.floor_nr, sim->B.car_nr, sim->DP->name, thread_nr);
+		report_stats(&R);
+		exit(EXIT_SUCCESS);
+	}
+#ifndef NO_TRACE
+	if (trace_file)
+		trace_open(trace_file);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (snap_file) {
+		sim_start();
+		snapshot_write(snap_file, sim_loop(snap_time));
+	}
+	else if (load_file)
+		sim_loop(LONG_MAX);
+	else
+		sim_run();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+#ifndef NO_TRACE
+	trace_close();
+#endif
+	if (replay_file)
+		replay_close();
+	if (sim->M.out) {
+		metrics_dump(current_step ? TIME : sim->M.start);
+		fclose(sim->M.out);
+	}
+	xlog_state("", 1, &sim->B.cars[0]);
 
 	/* done */
+	double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	struct replication r;
+	replication_stats(&r);
+	fprintf(stderr,
+		"users: %ld delivered, %ld gave up, at most %ld in the system.\n"
+		"wait: mean %.1f, p50 %.0f, p95 %.0f, p99 %.0f.\n"
+		"events: %ld in %.3f s (%.0f events/s), simulated TIME %ld.\n",
+		sim->W.delivered, sim->W.gave_up, sim->W.max_in_system,
+		r.wait_mean, r.wait_p50, r.wait_p95, r.wait_p99,
+		event_nr, sec, sec > 0 ? event_nr / sec : 0, TIME);
+	if (idle_skip)
+		fprintf(stderr, "idle: %ld steps elided.\n", elided_nr);
+	slab_report(&sim->WAIT_slab);
+	slab_report(&sim->USER_slab);
+	slab_report(&sim->user_info_slab);
 	xlog(LOG_CLOSE, "\nDONE.\n");
 	exit(EXIT_SUCCESS);
 }